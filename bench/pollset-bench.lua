@@ -0,0 +1,302 @@
+-- luacheck: ignore 611
+-- ***************************************************************
+--
+-- Benchmark the pollset implementations.
+--
+-- For each implementation compiled into org.conman.pollset, this measures
+-- the cost of set:insert(), set:update() and set:remove() per file, and
+-- the latency of set:wait() plus dispatching the events with set:ievents(),
+-- for various numbers of files and ratios of active (readable) files.
+-- Results are written to stdout as CSV (default) or JSON, one record per
+-- implementation, file count and active ratio.
+--
+-- Usage:       lua bench/pollset-bench.lua [options]
+--
+--      -f | --format csv|json                  output format
+--      -i | --implementation name[,name...]    implementations to test
+--      -n | --files count[,count...]           file counts
+--      -a | --active ratio[,ratio...]          active ratios (0 .. 1)
+--      -r | --rounds count                     waits per measurement
+--      -t | --type socket|pipe                 file type
+--      -h | --help                             this text
+--
+-- ********************************************************************
+
+local getopt  = require "org.conman.getopt".getopt
+local pollset = require "org.conman.pollset"
+local net     = require "org.conman.net"
+local fsys    = require "org.conman.fsys"
+local clock   = require "org.conman.clock"
+local process = require "org.conman.process"
+
+local FORMAT = 'csv'
+local IMPL   = { 'epoll' , 'uring' , 'kqueue' , 'poll' , 'select' }
+local FILES  = { 10 , 100 , 1000 , 10000 , 50000 }
+local ACTIVE = { 0.001 , 0.01 , 0.1 , 1.0 }
+local ROUNDS = 100
+local TYPE   = 'socket'
+
+local FIELDS =
+{
+  'implementation' , 'type'      , 'files'     , 'active'    , 'ratio'     ,
+  'insert_ns'      , 'update_ns' , 'remove_ns' , 'wait_mean_us' ,
+  'wait_p50_us'    , 'wait_p99_us' , 'events'
+}
+
+-- ***********************************************************************
+
+local function list(s,conv)
+  local r = {}
+  for item in s:gmatch("[^,]+") do
+    r[#r + 1] = conv and conv(item) or item
+  end
+  return r
+end
+
+-- ***********************************************************************
+
+local function usage()
+  io.stderr:write(string.format([[
+usage: %s [options]
+        -f | --format csv|json                  output format (%s)
+        -i | --implementation name[,name...]    implementations to test
+        -n | --files count[,count...]           file counts
+        -a | --active ratio[,ratio...]          active ratios (0 .. 1)
+        -r | --rounds count                     waits per measurement (%d)
+        -t | --type socket|pipe                 file type (%s)
+        -h | --help                             this text
+]],arg[0],FORMAT,ROUNDS,TYPE))
+  os.exit(0,true)
+end
+
+-- ***********************************************************************
+
+local function now()
+  return clock.get('monotonic')
+end
+
+-- ***********************************************************************
+-- Create count pairs of files.  reader[i] is inserted into the set,
+-- writer[i] makes it readable.  Returns fewer if we run out of files.
+-- ***********************************************************************
+
+local function files(count)
+  local reader = {}
+  local writer = {}
+  
+  for i = 1 , count do
+    if TYPE == 'pipe' then
+      local pipe = fsys.pipe()
+      if not pipe then break end
+      pipe.read:setvbuf('no')
+      pipe.write:setvbuf('no')
+      reader[i] = pipe.read
+      writer[i] = pipe.write
+    else
+      local a,b = net.socketpair()
+      if not a then break end
+      reader[i] = a
+      writer[i] = b
+    end
+  end
+  
+  return reader,writer
+end
+
+-- ***********************************************************************
+
+local function poke(writer)
+  if TYPE == 'pipe' then
+    writer:write("x")
+  else
+    writer:send(nil,"x")
+  end
+end
+
+-- ***********************************************************************
+
+local function drain(reader)
+  if TYPE == 'pipe' then
+    reader:read(1)
+  else
+    reader:recv()
+  end
+end
+
+-- ***********************************************************************
+
+local function timeit(count,f)
+  local start = now()
+  for i = 1 , count do
+    if f(i) ~= 0 then return end
+  end
+  return (now() - start) / count * 1e9
+end
+
+-- ***********************************************************************
+
+local function waits(set,reader,writer,count,active)
+  local step    = count / active
+  local samples = {}
+  local events  = 0
+  
+  for i = 0 , active - 1 do
+    poke(writer[math.floor(i * step) + 1])
+  end
+  
+  for r = 1 , ROUNDS do
+    local start = now()
+    set:wait(0)
+    for _ in set:ievents() do
+      events = events + 1
+    end
+    samples[r] = (now() - start) * 1e6
+  end
+  
+  for i = 0 , active - 1 do
+    drain(reader[math.floor(i * step) + 1])
+  end
+  
+  table.sort(samples)
+  local total = 0
+  for _,sample in ipairs(samples) do
+    total = total + sample
+  end
+  
+  return total / ROUNDS,
+         samples[math.max(1,math.floor(ROUNDS * 0.50))],
+         samples[math.max(1,math.floor(ROUNDS * 0.99))],
+         events / ROUNDS
+end
+
+-- ***********************************************************************
+
+local function bench(impl,reader,writer,count,results)
+  local set = pollset(impl)
+  if not set or set._implementation ~= impl then
+    return false
+  end
+  
+  local added  = 0
+  local insert = timeit(count,function(i)
+    local err = set:insert(reader[i],'r')
+    if err == 0 then added = i end
+    return err
+  end)
+  
+  if not insert then
+    io.stderr:write(string.format("%s: can't handle %d files\n",impl,count))
+    for i = 1 , added do
+      set:remove(reader[i])
+    end
+    return false
+  end
+  
+  local update = timeit(count,function(i) return set:update(reader[i],'r') end) or -1
+  local rows   = {}
+  
+  for _,ratio in ipairs(ACTIVE) do
+    local active = math.min(count,math.max(1,math.floor(count * ratio + 0.5)))
+    local mean,p50,p99,events = waits(set,reader,writer,count,active)
+    rows[#rows + 1] =
+    {
+      implementation = impl,
+      type           = TYPE,
+      files          = count,
+      active         = active,
+      ratio          = ratio,
+      update_ns      = update,
+      insert_ns      = insert,
+      wait_mean_us   = mean,
+      wait_p50_us    = p50,
+      wait_p99_us    = p99,
+      events         = events,
+    }
+  end
+  
+  local remove = timeit(count,function(i) return set:remove(reader[i]) end)
+  for _,row in ipairs(rows) do
+    row.remove_ns = remove or -1
+    results[#results + 1] = row
+  end
+  
+  return true
+end
+
+-- ***********************************************************************
+
+local function csv(results)
+  print(table.concat(FIELDS,","))
+  for _,row in ipairs(results) do
+    local line = {}
+    for i,field in ipairs(FIELDS) do
+      if type(row[field]) == 'number' and math.floor(row[field]) ~= row[field] then
+        line[i] = string.format("%.3f",row[field])
+      else
+        line[i] = tostring(row[field])
+      end
+    end
+    print(table.concat(line,","))
+  end
+end
+
+-- ***********************************************************************
+
+local function json(results)
+  local out = {}
+  for _,row in ipairs(results) do
+    local line = {}
+    for i,field in ipairs(FIELDS) do
+      if type(row[field]) == 'string' then
+        line[i] = string.format("%q:%q",field,row[field])
+      elseif math.floor(row[field]) ~= row[field] then
+        line[i] = string.format("%q:%.3f",field,row[field])
+      else
+        line[i] = string.format("%q:%d",field,row[field])
+      end
+    end
+    out[#out + 1] = "  {" .. table.concat(line,",") .. "}"
+  end
+  print("[\n" .. table.concat(out,",\n") .. "\n]")
+end
+
+-- ***********************************************************************
+
+getopt(arg,
+  {
+    { 'f' , 'format'         , true  , function(v) FORMAT = v end } ,
+    { 'i' , 'implementation' , true  , function(v) IMPL   = list(v) end } ,
+    { 'n' , 'files'          , true  , function(v) FILES  = list(v,tonumber) end } ,
+    { 'a' , 'active'         , true  , function(v) ACTIVE = list(v,tonumber) end } ,
+    { 'r' , 'rounds'         , true  , function(v) ROUNDS = tonumber(v) end } ,
+    { 't' , 'type'           , true  , function(v) TYPE   = v end } ,
+    { 'h' , 'help'           , false , usage } ,
+  }
+)
+
+if FORMAT ~= 'csv' and FORMAT ~= 'json' then usage() end
+if TYPE ~= 'socket' and TYPE ~= 'pipe' then usage() end
+
+table.sort(FILES)
+process.limits.soft.nofile = process.limits.hard.nofile
+
+local reader,writer = files(FILES[#FILES])
+local results       = {}
+
+for _,impl in ipairs(IMPL) do
+  for _,count in ipairs(FILES) do
+    if count > #reader then
+      io.stderr:write(string.format("%s: only %d files available, skipping %d\n",impl,#reader,count))
+      break
+    end
+    if not bench(impl,reader,writer,count,results) then
+      break
+    end
+  end
+end
+
+if FORMAT == 'json' then
+  json(results)
+else
+  csv(results)
+end
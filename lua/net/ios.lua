@@ -39,18 +39,30 @@
 --		errmsg (string/optional) error message
 --		err (integer/optional) system error code
 --
+-- and optionally a third:
+--
+-- Usage:	okay[,errmsg,err] = _drainv(ios,chunks)
+-- Desc:	Write a list of strings to a destination object (say, with
+--		writev()), in order.  If not provided, the strings are
+--		concatenated and given to _drain().
+-- Input:	ios (table) Input/Ouput object
+--		chunks (array) strings to write
+-- Return:	okay (boolean) true if success, false if error
+--		errmsg (string/optional) error message
+--		err (integer/optional) system error code
+--
 -- ===================================================================
 
+local buffer = require "org.conman.net.buffer"
 local string = require "string"
 local table  = require "table"
-local math   = require "math"
 
-local select    = select
-local type      = type
-local error     = error
-local unpack    = table.unpack or unpack
-local tonumber  = tonumber
-local tointeger = math.tointeger or function(s) return tonumber(s) end
+local select       = select
+local type         = type
+local error        = error
+local tostring     = tostring
+local setmetatable = setmetatable
+local unpack       = table.unpack or unpack
 
 -- *******************************************************************
 
@@ -60,89 +72,44 @@ local function refill(ios)
     if errm then error { errm,err } end
     ios._eof = true
   else
-    ios._readbuf = ios._readbuf .. data
+    ios._readbuf:append(data)
   end
   return data
 end
 
+-- *******************************************************************
+-- Return whatever is left in the read buffer at EOF, and mark it as
+-- returned (so the next read returns nil).
+-- *******************************************************************
+
+local function remaining(ios)
+  local buf    = ios._readbuf
+  ios._readbuf = nil
+  return buf and buf:get()
+end
+
 -- *******************************************************************
 -- usage:       number = read_number(ios)
 -- desc:        Read a number (in text form) to a number
 -- input:       ios (table) Input/Output object
 -- return:      number (number) data from source, nil on error
 --
--- Note:        This is a direct translation of read_number() from
---              liolib.c
+-- Note:        The scanning follows read_number() from liolib.c, and is
+--              done by the read buffer.
 -- *******************************************************************
 
 local function read_number(ios)
-  local function nextc(rn)
-    if #rn.buff >= 200 then
-      return false
-    else
-      rn.buff = rn.buff .. rn.c
-      rn.c    = ios:read(1)
-      return true
-    end
-  end
-  
-  local function test2(rn,c1,c2)
-    if rn.c == c1 or rn.c == c2 then
-      return nextc(rn)
-    else
-      return false
-    end
-  end
-  
-  local function readdigits(rn,hex)
-    local count = 0
-    while rn.c and rn.c:match(hex) and nextc(rn) do
-      count = count + 1
-    end
-    return count
-  end
-  
-  local rn        = { buff = "" , c = "" }
-  local hex       = "%d"
-  local exp1,exp2 = 'e','E'
-  local count     = 0
-  local integer   = true
-  
-  repeat
-    rn.c = ios:read(1)
-  until not rn.c or not rn.c:match"%s"
-  
-  test2(rn,'-','+')
-  if test2(rn,'0','0') then
-    if test2(rn,'x','X') then
-      hex = "%x"
-      exp1,exp2 = 'p','P'
-    else
-      count = 1
-    end
-  end
-  
-  count = count + readdigits(rn,hex)
-  if test2(rn,'.','.') then
-    count   = count + readdigits(rn,hex)
-    integer = false
-  end
-  
-  if count > 0 and test2(rn,exp1,exp2) then
-    test2(rn,'-','+')
-    readdigits(rn,"%d")
-    integer = false
+  if not ios._readbuf then
+    return nil
   end
   
-  if rn.c then
-    ios._readbuf = rn.c .. ios._readbuf -- ungetc()
+  local number,more = ios._readbuf:number(ios._eof)
+  if more then
+    refill(ios)
+    return read_number(ios)
   end
   
-  if integer then
-    return tointeger(rn.buff)
-  else
-    return tonumber(rn.buff)
-  end
+  return number
 end
 
 -- *******************************************************************
@@ -157,78 +124,46 @@ local READER READER =
   
   ['*l'] = function(ios)
     if ios._eof then
-      local data   = ios._readbuf
-      ios._readbuf = nil
-      return data
+      return remaining(ios)
     end
     
-    local s = ios._readbuf:find("[\r\n]",ios._rpos)
-    if not s then
-      ios._rpos = #ios._readbuf + 1
+    local data = ios._readbuf:line(false)
+    if not data then
       refill(ios)
       return READER['*l'](ios)
     end
     
-    local s2,e2 = ios._readbuf:find("\r?\n",s)
-    if not s2 then
-      refill(ios)
-      return READER['*l'](ios)
-    end
-    
-    local data   = ios._readbuf:sub(1,s2-1)
-    ios._readbuf = ios._readbuf:sub(e2 + 1,-1)
-    ios._rpos    = 1
     return data
   end,
   
   -- ====================================================================
   
   ['*a'] = function(ios)
-    local data
-    
     if ios._eof then
-      if ios._readbuf then
-        data = ios._readbuf
-        ios._readbuf = nil
-      end
-      return data
+      return remaining(ios)
     end
     
     repeat
-      data = refill(ios)
+      local data = refill(ios)
     until not data
     
-    data         = ios._readbuf
-    ios._readbuf = nil
-    ios._eof     = true
-    return data
+    ios._eof = true
+    return remaining(ios)
   end,
   
   -- ====================================================================
   
   ['*L'] = function(ios)
     if ios._eof then
-      local data = ios._readbuf
-      ios._readbuf = nil
-      return data
+      return remaining(ios)
     end
     
-    local s = ios._readbuf:find("[\r\n]",ios._rpos)
-    if not s then
-      ios._rpos = #ios._readbuf + 1
+    local data = ios._readbuf:line(true)
+    if not data then
       refill(ios)
       return READER['*L'](ios)
     end
     
-    local s2,e2 = ios._readbuf:find("\r?\n",s)
-    if not s2 then
-      refill(ios)
-      return READER['*L'](ios)
-    end
-    
-    local data   = ios._readbuf:sub(1,e2)
-    ios._readbuf = ios._readbuf:sub(e2 + 1,-1)
-    ios._rpos    = 1
     return data
   end,
   
@@ -236,46 +171,19 @@ local READER READER =
   
   ['*h'] = function(ios)
     if ios._eof then
-      local data = ios._readbuf
-      ios._readbuf = nil
-      return data
-    end
-    
-    -- ------------------------
-    -- Scan for first CR or LF
-    -- ------------------------
-    
-    local s = ios._readbuf:find("[\r\n]",ios._rpos)
-    if not s then
-      ios._rpos = #ios._readbuf + 1
-      refill(ios)
-      return READER['*h'](ios)
-    end
-    
-    -- ---------------
-    -- Check for CRLF
-    -- ---------------
-    
-    local s2 = ios._readbuf:find("\r?\n",s)
-    if not s2 then
-      refill(ios)
-      return READER['*h'](ios)
+      return remaining(ios)
     end
     
     -- --------------------------------------------------
-    -- Check for CRLFCRLF.
+    -- Everything up to and including the first blank line
     -- --------------------------------------------------
     
-    local s3,e3 = ios._readbuf:find("\r?\n\r?\n",s2)
-    
-    if not s3 then
+    local data = ios._readbuf:header()
+    if not data then
       refill(ios)
       return READER['*h'](ios)
     end
     
-    local data   = ios._readbuf:sub(1,e3)
-    ios._readbuf = ios._readbuf:sub(e3+1,-1)
-    ios._rpos    = 1
     return data
   end,
   
@@ -283,19 +191,14 @@ local READER READER =
   
   ['*b'] = function(ios)
     if ios._eof then
-      local data   = ios._readbuf
-      ios._readbuf = nil
-      return data
+      return remaining(ios)
     end
     
-    if ios._readbuf == "" then
+    if #ios._readbuf == 0 then
       refill(ios)
     end
     
-    local data   = ios._readbuf
-    ios._readbuf = ""
-    ios._rpos    = 1
-    return data
+    return ios._readbuf:get()
   end,
 }
 
@@ -308,40 +211,92 @@ READER['b'] = READER['*b'] -- extension
 
 -- *******************************************************************
 
+-- Output is kept as a list of strings (ios._writebuf), with the total
+-- size in ios._wbuflen, so nothing is concatenated until (and unless) it
+-- has to be.
+-- *******************************************************************
+
+local function drain(ios,count)
+  local queue = ios._writebuf
+  count       = count or #queue
+  
+  if count == 0 then
+    return true
+  end
+  
+  local chunks = queue
+  if count < #queue then
+    chunks = { unpack(queue,1,count) }
+  end
+  
+  local okay,errm,err
+  if ios._drainv then
+    okay,errm,err = ios:_drainv(chunks)
+  else
+    okay,errm,err = ios:_drain(table.concat(chunks))
+  end
+  
+  if okay then
+    if count == #queue then
+      ios._writebuf = {}
+      ios._wbuflen  = 0
+    else
+      local size = #queue
+      for i = 1 , count do
+        ios._wbuflen = ios._wbuflen - #queue[i]
+      end
+      for i = 1 , size - count do
+        queue[i] = queue[i + count]
+      end
+      for i = size - count + 1 , size do
+        queue[i] = nil
+      end
+    end
+  end
+  
+  return okay,errm,err
+end
+
+-- *******************************************************************
+-- Usage:       okay[,errmsg,err] = MODE[mode](ios,first)
+-- Desc:        Write out buffered data as per the buffering mode
+-- Input:       ios (table) Input/Output object
+--              first (integer) first entry in ios._writebuf added by
+--                      the current call to ios:write()
+-- *******************************************************************
+
 local MODE MODE =
 {
   ['no'] = function(self)
-    local okay,errm,err = self:_drain(self._writebuf)
-    if okay then
-      self._writebuf = ""
-    end
-    return okay,errm,err
+    return drain(self)
   end,
   
-  ['line'] = function(self)
-    while true do
-      local nl = self._writebuf:find("\n",1,true)
-      if not nl then
-        return MODE.full(self)
-      else
-        local okay,errm,err = self:_drain(self._writebuf:sub(1,nl))
+  ['line'] = function(self,first)
+    local queue = self._writebuf
+    
+    for i = #queue , first , -1 do
+      if queue[i]:find("\n",1,true) then
+        local nl = queue[i]:find("\n[^\n]*$")
+        if nl < #queue[i] then
+          table.insert(queue,i + 1,queue[i]:sub(nl + 1,-1))
+          queue[i] = queue[i]:sub(1,nl)
+        end
+        
+        local okay,errm,err = drain(self,i)
         if not okay then
           return okay,errm,err
         end
-        self._writebuf = self._writebuf:sub(nl+1,-1)
+        break
       end
     end
+    
+    return MODE.full(self)
   end,
   
   ['full'] = function(self)
-    while #self._writebuf >= self._wsize do
-      local okay,errm,err = self:_drain(self._writebuf:sub(1,self._wsize))
-      if not okay then
-        return okay,errm,err
-      end
-      self._writebuf = self._writebuf:sub(self._wsize + 1, -1)
+    if self._wbuflen >= self._wsize then
+      return drain(self)
     end
-    
     return true
   end,
 }
@@ -377,14 +332,7 @@ end
 -- *******************************************************************
 
 local function flush(ios)
-  if #ios._writebuf > 0 then
-    local okay,errm,err = ios._drain(ios,ios._writebuf)
-    if okay then
-      ios._writebuf = ""
-    end
-    return okay,errm,err
-  end
-  return true
+  return drain(ios)
 end
 
 -- *******************************************************************
@@ -421,15 +369,11 @@ local function read(ios,...)
     end
     
     if #ios._readbuf >= amount then
-      local data   = ios._readbuf:sub(1,amount)
-      ios._readbuf = ios._readbuf:sub(amount + 1,-1)
-      return data
+      return ios._readbuf:get(amount)
     end
     
     if ios._eof then
-      local data = ios._readbuf
-      ios._readbuf = ""
-      return data
+      return ios._readbuf:get()
     end
     
     refill(ios)
@@ -544,23 +488,57 @@ local function write(ios,...)
     return false,"stream closed",-2
   end
   
+  local queue = ios._writebuf
+  local first = #queue + 1
+  
   for i = 1 , select('#',...) do
     local data = select(i,...)
-    if type(data) ~= 'string' and type(data) ~= 'number' then
+    if type(data) == 'number' then
+      data = tostring(data)
+    elseif type(data) ~= 'string' then
       error("string or number expected, got " .. type(data))
     end
     
-    ios._writebuf = ios._writebuf .. data
+    if #data > 0 then
+      queue[#queue + 1] = data
+      ios._wbuflen      = ios._wbuflen + #data
+    end
   end
   
-  local okay,errm,err = ios:_mode()
+  local okay,errm,err = ios:_mode(first)
   okay = okay and ios or false
   return okay,errm,err
 end
 
 -- *******************************************************************
+-- Usage:       first,offset = advance(chunks,first,offset,bytes)
+-- Desc:        Skip over data written by sock:sendv(), for _drainv()
+-- Input:       chunks (array) strings being written
+--              first (integer) first unwritten entry
+--              offset (integer) bytes of chunks[first] written
+--              bytes (integer) bytes just written
+-- Return:      first (integer) first unwritten entry
+--              offset (integer) bytes of chunks[first] written
+-- *******************************************************************
+
+local function advance(chunks,first,offset,bytes)
+  while bytes > 0 do
+    local left = #chunks[first] - offset
+    if bytes >= left then
+      bytes  = bytes - left
+      first  = first + 1
+      offset = 0
+    else
+      offset = offset + bytes
+      bytes  = 0
+    end
+  end
+  return first,offset
+end
 
-return function()
+-- *******************************************************************
+
+local function new()
   return {
     close   = close,   -- override
     flush   = flush,
@@ -570,9 +548,9 @@ return function()
     setvbuf = setvbuf,
     write   = write,
     
-    _readbuf  = "",
-    _rpos     = 1,
-    _writebuf = "",
+    _readbuf  = buffer.new(),
+    _writebuf = {},
+    _wbuflen  = 0,
     _wsize    = 4096,
     _mode     = MODE.full,
     _eof      = false,
@@ -580,3 +558,9 @@ return function()
     _drain    = function() error("failed to provide ios._drain()")  end,
   }
 end
+
+-- *******************************************************************
+-- Calling the module returns a new ios; advance() is also exported.
+-- *******************************************************************
+
+return setmetatable({ advance = advance },{ __call = function() return new() end })
@@ -26,6 +26,8 @@ local net    = require "org.conman.net"
 local errno  = require "org.conman.errno"
 local ios    = require "org.conman.net.ios"
 
+require "org.conman.fsys" -- for file:_tofd()
+
 local _VERSION     = _VERSION
 local setmetatable = setmetatable
 local ipairs       = ipairs
@@ -69,6 +71,67 @@ local function make_ios(conn,remote)
     end
   end
   
+  state._drainv = function(self,chunks)
+    local first  = 1
+    local offset = 0
+    
+    while first <= #chunks do
+      local bytes,err = self.__socket:sendv(chunks,first,offset)
+      if bytes <= 0 then
+        -- ------------------------------------------------------------
+        -- Nothing written and no error would just loop forever, so
+        -- treat it as the other side having gone away.
+        -- ------------------------------------------------------------
+        
+        if err == 0 then
+          err = errno.EPIPE
+        end
+        return false,errno[err],err
+      end
+      first,offset = ios.advance(chunks,first,offset,bytes)
+    end
+    
+    return true
+  end
+  
+  -- ---------------------------------------------------------------------
+  -- Usage:       bytes[,errmsg,err] = ios:sendfile(file[,offset[,length]])
+  -- Desc:        Send part of a file, without reading it into Lua
+  -- Input:       file (userdata/integer) open file, or file descriptor
+  --              offset (integer/optional) offset in file (0)
+  --              length (integer/optional) bytes to send (rest of file)
+  -- Return:      bytes (integer) bytes sent, false on error
+  --              errmsg (string/optional) error message
+  --              err (integer/optional) system error code
+  -- ---------------------------------------------------------------------
+  
+  state.sendfile = function(self,file,offset,length)
+    local okay,errmsg,err0 = self:flush()
+    if not okay then
+      return false,errmsg,err0
+    end
+    
+    local total = 0
+    offset      = offset or 0
+    
+    while length ~= 0 do
+      local bytes,err = self.__socket:sendfile(file,offset,length)
+      if bytes < 0 then
+        return false,errno[err],err
+      end
+      
+      if bytes == 0 then
+        break
+      end
+      
+      total  = total  + bytes
+      offset = offset + bytes
+      length = length and length - bytes
+    end
+    
+    return total
+  end
+  
   state.__remote = remote
   state.__socket = conn
   
@@ -19,7 +19,8 @@
 --
 -- ********************************************************************
 -- luacheck: globals SOCKETS schedule spawn timeout info dump_info
--- luacheck: globals client_eventloop server_eventloop
+-- luacheck: globals listener client_eventloop server_eventloop profile
+-- luacheck: globals watchdog checkpoint pool accepting offload finally
 -- luacheck: ignore 611
 
 local pollset   = require "org.conman.pollset"
@@ -27,6 +28,8 @@ local syslog    = require "org.conman.syslog"
 local signal    = require "org.conman.signal"
 local clock     = require "org.conman.clock"
 local errno     = require "org.conman.errno"
+local process   = require "org.conman.process"
+local threads   = require "org.conman.offload"
 local coroutine = require "coroutine"
 local table     = require "table"
 local debug     = require "debug"
@@ -35,7 +38,12 @@ local math      = require "math"
 local _VERSION     = _VERSION
 local print        = print
 local assert       = assert
+local pcall        = pcall
 local pairs        = pairs
+local ipairs       = ipairs
+local next         = next
+local type         = type
+local select       = select
 local unpack       = table.unpack or unpack
 local tostring     = tostring
 local setmetatable = setmetatable
@@ -49,109 +57,447 @@ end
 -- **********************************************************************
 
 local REFQUEUE = { _n = 0 } -- list of all coroutines (for strong reference)
-local TOQUEUE  = setmetatable({},{ __mode = "k" }) -- TimeOut queue
-local RUNQUEUE = {}         -- run queue
-      SOCKETS  = pollset()  -- event generators
+local TOQUEUE  = setmetatable({},{ __mode = "k" }) -- timers by coroutine
+local TOARGS   = setmetatable({},{ __mode = "k" }) -- ... and arguments
+local TOCOUNT  = 0          -- pending timeouts
+local RUNQUEUE = {}         -- coroutines in run queue (prevents duplicates)
+local RUNCO    = {}         -- run queue (ring buffer) of coroutines
+local RUNARGS  = {}         -- ... and their arguments (false if none)
+local RUNWHEN  = {}         -- ... and when they were scheduled
+local RUNSIZE  = 64         -- size of ring buffer
+local RUNHEAD  = 0          -- next entry to run (0 based)
+local RUNCOUNT = 0          -- entries in run queue
+local LISTENERS = {}        -- listening sockets (for workers)
+local PROFILE  = false      -- per-coroutine times, when enabled
+local CPUCLOCK = pcall(clock.get,'thread_cputime') and 'thread_cputime' or 'monotonic'
+local METRICS               -- scheduler metrics
+local WATCHDOG = false      -- slow coroutine detection, when enabled
+local POOL     = false      -- idle coroutines for spawn(), when enabled
+local IDLE     = setmetatable({},{ __mode = "k" }) -- pooled coroutines not in use
+local FINALLY  = setmetatable({},{ __mode = "k" }) -- called when coroutines finish
+local OFFLOAD  = false      -- thread pool for offload(), when first used
+local OFFWAIT  = {}         -- coroutines waiting on offload() by id
+      SOCKETS  = pollset { timerfd = false } -- event generators
       
+for i = 1 , RUNSIZE do
+  RUNCO[i]   = false
+  RUNARGS[i] = false
+  RUNWHEN[i] = 0
+end
+
+local QWAITBUCKETS = 24 -- queue wait histogram, 1us to 8s (log2)
+
+local function metrics_reset()
+  METRICS =
+  {
+    since    = clock.get('monotonic'),
+    loops    = 0,
+    resumes  = 0,
+    wait     = 0, -- time in SOCKETS:wait()
+    dispatch = 0, -- time handling events from SOCKETS
+    run      = 0, -- time running coroutines
+    qwait    = {},
+  }
+  
+  for i = 1 , QWAITBUCKETS do
+    METRICS.qwait[i] = 0
+  end
+end
+
+metrics_reset()
+
 signal.ignore('pipe')
 
 -- **********************************************************************
--- TOQUEUE:insert() and TOQUEUE:remove() are based, more or less directly,
--- up http://en.wikipedia.org/wiki/Binary_heap
+-- The run queue is a ring buffer, doubled in size when full.  Coroutines
+-- scheduled without arguments (the common case) don't allocate anything.
 -- ----------------------------------------------------------------------
 
-function TOQUEUE:insert(when,co,...)
-  local function bubble_up(parent,child)
-    if parent > 0 then
-      if self[parent].awake > self[child].awake then
-        self[parent] , self[child] = self[child] , self[parent]
-        return bubble_up(math.floor(parent / 2),parent)
-      end
+local function runqueue_grow()
+  local co   = {}
+  local args = {}
+  local when = {}
+  
+  for i = 1 , RUNSIZE * 2 do
+    if i <= RUNCOUNT then
+      local slot = (RUNHEAD + i - 1) % RUNSIZE + 1
+      co[i]      = RUNCO[slot]
+      args[i]    = RUNARGS[slot]
+      when[i]    = RUNWHEN[slot]
+    else
+      co[i]   = false
+      args[i] = false
+      when[i] = 0
     end
   end
   
-  local idx    = #self + 1
-  local parent = math.floor(idx / 2)
-  local info   =
-  {
-    awake   = clock.get('monotonic') + when,
-    trigger = true,
-    co      = co,
-    ...
-  }
+  RUNCO   = co
+  RUNARGS = args
+  RUNWHEN = when
+  RUNSIZE = RUNSIZE * 2
+  RUNHEAD = 0
+end
+
+-- **********************************************************************
+
+local function runqueue_next()
+  local slot = RUNHEAD + 1
+  local co   = RUNCO[slot]
+  local args = RUNARGS[slot]
   
-  self[idx] = info
-  self[co]  = info
-  bubble_up(parent,idx)
+  RUNCO[slot]   = false
+  RUNARGS[slot] = false
+  RUNHEAD       = slot % RUNSIZE
+  RUNCOUNT      = RUNCOUNT - 1
+  RUNQUEUE[co]  = nil
+  return co,args,RUNWHEN[slot]
 end
 
 -- **********************************************************************
 
-function TOQUEUE:remove()
-  local function bubble_down(parent,left,right)
-    local smallest = parent
-    
-    if left <= #self and self[left].awake < self[smallest].awake then
-      smallest = left
+function schedule(co , ... )
+  if not RUNQUEUE[co] then
+    if RUNCOUNT == RUNSIZE then
+      runqueue_grow()
     end
     
-    if right <= #self and self[right].awake < self[smallest].awake then
-      smallest = right
-    end
+    local slot = (RUNHEAD + RUNCOUNT) % RUNSIZE + 1
+    local n    = select('#',...)
     
-    if smallest ~= parent then
-      self[parent] , self[smallest] = self[smallest] , self[parent]
-      return bubble_down(smallest,smallest * 2,smallest * 2 + 1)
-    end
+    RUNCO[slot]   = co
+    RUNARGS[slot] = n > 0 and { n = n , ... } or false
+    RUNWHEN[slot] = clock.get('monotonic')
+    RUNCOUNT      = RUNCOUNT + 1
+    RUNQUEUE[co]  = true
   end
-  
-  local res    = self[1]
-  local x      = table.remove(self)
-  self[res.co] = nil
-  
-  if #self > 0 then
-    self[1] = x
-    bubble_down(1,2,3)
-  end
-  
-  return res
 end
 
 -- **********************************************************************
 
-function schedule(co , ... )
-  if not RUNQUEUE[co] then
-    RUNQUEUE[#RUNQUEUE + 1] = { co , ... }
-    RUNQUEUE[co] = true
-  end
+-- Pooled coroutines run pool_main(), which calls the function given to
+-- spawn() and, when it returns, yields POOLDONE back to the event loop.
+-- The next spawn() resumes it with the next function and arguments.  The
+-- tail call leaves nothing from the previous use on the stack.
+-- ----------------------------------------------------------------------
+
+local POOLDONE = {}
+
+local function pool_main(f,...)
+  f(...)
+  return pool_main(coroutine.yield(POOLDONE))
 end
 
 -- **********************************************************************
 
 function spawn(f, ...)
-  local co = coroutine.create(f)
+  local co
+  
+  if POOL then
+    -- ------------------------------------------------------------------
+    -- An idle coroutine that was scheduled anyway (a stale wakeup) can't
+    -- be used---schedule() would ignore us.  It's left to the event loop
+    -- to discard.
+    -- ------------------------------------------------------------------
+    
+    while POOL.n > 0 and not co do
+      co           = POOL[POOL.n]
+      POOL[POOL.n] = nil
+      POOL.n       = POOL.n - 1
+      if RUNQUEUE[co] then
+        co = nil
+      else
+        IDLE[co] = nil
+      end
+    end
+    
+    co = co or coroutine.create(pool_main)
+  else
+    co = coroutine.create(f)
+  end
   
   if co then
     REFQUEUE[co] = true
     REFQUEUE._n = REFQUEUE._n + 1
-    schedule(co,...)
+    if POOL then
+      schedule(co,f,...)
+    else
+      schedule(co,...)
+    end
   end
   
   return co
 end
 
+-- **********************************************************************
+-- Usage:       pool(size)
+-- Desc:        Reuse coroutines for spawn()
+-- Input:       size (integer) maximum idle coroutines kept, 0 or nil to
+--                      stop pooling
+--
+-- Note:        A pooled coroutine is only reused once its function has
+--              returned.  One that crashes is logged and dropped, as
+--              without pooling.  Don't keep references to a coroutine
+--              after its function returns---it may be running something
+--              else.  Wakeups for an idle coroutine are discarded, but
+--              sockets it waited on should be closed (or removed from
+--              SOCKETS) before its function returns.
+-- **********************************************************************
+
+function pool(size)
+  if size and size > 0 then
+    POOL     = POOL or { n = 0 }
+    POOL.max = size
+    while POOL.n > size do
+      POOL[POOL.n] = nil
+      POOL.n       = POOL.n - 1
+    end
+  else
+    POOL = false
+  end
+end
+
+-- **********************************************************************
+-- Usage:       finally(co,f)
+-- Desc:        Call a function when a coroutine finishes
+-- Input:       co (thread) coroutine
+--              f (function) called with co once the coroutine returns or
+--                      crashes, nil to remove
+--
+-- Note:        This works with pooled coroutines, and unlike pcall(), the
+--              coroutine can yield under Lua 5.1.  f() is called from
+--              the event loop, and must not yield.
+-- **********************************************************************
+
+function finally(co,f)
+  FINALLY[co] = f
+end
+
+-- **********************************************************************
+-- Timeouts are timers kept by SOCKETS (in a heap in C), so adding and
+-- cancelling one is cheap, and expired ones are returned by SOCKETS:wait().
+-- ----------------------------------------------------------------------
+
+local function timeout_cancel(co)
+  local timer = TOQUEUE[co]
+  
+  if timer then
+    SOCKETS:remove(timer)
+    TOQUEUE[co] = nil
+    TOARGS[co]  = nil
+    TOCOUNT     = TOCOUNT - 1
+  end
+end
+
+-- **********************************************************************
+
+local function timeout_expired(co)
+  local args = TOARGS[co]
+  
+  timeout_cancel(co)
+  if coroutine.status(co) ~= 'dead' then
+    if args then
+      schedule(co,unpack(args,1,args.n))
+    else
+      schedule(co)
+    end
+  end
+end
+
 -- **********************************************************************
 
 function timeout(when,...)
   local co = coroutine.running()
   
-  if when == 0 then
-    if TOQUEUE[co] then
-      assert(TOQUEUE[co].co == co)
-      TOQUEUE[co].trigger = false
+  timeout_cancel(co)
+  
+  if when ~= 0 then
+    local timer,err = SOCKETS:timer(math.max(when,0),co)
+    assert(timer,errno[err])
+    
+    local n = select('#',...)
+    
+    TOQUEUE[co] = timer
+    TOARGS[co]  = n > 0 and { n = n , ... } or nil
+    TOCOUNT     = TOCOUNT + 1
+  end
+end
+
+-- **********************************************************************
+-- Usage:       watchdog(threshold[,preempt])
+-- Desc:        Log coroutines that run too long without yielding
+-- Input:       threshold (number) seconds, 0 or nil to disable
+--              preempt (boolean/optional) checkpoint() yields once
+--                      threshold is exceeded
+--
+-- Note:        A count hook is set on each coroutine as it's resumed, so
+--              a runaway coroutine is logged while it's still running.  A
+--              coroutine blocked in a system call runs no instructions, so
+--              it's logged once it yields.  The hook replaces any hook set
+--              by the coroutine with debug.sethook().
+-- ----------------------------------------------------------------------
+
+local WDCOUNT = 1000 -- instructions between checks
+
+local function watchdog_log(co,elapsed,traceback)
+  WATCHDOG.count   = WATCHDOG.count + 1
+  WATCHDOG.flagged = true
+  syslog('warning',"WATCHDOG: coroutine %s ran for %.3fs",tostring(co),elapsed)
+  for entry in traceback:gmatch("[^%\n]+") do
+    syslog('warning',"WATCHDOG: %s: %s",tostring(co),entry)
+  end
+end
+
+-- **********************************************************************
+
+local function watchdog_hook()
+  if WATCHDOG and not WATCHDOG.flagged then
+    local elapsed = clock.get('monotonic') - WATCHDOG.start
+    if elapsed >= WATCHDOG.threshold then
+      watchdog_log(coroutine.running(),elapsed,debug.traceback("",2))
     end
+  end
+end
+
+-- **********************************************************************
+
+function watchdog(threshold,preempt)
+  if threshold and threshold > 0 then
+    WATCHDOG =
+    {
+      threshold = threshold,
+      preempt   = preempt or false,
+      count     = WATCHDOG and WATCHDOG.count or 0,
+      start     = 0,
+      flagged   = false,
+    }
   else
-    TOQUEUE:insert(when,co,...)
+    WATCHDOG = false
+  end
+end
+
+-- **********************************************************************
+-- Usage:       checkpoint()
+-- Desc:        A safe point for a long running coroutine to yield.  If the
+--              watchdog is enabled with preempt, and the coroutine has
+--              run past the threshold, it is rescheduled and yields, to
+--              let other coroutines run.  Otherwise, this does nothing.
+--
+-- Note:        Don't call this while waiting for a timeout().
+-- **********************************************************************
+
+function checkpoint()
+  if WATCHDOG and WATCHDOG.preempt then
+    if clock.get('monotonic') - WATCHDOG.start >= WATCHDOG.threshold then
+      local co = coroutine.running()
+      schedule(co)
+      coroutine.yield()
+    end
+  end
+end
+
+-- **********************************************************************
+-- Usage:       ... = offload(op,...)
+-- Desc:        Run a blocking operation on a thread, yielding the calling
+--              coroutine until it's done.  The thread pool is created on
+--              first use.
+-- Input:       op (string) 'address2', 'stat', 'fsync' or 'read'
+--              ... parameters (see org.conman.offload)
+-- Return:      ... results of the operation; nil,err if it couldn't
+--                      be started
+--
+-- Note:        If the coroutine is resumed by something else first (say,
+--              a timeout()), that's what's returned, and the result of
+--              the operation is discarded.
+-- **********************************************************************
+
+local function offload_result(id,...)
+  if id then
+    local co = OFFWAIT[id]
+    OFFWAIT[id] = nil
+    if co then
+      schedule(co,...)
+    end
+    return true
+  end
+end
+
+-- **********************************************************************
+-- If something else resumed the coroutine (a timeout, say), it's no longer
+-- waiting, so forget it---the result, when it comes, is dropped.
+-- ----------------------------------------------------------------------
+
+local function offload_resumed(id,co,...)
+  if OFFWAIT[id] == co then
+    OFFWAIT[id] = nil
+  end
+  return ...
+end
+
+-- **********************************************************************
+
+function offload(op,...)
+  if not OFFLOAD then
+    local pool,err = threads.pool()
+    if not pool then
+      return nil,err
+    end
+    
+    OFFLOAD = pool
+    SOCKETS:insert(OFFLOAD,'r',function()
+      while offload_result(OFFLOAD:result()) do -- luacheck: ignore
+      end
+    end)
+  end
+  
+  local id,err = OFFLOAD:submit(op,...)
+  if not id then
+    return nil,err
+  end
+  
+  local co = coroutine.running()
+  OFFWAIT[id] = co
+  return offload_resumed(id,co,coroutine.yield())
+end
+
+-- **********************************************************************
+-- A coroutine finished, and is no longer counted as running.  Only those
+-- started with spawn() are counted, but any coroutine can be scheduled.
+-- **********************************************************************
+
+local function finished(co)
+  if REFQUEUE[co] then
+    assert(REFQUEUE._n > 0)
+    REFQUEUE[co] = nil
+    REFQUEUE._n  = REFQUEUE._n - 1
+  end
+  
+  local f = FINALLY[co]
+  if f then
+    FINALLY[co] = nil
+    f(co)
+  end
+end
+
+-- **********************************************************************
+-- A pooled coroutine finished its function.  It's no longer counted as
+-- running, and is kept for reuse unless the pool is full or it's already
+-- scheduled to run again.  It can't be waiting on offload() (that clears
+-- itself once resumed) and its timeout is cancelled here.  Wakeups that
+-- arrive while it's idle are discarded by the event loop.
+-- **********************************************************************
+
+local function pool_release(co)
+  finished(co)
+  timeout_cancel(co)
+  
+  if PROFILE then
+    PROFILE[co] = nil
+  end
+  
+  if POOL and POOL.n < POOL.max and not RUNQUEUE[co] then
+    POOL.n       = POOL.n + 1
+    POOL[POOL.n] = co
+    IDLE[co]     = true
   end
 end
 
@@ -161,63 +507,108 @@ local function eventloop(done_f)
   if done_f() then return end
   
   local timeout = -1
-  local now     = clock.get('monotonic')
-  
-  while #TOQUEUE > 0 do
-    local co = TOQUEUE[1]
-    
-    if co.trigger then
-      timeout = co.awake - now
-      if timeout > 0 then
-        break
-      end
-      
-      if coroutine.status(co.co) ~= 'dead' then
-        schedule(co.co,unpack(co))
-      end
-    end
-    
-    TOQUEUE:remove()
-  end
   
-  if #RUNQUEUE > 0 then
+  if RUNCOUNT > 0 then
     timeout = 0
   end
   
-  local okay,err = SOCKETS:wait(timeout)
+  local start     = clock.get('monotonic')
+  local okay,err  = SOCKETS:wait(timeout)
+  local waited    = clock.get('monotonic')
+  METRICS.loops   = METRICS.loops + 1
+  METRICS.wait    = METRICS.wait + waited - start
+  
   if not okay then
     syslog('error',"SOCKETS:events() = %s",errno[err])
     return eventloop(done_f)
   end
   
+  -- ----------------------------------------------------------------------
+  -- Timers other than timeouts, like SOCKETS:timer(secs,fn), are handled
+  -- like any other event.
+  -- ----------------------------------------------------------------------
+  
   for event in SOCKETS:events() do
-    event.obj(event)
+    if event.timer and TOQUEUE[event.obj] then
+      timeout_expired(event.obj)
+    else
+      event.obj(event)
+    end
   end
   
-  while #RUNQUEUE > 0 do
-    local co        = table.remove(RUNQUEUE,1)
-    RUNQUEUE[co[1]] = nil
-    
-    local status = coroutine.status(co[1])
+  local dispatched = clock.get('monotonic')
+  METRICS.dispatch = METRICS.dispatch + dispatched - waited
+  
+  while RUNCOUNT > 0 do
+    local co,args,when = runqueue_next()
+    local status       = coroutine.status(co)
     
-    if status == 'dead' then
+    if IDLE[co] then
+      syslog('debug',"A stale wakeup for idle coroutine %s was discarded",tostring(co))
+      
+    elseif status == 'dead' then
       syslog('warning',"A dead coroutine was scheduled to run")
       
     elseif status == 'suspended' then
-      local ret = { coroutine.resume(unpack(co)) }
+      local okay,err
+      local resumed = clock.get('monotonic')
+      local qwait   = (resumed - when) * 1000000
+      local bucket  = 1
+      
+      while qwait >= 1 and bucket < QWAITBUCKETS do
+        bucket = bucket + 1
+        qwait  = qwait / 2
+      end
+      
+      METRICS.qwait[bucket] = METRICS.qwait[bucket] + 1
+      METRICS.resumes       = METRICS.resumes + 1
+      
+      local cpu = PROFILE and clock.get(CPUCLOCK)
+      local wd  = WATCHDOG
+      if wd then
+        wd.start   = resumed
+        wd.flagged = false
+        debug.sethook(co,watchdog_hook,"",WDCOUNT)
+      end
+      
+      if args then
+        okay,err = coroutine.resume(co,unpack(args,1,args.n))
+      else
+        okay,err = coroutine.resume(co)
+      end
+      
+      if wd then
+        debug.sethook(co)
+        if not wd.flagged and wd == WATCHDOG then
+          local elapsed = clock.get('monotonic') - resumed
+          if elapsed >= wd.threshold then
+            watchdog_log(co,elapsed,debug.traceback(co))
+          end
+        end
+      end
+      
+      if PROFILE and cpu then
+        local prof = PROFILE[co]
+        if not prof then
+          prof        = { time = 0 , resumes = 0 }
+          PROFILE[co] = prof
+        end
+        prof.time    = prof.time + clock.get(CPUCLOCK) - cpu
+        prof.resumes = prof.resumes + 1
+      end
       
-      if not ret[1] then
-        syslog('error',"CRASH: coroutine %s dead: %s",tostring(co[1]),ret[2])
-        local msg = debug.traceback(co[1])
+      if not okay then
+        syslog('error',"CRASH: coroutine %s dead: %s",tostring(co),err)
+        local msg = debug.traceback(co)
         for entry in msg:gmatch("[^%\n]+") do
-          syslog('error',"CRASH: %s: %s",tostring(co[1]),entry)
+          syslog('error',"CRASH: %s: %s",tostring(co),entry)
         end
       end
       
-      if coroutine.status(co[1]) == 'dead' then
-        assert(REFQUEUE._n > 0)
-        REFQUEUE[co[1]] = nil
-        REFQUEUE._n     = REFQUEUE._n - 1
+      if coroutine.status(co) == 'dead' then
+        finished(co)
+      elseif err == POOLDONE then
+        pool_release(co)
       end
     
     else
@@ -242,12 +633,11 @@ local function eventloop(done_f)
       -- =====================================================================
       
       syslog('critical',"unexpected coroutine state %q",status)
-      assert(REFQUEUE._n > 0)
-      REFQUEUE[co[1]] = nil
-      REFQUEUE._n     = REFQUEUE._n - 1
+      finished(co)
     end
   end
   
+  METRICS.run = METRICS.run + clock.get('monotonic') - dispatched
   return eventloop(done_f)
 end
 
@@ -258,17 +648,331 @@ function client_eventloop(done_f)
   return eventloop(function() return REFQUEUE._n == 0 or done_f() end)
 end
 
+-- **********************************************************************
+-- Usage:       listener(sock,handler[,create])
+-- Desc:        Add a listening socket to SOCKETS, and remember it so
+--              it can be given to worker processes.
+-- Input:       sock (userdata/socket) listening socket
+--              handler (function) event handler
+--              create (function/optional) create the listening socket
+--                      | again with SO_REUSEPORT in a worker, so each
+--                      | worker has its own accept queue
+-- Return:      err (integer) system error
+-- **********************************************************************
+
+function listener(sock,handler,create)
+  LISTENERS[#LISTENERS + 1] =
+  {
+    sock    = sock,
+    handler = handler,
+    create  = create,
+    events  = 'r',
+  }
+  return SOCKETS:insert(sock,'r',handler)
+end
+
+-- **********************************************************************
+-- Usage:       err = accepting(sock,enable)
+-- Desc:        Pause or resume accepting connections on a listening
+--              socket added with listener()
+-- Input:       sock (userdata/socket) listening socket
+--              enable (boolean) true to resume, false to pause
+-- Return:      err (integer) system error
+-- **********************************************************************
+
+function accepting(sock,enable)
+  for _,l in ipairs(LISTENERS) do
+    if l.sock == sock then
+      if enable then
+        return SOCKETS:insert(sock,l.events,l.handler)
+      else
+        return SOCKETS:remove(sock)
+      end
+    end
+  end
+  return errno.ENOENT
+end
+
+-- **********************************************************************
+-- A worker gets its own SOCKETS (a pollset can't be shared across a
+-- fork()), and its own listening sockets when SO_REUSEPORT can be used.
+-- Otherwise, the workers share the listening socket.  Timeouts, sockets
+-- other than listeners and the offload() threads aren't carried over.
+-- **********************************************************************
+
+local function worker(slot,conf,done_f)
+  local listeners = LISTENERS
+  
+  -- ------------------------------------------------------------------
+  -- The inherited SOCKETS shares its kernel state with the supervisor,
+  -- so it's only closed (which also closes any timers in it), never
+  -- changed.  The offload() threads don't exist here; closing the pool
+  -- just closes its descriptors.
+  -- ------------------------------------------------------------------
+  
+  SOCKETS:close()
+  if OFFLOAD then
+    OFFLOAD:close()
+  end
+  
+  SOCKETS   = pollset { timerfd = false }
+  LISTENERS = {}
+  TOQUEUE   = setmetatable({},{ __mode = "k" })
+  TOARGS    = setmetatable({},{ __mode = "k" })
+  TOCOUNT   = 0
+  OFFLOAD   = false
+  OFFWAIT   = {}
+  metrics_reset()
+  
+  if conf.affinity then
+    local cpus = process.getaffinity()
+    if cpus then
+      process.setaffinity(0,(slot - 1) % #cpus + 1)
+    end
+  end
+  
+  for _,l in ipairs(listeners) do
+    if l.sock:_tofd() == -1 then
+      l.create()
+    else
+      l.events                  = 'rx'
+      LISTENERS[#LISTENERS + 1] = l
+      SOCKETS:insert(l.sock,'rx',l.handler)
+    end
+  end
+  
+  eventloop(done_f)
+  process.exit(0)
+end
+
+-- **********************************************************************
+
+local function supervisor(conf,done_f)
+  local workers = {}
+  local started = {}
+  local pending = {}
+  local stop    = false
+  local set     = pollset()
+  local sigs    = set:insert_signal({ 'child' , 'term' , 'int' , 'hup' , 'usr1' , 'usr2' })
+  
+  for _,l in ipairs(LISTENERS) do
+    SOCKETS:remove(l.sock)
+    if l.create and l.sock.reuseport ~= nil then
+      l.sock:close()
+    end
+  end
+  
+  local function later(slot)
+    pending[set:timer(1)] = slot
+  end
+  
+  local function start(slot)
+    local pid,err = process.fork()
+    
+    if not pid then
+      syslog('error',"fork() = %s",errno[err])
+      later(slot)
+    elseif pid == 0 then
+      set:close() -- also releases sigs and the pending timers
+      worker(slot,conf,done_f)
+    else
+      workers[pid]  = slot
+      started[slot] = clock.get('monotonic')
+    end
+  end
+  
+  local function reap()
+    while true do
+      local status = process.wait(-1,true)
+      if not status then return end
+      
+      local slot = workers[status.pid]
+      if slot and status.status ~= 'stopped' and status.status ~= nil then
+        workers[status.pid] = nil
+        if not stop then
+          syslog('warning',"worker %d (pid %d) exited: %s",slot,status.pid,status.description)
+          if clock.get('monotonic') - started[slot] < 1 then
+            later(slot)
+          else
+            start(slot)
+          end
+        end
+      end
+    end
+  end
+  
+  for slot = 1 , conf.workers do
+    start(slot)
+  end
+  
+  while not stop or next(workers) do
+    set:wait()
+    for obj,events,result in set:ievents() do
+      if events == set.TIMER then
+        local slot   = pending[obj]
+        pending[obj] = nil
+        set:remove(obj)
+        if not stop then start(slot) end
+      elseif result.signal == 'child' then
+        reap()
+      else
+        if result.signal == 'term' or result.signal == 'int' then
+          stop = true
+        end
+        for pid in pairs(workers) do
+          signal.raise(result.signal,pid)
+        end
+      end
+    end
+  end
+  
+  set:remove(sigs)
+end
+
+-- **********************************************************************
+-- Usage:       server_eventloop([done_f])
+--              server_eventloop(conf)
+-- Desc:        Run the event loop for a server
+-- Input:       done_f (function/optional) returns true when done
+--              conf (table)
+--                      * workers (integer/optional) number of worker
+--                      |       processes to fork (default, no workers)
+--                      * affinity (boolean/optional) pin each worker
+--                      |       to a CPU
+--                      * done (function/optional) returns true when
+--                      |       a worker is done
+-- Note:        With workers, this process becomes a supervisor that
+--              restarts workers that exit, and forwards the HUP, USR1,
+--              USR2, TERM and INT signals to them (and exits after them
+--              on TERM or INT).  Listening sockets should be created
+--              with nfl.tcp.listen() or nfl.tls.listen() before calling
+--              this.
 -- **********************************************************************
 
 function server_eventloop(done_f)
+  if type(done_f) == 'table' then
+    local conf = done_f
+    done_f = conf.done or function() return false end
+    if conf.workers and conf.workers > 0 then
+      return supervisor(conf,done_f)
+    end
+  end
+  
   done_f = done_f or function() return false end
   return eventloop(done_f)
 end
 
+-- **********************************************************************
+-- Timeouts and the offload() thread pool are in SOCKETS, but aren't
+-- sockets.
+-- **********************************************************************
+
+local function sockets()
+  return #SOCKETS - TOCOUNT - (OFFLOAD and 1 or 0)
+end
+
+-- **********************************************************************
+
+-- Usage:       coroutines,runqueue,timeouts,sockets = info()
+--              metrics = info(true[,reset])
+-- Desc:        Return scheduler information
+-- Input:       reset (boolean/optional) reset metrics after returning them
+-- Return:      coroutines (integer) number of coroutines
+--              runqueue (integer) coroutines ready to run
+--              timeouts (integer) pending timeouts
+--              sockets (integer) files being watched, other than
+--                      | timeouts and the offload() thread pool
+--              metrics (table)
+--                      * coroutines, runqueue, timeouts, sockets
+--                      |       (integer) as above
+--                      * seconds (number) time metrics cover
+--                      * loops (integer) times through the event loop
+--                      * resumes (integer) coroutines resumed
+--                      * rate (number) resumes per second
+--                      * phases (table) seconds spent in each phase
+--                      |       * wait - SOCKETS:wait(), which includes
+--                      |               checking timeouts
+--                      |       * dispatch - handling events
+--                      |       * run - running coroutines
+--                      * watchdog (integer) times the watchdog fired
+--                      * pool (integer) idle pooled coroutines
+--                      * queuewait (array) resumes by time between
+--                      |       schedule() and resume; [1] is under 1us,
+--                      |       [2] under 2us, [3] under 4us, and so on
+--                      * profile (table/optional) if profile(true)
+--                      |       was called, time (seconds of CPU time)
+--                      |       and resumes (integer) indexed by
+--                      |       coroutine
 -- **********************************************************************
 
-function info()
-  return REFQUEUE._n,#RUNQUEUE,#TOQUEUE,#SOCKETS
+function info(detail,reset)
+  if not detail then
+    return REFQUEUE._n,RUNCOUNT,TOCOUNT,sockets()
+  end
+  
+  local now     = clock.get('monotonic')
+  local seconds = now - METRICS.since
+  local qwait   = {}
+  
+  for i = 1 , QWAITBUCKETS do
+    qwait[i] = METRICS.qwait[i]
+  end
+  
+  local res =
+  {
+    coroutines = REFQUEUE._n,
+    runqueue   = RUNCOUNT,
+    timeouts   = TOCOUNT,
+    sockets    = sockets(),
+    seconds    = seconds,
+    loops      = METRICS.loops,
+    resumes    = METRICS.resumes,
+    rate       = seconds > 0 and METRICS.resumes / seconds or 0,
+    phases     =
+    {
+      wait     = METRICS.wait,
+      dispatch = METRICS.dispatch,
+      run      = METRICS.run,
+    },
+    queuewait  = qwait,
+    watchdog   = WATCHDOG and WATCHDOG.count or 0,
+    pool       = POOL and POOL.n or 0,
+  }
+  
+  if PROFILE then
+    res.profile = {}
+    for co,prof in pairs(PROFILE) do
+      res.profile[co] = { time = prof.time , resumes = prof.resumes }
+    end
+  end
+  
+  if reset then
+    metrics_reset()
+    if PROFILE then
+      PROFILE = setmetatable({},{ __mode = "k" })
+    end
+  end
+  
+  return res
+end
+
+-- **********************************************************************
+-- Usage:       profile(enable)
+-- Desc:        Turn per-coroutine time accounting on or off
+-- Input:       enable (boolean)
+--
+-- Note:        Time is the CPU time used by the thread running the event
+--              loop, so time a coroutine spends blocked in a system call
+--              isn't counted.  Where there's no per-thread CPU clock, it's
+--              elapsed time instead.
+-- **********************************************************************
+
+function profile(enable)
+  if enable then
+    PROFILE = PROFILE or setmetatable({},{ __mode = "k" })
+  else
+    PROFILE = false
+  end
 end
 
 -- **********************************************************************
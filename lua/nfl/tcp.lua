@@ -18,7 +18,8 @@
 -- Comments, questions and criticisms can be sent to: sean@conman.org
 --
 -- ********************************************************************
--- luacheck: globals listens listena listen connecta connect
+-- luacheck: globals listens listena listen connecta connect relay
+-- luacheck: globals max_connections accept_budget
 -- luacheck: ignore 611
 
 local syslog    = require "org.conman.syslog"
@@ -27,6 +28,9 @@ local net       = require "org.conman.net"
 local mkios     = require "org.conman.net.ios"
 local nfl       = require "org.conman.nfl"
 local coroutine = require "coroutine"
+local math      = require "math"
+
+require "org.conman.fsys" -- for file:_tofd()
 
 local _VERSION     = _VERSION
 local tostring     = tostring
@@ -40,6 +44,44 @@ else
   _ENV = {} -- luacheck: ignore
 end
 
+-- **********************************************************************
+-- Tunables for listening sockets.  max_connections is the limit of
+-- connections per listening socket; when reached, the listening socket
+-- is removed from SOCKETS until the handler for a connection finishes.
+-- accept_budget is the maximum number of connections accepted per event.
+-- **********************************************************************
+
+max_connections = math.huge
+accept_budget   = 64
+
+-- **********************************************************************
+-- Usage:       ... = waitfor(ios,what)
+-- Desc:        Wait for a connection to become readable or writable
+-- Input:       ios (table) I/O object
+--              what (string) 'r' or 'w'
+-- Return:      ... (any) values the coroutine was resumed with
+--
+-- Note:        If SOCKETS supports it, connections are registered once as
+--              edge triggered for both reading and writing, so all we do
+--              is note what the handler should wake us up for.  Otherwise,
+--              the registration is switched to writing, and the handler
+--              switches it back to reading.
+-- **********************************************************************
+
+local function resumed(ios,...)
+  ios.__want = false
+  return ...
+end
+
+local function waitfor(ios,what)
+  if ios.__edge then
+    ios.__want = what
+  elseif what == 'w' then
+    nfl.SOCKETS:update(ios.__socket,'w')
+  end
+  return resumed(ios,coroutine.yield())
+end
+
 -- **********************************************************************
 -- usage:       ios,handler = create_handler(conn,remote)
 -- desc:        Create the event handler for handing network packets
@@ -56,28 +98,119 @@ local function create_handler(conn,remote)
   ios.__output = ""
   ios.__rbytes = 0
   ios.__wbytes = 0
+  ios.__edge   = nfl.SOCKETS._flags:find('e',1,true) ~= nil
+  ios.__events = ios.__edge and 'rwe' or 'r'
+  ios.__want   = false
   
-  ios._refill = function()
-    return coroutine.yield()
+  ios._refill = function(self)
+    if not self.__edge then
+      return coroutine.yield()
+    end
+    
+    while true do
+      local _,packet,err = self.__socket:recv()
+      if packet then
+        self._eof = #packet == 0
+        return packet
+      elseif err ~= errno.EAGAIN then
+        syslog('error',"socket:recv() = %s",errno[err])
+        return false,errno[err],err
+      end
+      
+      local okay,errmsg,err1 = waitfor(self,'r')
+      if okay == false then
+        return okay,errmsg,err1
+      end
+    end
   end
   
   ios._drain = function(self,data)
     local bytes,err = self.__socket:send(nil,data)
-    if err ~= 0 then
+    if err ~= 0 and err ~= errno.EAGAIN then
       syslog('error',"socket:send() = %s",errno[err])
       return false,errno[err],err
     end
     
+    bytes        = math.max(bytes,0)
     ios.__wbytes = self.__wbytes + bytes;
     if bytes < #data then
-      nfl.SOCKETS:update(self.__socket,'w')
-      coroutine.yield()
+      waitfor(self,'w')
       data = data:sub(bytes + 1,-1)
       return self:_drain(data)
     end
     return true
   end
   
+  ios._drainv = function(self,chunks)
+    local first  = 1
+    local offset = 0
+    
+    while first <= #chunks do
+      local bytes,err = self.__socket:sendv(chunks,first,offset)
+      if err ~= 0 and err ~= errno.EAGAIN then
+        syslog('error',"socket:sendv() = %s",errno[err])
+        return false,errno[err],err
+      end
+      
+      if bytes > 0 then
+        self.__wbytes = self.__wbytes + bytes
+        first,offset  = mkios.advance(chunks,first,offset,bytes)
+      end
+      
+      if first <= #chunks then
+        waitfor(self,'w')
+      end
+    end
+    
+    return true
+  end
+  
+  -- ---------------------------------------------------------------------
+  -- Usage:       bytes[,errmsg,err] = ios:sendfile(file[,offset[,length]])
+  -- Desc:        Send part of a file, without reading it into Lua
+  -- Input:       file (userdata/integer) open file, or file descriptor
+  --              offset (integer/optional) offset in file (0)
+  --              length (integer/optional) bytes to send (rest of file)
+  -- Return:      bytes (integer) bytes sent, false on error
+  --              errmsg (string/optional) error message
+  --              err (integer/optional) system error code
+  -- ---------------------------------------------------------------------
+  
+  ios.sendfile = function(self,file,offset,length)
+    local okay,errmsg,err0 = self:flush()
+    if not okay then
+      return false,errmsg,err0
+    end
+    
+    local total = 0
+    offset      = offset or 0
+    
+    while length ~= 0 do
+      local bytes,err = self.__socket:sendfile(file,offset,length)
+      if err ~= 0 and err ~= errno.EAGAIN then
+        syslog('error',"socket:sendfile() = %s",errno[err])
+        return false,errno[err],err
+      end
+      
+      if err == 0 and bytes == 0 then
+        break
+      end
+      
+      if bytes > 0 then
+        self.__wbytes = self.__wbytes + bytes
+        total         = total  + bytes
+        offset        = offset + bytes
+        length        = length and length - bytes
+      end
+      
+      if err == errno.EAGAIN then
+        waitfor(self,'w')
+      end
+    end
+    
+    return total
+  end
+  
   ios.close = function(self)
     -- -----------------------------------------------------------------
     -- XXX - this call to assert() seems to remove a bunch of calls to
@@ -99,7 +232,18 @@ local function create_handler(conn,remote)
     setmetatable(ios,mt)
   end
   
-  return ios,function(event)
+  ios.__handler = function(event)
+    if ios.__edge then
+      local wake = event.hangup or event.error
+                or (ios.__want == 'r' and (event.read or event.rdhangup))
+                or (ios.__want == 'w' and event.write)
+      if ios.__want and wake then
+        ios.__want = false
+        nfl.schedule(ios.__co,true)
+      end
+      return
+    end
+    
     assert(not (event.read and event.write))
     
     if event.hangup then
@@ -126,46 +270,84 @@ local function create_handler(conn,remote)
       nfl.schedule(ios.__co,true)
     end
   end
+  
+  return ios,ios.__handler
 end
 
 -- **********************************************************************
--- Usage:       sock,errmsg = listens(sock,mainf)
+-- Usage:       sock,errmsg = listens(sock,mainf[,create])
 -- Desc:        Initialize a listening TCP socket
 -- Input:       sock (userdata/socket) bound socket
 --              mainf (function) main handler for service
+--              create (function/optional) recreate the listening socket
+--                      | in worker processes (see nfl.listener())
 -- Return:      sock (userdata) socket used for listening, false on error
 --              errmsg (string) error message
 -- **********************************************************************
 
-function listens(sock,mainf)
-  nfl.SOCKETS:insert(sock,'r',function()
-    local conn,remote,err = sock:accept()
-    
-    if not conn then
-      syslog('error',"sock:accept() = %s",errno[err])
-      return
+function listens(sock,mainf,create)
+  local count  = 0
+  local paused = false
+  
+  -- -------------------------------------------------------------------
+  -- The connection's slot is released when its coroutine finishes, even
+  -- if it crashed.  A socket left open is no longer watched, as nothing
+  -- is left to wake up (and a pooled coroutine may be running something
+  -- else by then).
+  -- -------------------------------------------------------------------
+  
+  local function finished(ios)
+    if ios.__socket:_tofd() >= 0 then
+      nfl.SOCKETS:remove(ios.__socket)
     end
     
-    conn.nonblock = true
-    conn.nodelay  = true
-    local ios,packet_handler = create_handler(conn,remote)
-    ios.__co = nfl.spawn(mainf,ios)
-    nfl.SOCKETS:insert(conn,'r',packet_handler)
-  end)
+    count = count - 1
+    if paused and count < max_connections then
+      paused = false
+      nfl.accepting(sock,true)
+    end
+  end
+  
+  sock.nonblock = true
+  nfl.listener(sock,function()
+    for _ = 1 , accept_budget do
+      if count >= max_connections then
+        paused = true
+        nfl.accepting(sock,false)
+        return
+      end
+      
+      local conn,remote,err = sock:accept(true)
+      
+      if not conn then
+        if err ~= errno.EAGAIN then
+          syslog('error',"sock:accept() = %s",errno[err])
+        end
+        return
+      end
+      
+      conn.nodelay = true
+      count        = count + 1
+      local ios,packet_handler = create_handler(conn,remote)
+      ios.__co     = nfl.spawn(mainf,ios)
+      nfl.finally(ios.__co,function() finished(ios) end)
+      nfl.SOCKETS:insert(conn,ios.__events,packet_handler)
+    end
+  end,create)
   
   return sock
 end
 
 -- **********************************************************************
--- Usage:       sock,errmsg = listena(addr,mainf)
--- Desc:        Initalize a listening TCP socket
+-- Usage:       sock,errmsg = listen_socket(addr,reuseport)
+-- Desc:        Create a bound, listening socket
 -- Input:       addr (userdata/address) IP address
---              mainf (function) main handler for service
--- Return:      sock (userdata) socket used for listening, false on error
+--              reuseport (boolean) set SO_REUSEPORT
+-- Return:      sock (userdata) socket, false on error
 --              errmsg (string) error message
 -- **********************************************************************
 
-function listena(addr,mainf)
+local function listen_socket(addr,reuseport)
   local sock,err = net.socket(addr.family,'tcp')
   
   if not sock then
@@ -173,10 +355,37 @@ function listena(addr,mainf)
   end
   
   sock.reuseaddr = true
+  sock.reuseport = reuseport
   sock.nonblock  = true
   sock:bind(addr)
   sock:listen()
-  return listens(sock,mainf)
+  return sock
+end
+
+-- **********************************************************************
+-- Usage:       sock,errmsg = listena(addr,mainf)
+-- Desc:        Initalize a listening TCP socket
+-- Input:       addr (userdata/address) IP address
+--              mainf (function) main handler for service
+-- Return:      sock (userdata) socket used for listening, false on error
+--              errmsg (string) error message
+-- **********************************************************************
+
+function listena(addr,mainf)
+  local sock,err = listen_socket(addr,false)
+  
+  if not sock then
+    return false,err
+  end
+  
+  return listens(sock,mainf,function()
+    local wsock,werr = listen_socket(addr,true)
+    if not wsock then
+      syslog('error',"listen(%s) = %s",tostring(addr),werr)
+      return false,werr
+    end
+    return listens(wsock,mainf)
+  end)
 end
 
 -- **********************************************************************
@@ -220,12 +429,17 @@ function connecta(addr,to)
   -- optionally timing out the operation).
   -- ------------------------------------------------------------
   
-  nfl.SOCKETS:insert(sock,'w',packet_handler)
+  nfl.SOCKETS:insert(sock,ios.__edge and ios.__events or 'w',packet_handler)
   if to then nfl.timeout(to,false,errno[errno.ETIMEDOUT]) end
   sock:connect(addr)
-  local okay,err1 = coroutine.yield()
+  ios.__want      = 'w'
+  local okay,err1 = resumed(ios,coroutine.yield())
   if to then nfl.timeout(0) end
   
+  if okay and ios.__edge and sock.error ~= 0 then
+    ios._eof = true
+  end
+  
   if not okay then
     nfl.SOCKETS:remove(sock)
     sock:close()
@@ -262,6 +476,170 @@ function connect(host,port,to)
   end
 end
 
+-- **********************************************************************
+-- Usage:       atob,btoa,reason = tcp.relay(a,b[,opts])
+-- Desc:        Relay data between two connections until both sides close
+-- Input:       a (table) I/O object from this module
+--              b (table) I/O object from this module
+--              opts (table/optional) options
+--                      * size (integer) bytes moved per call (64K)
+--                      * splice (boolean) false to copy data (true)
+--                      * timeout (number) idle timeout in seconds (none)
+-- Return:      atob (integer) bytes relayed from a to b
+--              btoa (integer) bytes relayed from b to a
+--              reason (string) 'eof', 'timeout' or error message
+--
+-- Note:        Data is moved by net.relay(), so outside of what was
+--              already read into the I/O objects, it never enters Lua.
+--              When one side closes, the write side of the other is
+--              shutdown and the relay continues in the other direction.
+--              Both I/O objects are left open.
+-- **********************************************************************
+
+function relay(a,b,opts)
+  assert(a.__handler and b.__handler,"relay() needs TCP I/O objects")
+  opts = opts or {}
+  
+  local co    = coroutine.running()
+  local dirs  =
+  {
+    { src = a , dest = b , bytes = 0 , wait = 'r' },
+    { src = b , dest = a , bytes = 0 , wait = 'r' },
+  }
+  local armed = {}
+  local reason
+  
+  local function wake()
+    nfl.schedule(co,true)
+  end
+  
+  -- --------------------------------------------------------------------
+  -- A socket waiting on nothing is removed from SOCKETS, otherwise a
+  -- hangup would be reported over and over again.
+  -- --------------------------------------------------------------------
+  
+  local function rearm(ios,events)
+    if events == "" then
+      if armed[ios] then
+        nfl.SOCKETS:remove(ios.__socket)
+        armed[ios] = false
+      end
+    elseif armed[ios] then
+      nfl.SOCKETS:update(ios.__socket,events)
+    else
+      nfl.SOCKETS:insert(ios.__socket,events,wake)
+      armed[ios] = true
+    end
+  end
+  
+  local function events(out,inp)
+    return (out.wait == 'r' and 'r' or '') .. (inp.wait == 'w' and 'w' or '')
+  end
+  
+  -- --------------------------------------------------------------------
+  -- Until the sockets are taken from their handlers below, an error just
+  -- needs to close any relay already made---the sockets are still
+  -- watched as they were.
+  -- --------------------------------------------------------------------
+  
+  local function failed(errmsg)
+    for _,dir in ipairs(dirs) do
+      if dir.relay then
+        dir.relay:close()
+      end
+    end
+    return dirs[1].bytes,dirs[2].bytes,errmsg
+  end
+  
+  -- --------------------------------------------------------------------
+  -- Pending output goes first, then anything already read.
+  -- --------------------------------------------------------------------
+  
+  for _,dir in ipairs(dirs) do
+    local okay,errmsg = dir.dest:flush()
+    if not okay then
+      return failed(errmsg)
+    end
+  end
+  
+  for _,dir in ipairs(dirs) do
+    local buf = dir.src._readbuf
+    if buf and #buf > 0 then
+      local data        = buf:get()
+      local okay,errmsg = dir.dest:_drain(data)
+      if not okay then
+        return failed(errmsg)
+      end
+      dir.bytes = #data
+    end
+    
+    local err
+    dir.relay,err = net.relay(opts.size,opts.splice)
+    if not dir.relay then
+      return failed(errno[err])
+    end
+  end
+  
+  nfl.SOCKETS:remove(a.__socket)
+  nfl.SOCKETS:remove(b.__socket)
+  
+  while true do
+    for _,dir in ipairs(dirs) do
+      if dir.wait then
+        local bytes,err,state = dir.relay:move(dir.src.__socket,dir.dest.__socket)
+        dir.bytes         = dir.bytes         + bytes
+        dir.src.__rbytes  = dir.src.__rbytes  + bytes
+        dir.dest.__wbytes = dir.dest.__wbytes + bytes
+        
+        if err ~= 0 then
+          reason = errno[err]
+          break
+        end
+        
+        if state == 'eof' then
+          dir.dest.__socket:shutdown('w')
+          dir.wait = false
+        else
+          dir.wait = state
+        end
+      end
+    end
+    
+    if not reason and not dirs[1].wait and not dirs[2].wait then
+      reason = 'eof'
+    end
+    
+    if reason then break end
+    
+    rearm(a,events(dirs[1],dirs[2]))
+    rearm(b,events(dirs[2],dirs[1]))
+    
+    if opts.timeout then nfl.timeout(opts.timeout,false) end
+    if not coroutine.yield() then
+      reason = 'timeout'
+      break
+    end
+  end
+  
+  if opts.timeout then nfl.timeout(0) end
+  
+  for _,ios in ipairs { a , b } do
+    if armed[ios] then
+      nfl.SOCKETS:remove(ios.__socket)
+    end
+    nfl.SOCKETS:insert(ios.__socket,ios.__events,ios.__handler)
+  end
+  
+  dirs[1].relay:close()
+  dirs[2].relay:close()
+  
+  if reason ~= 'eof' then
+    syslog('notice',"relay(%s,%s) = %s",tostring(a.__remote),tostring(b.__remote),reason)
+  end
+  
+  return dirs[1].bytes,dirs[2].bytes,reason
+end
+
 -- **********************************************************************
 
 if _VERSION >= "Lua 5.2" then
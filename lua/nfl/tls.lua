@@ -19,6 +19,7 @@
 --
 -- ********************************************************************
 -- luacheck: globals listens listena listen connecta connect
+-- luacheck: globals max_connections accept_budget
 -- luacheck: ignore 611
 --
 -- We require org.conman.tls.LIBRESSL_VERSION >= 0x2050000f
@@ -30,11 +31,13 @@ local net       = require "org.conman.net"
 local tls       = require "org.conman.tls"
 local nfl       = require "org.conman.nfl"
 local coroutine = require "coroutine"
+local math      = require "math"
 
 local _VERSION     = _VERSION
 local assert       = assert
 local setmetatable = setmetatable
 local ipairs       = ipairs
+local tostring     = tostring
 
 if _VERSION == "Lua 5.1" then
   module(...)
@@ -42,6 +45,13 @@ else
   _ENV = {} -- luacheck: ignore
 end
 
+-- **********************************************************************
+-- Tunables for listening sockets, as in org.conman.nfl.tcp.
+-- **********************************************************************
+
+max_connections = math.huge
+accept_budget   = 64
+
 -- **********************************************************************
 
 local function create_handler(conn,remote)
@@ -225,16 +235,18 @@ local function tlscb_write(_,str,ios)
 end
 
 -- **********************************************************************
--- Usage:       sock,errmsg = listens(sock,mainf,conf)
+-- Usage:       sock,errmsg = listens(sock,mainf,conf[,create])
 -- Desc:        Initialize a listening TCP socket
 -- Input:       sock (userdata/socket) bound socket
 --              mainf (function) main handler for service
 --              conf (function) function for TLS configuration
+--              create (function/optional) recreate the listening socket
+--                      | in worker processes (see nfl.listener())
 -- Return:      sock (userdata) socket used for listening, false on error
 --              errmsg (string) error message
 -- **********************************************************************
 
-function listens(sock,mainf,conf)
+function listens(sock,mainf,conf,create)
   local config = tls.config()
   local server = tls.server()
   
@@ -243,36 +255,69 @@ function listens(sock,mainf,conf)
     return false,server:error()
   end
   
-  nfl.SOCKETS:insert(sock,'r',function()
-    local conn,remote,err = sock:accept()
-    
-    if not conn then
-      syslog('error',"sock:accept() = %s",errno[err])
-      return
+  local count  = 0
+  local paused = false
+  
+  -- -------------------------------------------------------------------
+  -- The connection's slot is released when its coroutine finishes, even
+  -- if it crashed.  A socket left open is no longer watched, as nothing
+  -- is left to wake up (and a pooled coroutine may be running something
+  -- else by then).
+  -- -------------------------------------------------------------------
+  
+  local function finished(ios)
+    if ios.__socket:_tofd() >= 0 then
+      nfl.SOCKETS:remove(ios.__socket)
     end
     
-    conn.nonblock            = true
-    conn.nodelay             = true
-    local ios,packet_handler = create_handler(conn,remote)
-    ios.__ctx                = server:accept_cbs(ios,tlscb_read,tlscb_write)
-    ios.__co                 = nfl.spawn(mainf,ios)
-    nfl.SOCKETS:insert(conn,'r',packet_handler)
-  end)
+    count = count - 1
+    if paused and count < max_connections then
+      paused = false
+      nfl.accepting(sock,true)
+    end
+  end
+  
+  sock.nonblock = true
+  nfl.listener(sock,function()
+    for _ = 1 , accept_budget do
+      if count >= max_connections then
+        paused = true
+        nfl.accepting(sock,false)
+        return
+      end
+      
+      local conn,remote,err = sock:accept(true)
+      
+      if not conn then
+        if err ~= errno.EAGAIN then
+          syslog('error',"sock:accept() = %s",errno[err])
+        end
+        return
+      end
+      
+      conn.nodelay             = true
+      count                    = count + 1
+      local ios,packet_handler = create_handler(conn,remote)
+      ios.__ctx                = server:accept_cbs(ios,tlscb_read,tlscb_write)
+      ios.__co                 = nfl.spawn(mainf,ios)
+      nfl.finally(ios.__co,function() finished(ios) end)
+      nfl.SOCKETS:insert(conn,'r',packet_handler)
+    end
+  end,create)
   
   return sock
 end
 
 -- **********************************************************************
--- Usage:       sock,errmsg = listena(addr,mainf,conf)
--- Desc:        Initialize a listening TCP socket
+-- Usage:       sock,errmsg = listen_socket(addr,reuseport)
+-- Desc:        Create a bound, listening socket
 -- Input:       addr (userdata/address) IP address
---              mainf (function) main handler for service
---              conf (function) function for TLS configuration
--- Return:      sock (userdata) socket used for listening, false on error
+--              reuseport (boolean) set SO_REUSEPORT
+-- Return:      sock (userdata) socket, false on error
 --              errmsg (string) error message
 -- **********************************************************************
 
-function listena(addr,mainf,conf)
+local function listen_socket(addr,reuseport)
   local sock,err = net.socket(addr.family,'tcp')
   
   if not sock then
@@ -280,10 +325,38 @@ function listena(addr,mainf,conf)
   end
   
   sock.reuseaddr = true
+  sock.reuseport = reuseport
   sock.nonblock  = true
   sock:bind(addr)
   sock:listen()
-  return listens(sock,mainf,conf)
+  return sock
+end
+
+-- **********************************************************************
+-- Usage:       sock,errmsg = listena(addr,mainf,conf)
+-- Desc:        Initialize a listening TCP socket
+-- Input:       addr (userdata/address) IP address
+--              mainf (function) main handler for service
+--              conf (function) function for TLS configuration
+-- Return:      sock (userdata) socket used for listening, false on error
+--              errmsg (string) error message
+-- **********************************************************************
+
+function listena(addr,mainf,conf)
+  local sock,err = listen_socket(addr,false)
+  
+  if not sock then
+    return false,err
+  end
+  
+  return listens(sock,mainf,conf,function()
+    local wsock,werr = listen_socket(addr,true)
+    if not wsock then
+      syslog('error',"listen(%s) = %s",tostring(addr),werr)
+      return false,werr
+    end
+    return listens(wsock,mainf,conf)
+  end)
 end
 
 -- **********************************************************************
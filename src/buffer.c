@@ -0,0 +1,626 @@
+/***************************************************************************
+*
+* Copyright 2026 by Sean Conner.
+*
+* This library is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This library is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+* License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library; if not, see <http://www.gnu.org/licenses/>.
+*
+* Comments, questions and criticisms can be sent to: sean@conman.org
+*
+* ---------------------------------------------------------------------
+*
+* A byte buffer for org.conman.net.ios.  Data is appended to the end and
+* taken from the front.  The data is kept contiguous, so anything taken
+* from the buffer is copied once (into the Lua string returned).  Space
+* at the front is reclaimed when there's at least as much of it as there
+* is data, and the buffer shrinks as data is consumed.
+*
+* Searches for line and header endings pick up where the last one left
+* off, so data isn't rescanned each time more is appended.
+*
+*       buffer = require "org.conman.net.buffer"
+*       buf    = buffer.new()
+*       buf:append("GET / HTTP/1.1\r\n")
+*       line   = buf:line()
+*
+*************************************************************************/
+
+#ifndef __GNUC__
+#  define __attribute__(x)
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#if !defined(LUA_VERSION_NUM) || LUA_VERSION_NUM < 501
+#  error You need to compile against Lua 5.1 or higher
+#endif
+
+#if LUA_VERSION_NUM == 501
+#  define luaL_setfuncs(L,reg,up) luaL_register((L),NULL,(reg))
+#endif
+
+#define TYPE_BUFFER     "org.conman.net.buffer"
+#define BUFFER_MIN      4096uL
+#define NUMBER_MAX      200     /* same as L_MAXLENNUM in liolib.c */
+
+/************************************************************************/
+
+typedef enum
+{
+  SCAN_NONE,
+  SCAN_LINE,
+  SCAN_HEADER,
+} scan__t;
+
+typedef struct
+{
+  char   *data;
+  size_t  size;
+  size_t  head;
+  size_t  tail;
+  size_t  scan;         /* offset from head where the last search ended */
+  scan__t scanfor;      /* ... and what it was looking for */
+} buffer__t;
+
+typedef struct
+{
+  char const *p;
+  size_t      len;
+  size_t      i;
+  bool        eof;
+  bool        more;
+  size_t      n;
+  char        buff[NUMBER_MAX + 1];
+} number__t;
+
+/************************************************************************
+* Make room for at least need more bytes at the end of the buffer.
+*************************************************************************/
+
+static bool buffer_reserve(buffer__t *buf,size_t need)
+{
+  size_t  len = buf->tail - buf->head;
+  size_t  size;
+  char   *data;
+  
+  if (buf->size - buf->tail >= need)
+    return true;
+  
+  if ((buf->head >= len) && (buf->size - len >= need))
+  {
+    memmove(buf->data,buf->data + buf->head,len);
+    buf->head = 0;
+    buf->tail = len;
+    return true;
+  }
+  
+  size = buf->size < BUFFER_MIN ? BUFFER_MIN : buf->size;
+  while(size - len < need)
+  {
+    if (size > ((size_t)-1) / 2)
+      return false;
+    size *= 2;
+  }
+  
+  if (buf->head > 0)
+  {
+    memmove(buf->data,buf->data + buf->head,len);
+    buf->head = 0;
+    buf->tail = len;
+  }
+  
+  data = realloc(buf->data,size);
+  if (data == NULL)
+    return false;
+  
+  buf->data = data;
+  buf->size = size;
+  return true;
+}
+
+/************************************************************************
+* Remove amount bytes from the front, and give back memory once most of
+* the buffer is unused.
+*************************************************************************/
+
+static void buffer_consume(buffer__t *buf,size_t amount)
+{
+  size_t len;
+  
+  buf->head   += amount;
+  buf->scan    = 0;
+  buf->scanfor = SCAN_NONE;
+  len          = buf->tail - buf->head;
+  
+  if (len == 0)
+  {
+    buf->head = 0;
+    buf->tail = 0;
+  }
+  
+  if ((buf->size > BUFFER_MIN) && (len <= buf->size / 4))
+  {
+    size_t  size = buf->size / 2;
+    char   *data;
+    
+    memmove(buf->data,buf->data + buf->head,len);
+    buf->head = 0;
+    buf->tail = len;
+    data      = realloc(buf->data,size);
+    if (data != NULL)
+    {
+      buf->data = data;
+      buf->size = size;
+    }
+  }
+}
+
+/************************************************************************
+* Push the first amount bytes as a string, then remove amount + skip
+* bytes from the buffer.
+*************************************************************************/
+
+static void buffer_take(lua_State *L,buffer__t *buf,size_t amount,size_t skip)
+{
+  lua_pushlstring(L,buf->data != NULL ? buf->data + buf->head : "",amount);
+  buffer_consume(buf,amount + skip);
+}
+
+/************************************************************************
+* Usage:        buf = buffer.new()
+* Desc:         Create a new, empty buffer
+* Return:       buf (userdata) buffer
+*************************************************************************/
+
+static int bufferlua_new(lua_State *L)
+{
+  buffer__t *buf = lua_newuserdata(L,sizeof(buffer__t));
+  
+  buf->data    = NULL;
+  buf->size    = 0;
+  buf->head    = 0;
+  buf->tail    = 0;
+  buf->scan    = 0;
+  buf->scanfor = SCAN_NONE;
+  luaL_getmetatable(L,TYPE_BUFFER);
+  lua_setmetatable(L,-2);
+  return 1;
+}
+
+/************************************************************************/
+
+static int bufferlua___gc(lua_State *L)
+{
+  buffer__t *buf = luaL_checkudata(L,1,TYPE_BUFFER);
+  
+  free(buf->data);
+  buf->data = NULL;
+  buf->size = 0;
+  buf->head = 0;
+  buf->tail = 0;
+  return 0;
+}
+
+/************************************************************************/
+
+static int bufferlua___len(lua_State *L)
+{
+  buffer__t *buf = luaL_checkudata(L,1,TYPE_BUFFER);
+  lua_pushinteger(L,buf->tail - buf->head);
+  return 1;
+}
+
+/************************************************************************/
+
+static int bufferlua___tostring(lua_State *L)
+{
+  buffer__t *buf = luaL_checkudata(L,1,TYPE_BUFFER);
+  lua_pushfstring(L,"buffer (%d bytes)",(int)(buf->tail - buf->head));
+  return 1;
+}
+
+/************************************************************************
+* Usage:        buf:append(data)
+* Desc:         Add data to the end of the buffer
+* Input:        data (string)
+*************************************************************************/
+
+static int bufferlua_append(lua_State *L)
+{
+  buffer__t  *buf = luaL_checkudata(L,1,TYPE_BUFFER);
+  size_t      len;
+  char const *data = luaL_checklstring(L,2,&len);
+  
+  if (len > 0)
+  {
+    if (!buffer_reserve(buf,len))
+      return luaL_error(L,"not enough memory");
+    memcpy(buf->data + buf->tail,data,len);
+    buf->tail += len;
+  }
+  
+  return 0;
+}
+
+/************************************************************************
+* Usage:        buf:unget(data)
+* Desc:         Put data back at the front of the buffer
+* Input:        data (string)
+*************************************************************************/
+
+static int bufferlua_unget(lua_State *L)
+{
+  buffer__t  *buf = luaL_checkudata(L,1,TYPE_BUFFER);
+  size_t      len;
+  char const *data = luaL_checklstring(L,2,&len);
+  
+  if (len > buf->head)
+  {
+    size_t have = buf->tail - buf->head;
+    
+    if (!buffer_reserve(buf,len))
+      return luaL_error(L,"not enough memory");
+    memmove(buf->data + buf->head + len,buf->data + buf->head,have);
+    buf->tail += len;
+    buf->head += len;
+  }
+  
+  buf->head    -= len;
+  buf->scan     = 0;
+  buf->scanfor  = SCAN_NONE;
+  memcpy(buf->data + buf->head,data,len);
+  return 0;
+}
+
+/************************************************************************
+* Usage:        data = buf:get([amount])
+* Desc:         Remove data from the front of the buffer
+* Input:        amount (integer/optional) maximum amount (default all)
+* Return:       data (string) data, which may be shorter than amount
+*************************************************************************/
+
+static int bufferlua_get(lua_State *L)
+{
+  buffer__t *buf = luaL_checkudata(L,1,TYPE_BUFFER);
+  size_t     len = buf->tail - buf->head;
+  
+  if (!lua_isnoneornil(L,2))
+  {
+    lua_Integer amount = luaL_checkinteger(L,2);
+    
+    if (amount < 0)
+      amount = 0;
+    if ((size_t)amount < len)
+      len = (size_t)amount;
+  }
+  
+  buffer_take(L,buf,len,0);
+  return 1;
+}
+
+/************************************************************************
+* Usage:        line = buf:line([keep])
+* Desc:         Remove a line from the front of the buffer
+* Input:        keep (boolean/optional) keep the line ending
+* Return:       line (string) line, nil if there isn't a complete line
+*
+* Note:         A line ends with LF or CRLF.
+*************************************************************************/
+
+static int bufferlua_line(lua_State *L)
+{
+  buffer__t  *buf  = luaL_checkudata(L,1,TYPE_BUFFER);
+  bool        keep = lua_toboolean(L,2);
+  char const *start;
+  char const *nl;
+  size_t      len;
+  size_t      eol;
+  
+  if (buf->tail == buf->head)
+    return 0;
+  
+  /*---------------------------------------------------------------------
+  ; A previous search for a header stopped after line endings, so it
+  ; can't be used here.  A previous search for a line can.
+  ;----------------------------------------------------------------------*/
+  
+  if (buf->scanfor != SCAN_LINE)
+    buf->scan = 0;
+  
+  start = buf->data + buf->head;
+  nl    = memchr(start + buf->scan,'\n',buf->tail - buf->head - buf->scan);
+  
+  if (nl == NULL)
+  {
+    buf->scan    = buf->tail - buf->head;
+    buf->scanfor = SCAN_LINE;
+    return 0;
+  }
+  
+  len = (size_t)(nl - start);
+  eol = 1;
+  if ((len > 0) && (nl[-1] == '\r'))
+  {
+    len--;
+    eol++;
+  }
+  
+  if (keep)
+    buffer_take(L,buf,len + eol,0);
+  else
+    buffer_take(L,buf,len,eol);
+  return 1;
+}
+
+/************************************************************************
+* Usage:        header = buf:header()
+* Desc:         Remove a block of lines ending with a blank line from the
+*               front of the buffer (like an email or HTTP header)
+* Return:       header (string) the block, including the blank line, nil
+*                       if there isn't a complete block
+*
+* Note:         Lines end with LF or CRLF.
+*************************************************************************/
+
+static int bufferlua_header(lua_State *L)
+{
+  buffer__t  *buf = luaL_checkudata(L,1,TYPE_BUFFER);
+  char const *start;
+  char const *end;
+  char const *nl;
+  
+  if (buf->tail == buf->head)
+    return 0;
+  
+  start = buf->data + buf->head;
+  end   = buf->data + buf->tail;
+  nl    = start + (buf->scanfor != SCAN_NONE ? buf->scan : 0);
+  
+  while((nl = memchr(nl,'\n',(size_t)(end - nl))) != NULL)
+  {
+    char const *eol = nl++;
+    
+    if ((nl < end) && (*nl == '\n'))
+    {
+      buffer_take(L,buf,(size_t)(nl - start) + 1,0);
+      return 1;
+    }
+    if ((nl + 1 < end) && (nl[0] == '\r') && (nl[1] == '\n'))
+    {
+      buffer_take(L,buf,(size_t)(nl - start) + 2,0);
+      return 1;
+    }
+    
+    /*-------------------------------------------------------------------
+    ; Not enough data to tell if this line ending is followed by a blank
+    ; line, so start here next time.
+    ;--------------------------------------------------------------------*/
+    
+    if ((nl == end) || ((nl + 1 == end) && (*nl == '\r')))
+    {
+      buf->scan    = (size_t)(eol - start);
+      buf->scanfor = SCAN_HEADER;
+      return 0;
+    }
+  }
+  
+  buf->scan    = buf->tail - buf->head;
+  buf->scanfor = SCAN_HEADER;
+  return 0;
+}
+
+/************************************************************************
+* The number scanner follows read_number() in liolib.c.  If it runs out
+* of data before the number ends (and it's not at EOF), it sets more.
+*************************************************************************/
+
+static bool number_peek(number__t *rn,char c1,char c2)
+{
+  if (rn->i == rn->len)
+  {
+    rn->more = !rn->eof;
+    return false;
+  }
+  return (rn->p[rn->i] == c1) || (rn->p[rn->i] == c2);
+}
+
+/************************************************************************/
+
+static bool number_next(number__t *rn)
+{
+  if (rn->n >= NUMBER_MAX)
+  {
+    rn->buff[0] = '\0';
+    return false;
+  }
+  rn->buff[rn->n++] = rn->p[rn->i++];
+  return true;
+}
+
+/************************************************************************/
+
+static bool number_test2(number__t *rn,char c1,char c2)
+{
+  return number_peek(rn,c1,c2) && number_next(rn);
+}
+
+/************************************************************************/
+
+static size_t number_digits(number__t *rn,bool hex)
+{
+  size_t count = 0;
+  
+  while(true)
+  {
+    if (rn->i == rn->len)
+    {
+      rn->more = !rn->eof;
+      break;
+    }
+    if (!(hex ? isxdigit((unsigned char)rn->p[rn->i]) : isdigit((unsigned char)rn->p[rn->i])))
+      break;
+    if (!number_next(rn))
+      break;
+    count++;
+  }
+  
+  return count;
+}
+
+/************************************************************************/
+
+static void number_scan(number__t *rn)
+{
+  size_t count = 0;
+  bool   hex   = false;
+  char   exp1  = 'e';
+  char   exp2  = 'E';
+  
+  number_test2(rn,'-','+');
+  if (rn->more) return;
+  
+  if (number_test2(rn,'0','0'))
+  {
+    if (number_test2(rn,'x','X'))
+    {
+      hex  = true;
+      exp1 = 'p';
+      exp2 = 'P';
+    }
+    else
+      count = 1;
+  }
+  if (rn->more) return;
+  
+  count += number_digits(rn,hex);
+  if (rn->more) return;
+  
+  if (number_test2(rn,'.','.'))
+    count += number_digits(rn,hex);
+  if (rn->more) return;
+  
+  if ((count > 0) && number_test2(rn,exp1,exp2))
+  {
+    number_test2(rn,'-','+');
+    if (rn->more) return;
+    number_digits(rn,false);
+  }
+}
+
+/************************************************************************
+* Usage:        number,more = buf:number([eof])
+* Desc:         Remove a number (in text form) from the front of the
+*               buffer, like file:read('n')
+* Input:        eof (boolean/optional) no more data will be added
+* Return:       number (number) number, nil if not a number
+*               more (boolean) true if more data is needed
+*
+* Note:         Leading whitespace is always removed.  As with
+*               file:read('n'), characters that fail to make a number
+*               are removed.
+*************************************************************************/
+
+static int bufferlua_number(lua_State *L)
+{
+  buffer__t *buf = luaL_checkudata(L,1,TYPE_BUFFER);
+  number__t  rn;
+  size_t     skip = 0;
+  
+  rn.p    = buf->data != NULL ? buf->data + buf->head : "";
+  rn.len  = buf->tail - buf->head;
+  rn.eof  = lua_toboolean(L,2);
+  
+  while((skip < rn.len) && isspace((unsigned char)rn.p[skip]))
+    skip++;
+  
+  rn.p    += skip;
+  rn.len  -= skip;
+  rn.i     = 0;
+  rn.n     = 0;
+  rn.more  = false;
+  
+  number_scan(&rn);
+  
+  if (rn.more)
+  {
+    buffer_consume(buf,skip);
+    lua_pushnil(L);
+    lua_pushboolean(L,true);
+    return 2;
+  }
+  
+  buffer_consume(buf,skip + rn.i);
+  rn.buff[rn.n] = '\0';
+  
+#if LUA_VERSION_NUM >= 503
+  if (lua_stringtonumber(L,rn.buff) == 0)
+    lua_pushnil(L);
+#else
+  lua_pushstring(L,rn.buff);
+  if (lua_isnumber(L,-1))
+    lua_pushnumber(L,lua_tonumber(L,-1));
+  else
+    lua_pushnil(L);
+  lua_remove(L,-2);
+#endif
+  
+  lua_pushboolean(L,false);
+  return 2;
+}
+
+/************************************************************************/
+
+int luaopen_org_conman_net_buffer(lua_State *L)
+{
+  static luaL_Reg const m_bufferlua_reg[] =
+  {
+    { "new"               , bufferlua_new         } ,
+    { NULL                , NULL                  }
+  };
+  
+  static luaL_Reg const m_bufferlua[] =
+  {
+    { "__gc"              , bufferlua___gc        } ,
+    { "__len"             , bufferlua___len       } ,
+    { "__tostring"        , bufferlua___tostring  } ,
+    { "append"            , bufferlua_append      } ,
+    { "unget"             , bufferlua_unget       } ,
+    { "get"               , bufferlua_get         } ,
+    { "line"              , bufferlua_line        } ,
+    { "header"            , bufferlua_header      } ,
+    { "number"            , bufferlua_number      } ,
+    { NULL                , NULL                  }
+  };
+  
+  luaL_newmetatable(L,TYPE_BUFFER);
+  luaL_setfuncs(L,m_bufferlua,0);
+  lua_pushvalue(L,-1);
+  lua_setfield(L,-2,"__index");
+  lua_pop(L,1);
+  
+#if LUA_VERSION_NUM == 501
+  luaL_register(L,"org.conman.net.buffer",m_bufferlua_reg);
+#else
+  luaL_newlib(L,m_bufferlua_reg);
+#endif
+  
+  return 1;
+}
+
+/************************************************************************/
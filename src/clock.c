@@ -56,6 +56,8 @@
 * Input:        clocktype (enum/optional)
 *                       'realtime'  (default) walltime
 *                       'monotonic' time since boot
+*                       'process_cputime' CPU time used by the process
+*                       'thread_cputime'  CPU time used by the thread
 *               gfrac (boolean) false - return time as float
 *                       * true - return time as seconds,nanoseconds
 *
@@ -137,6 +139,12 @@ static char const *const m_clocks[] =
 {
   "realtime",
   "monotonic",
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+  "process_cputime",
+#endif
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  "thread_cputime",
+#endif
   NULL
 };
 
@@ -144,6 +152,12 @@ static clockid_t const m_clockids[] =
 {
   CLOCK_REALTIME,
   CLOCK_MONOTONIC,
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+  CLOCK_PROCESS_CPUTIME_ID,
+#endif
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  CLOCK_THREAD_CPUTIME_ID,
+#endif
 };
 
 /**************************************************************************/
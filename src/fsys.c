@@ -50,12 +50,18 @@
 #include <fnmatch.h>
 #include <glob.h>
 
+#ifdef __linux
+#  include <stdint.h>
+#  include <sys/eventfd.h>
+#endif
+
 #if !defined(LUA_VERSION_NUM) || LUA_VERSION_NUM < 501
 #  error You need to compile against Lua 5.1 or higher
 #endif
 
 #define TYPE_DIR        "org.conman.fsys:dir"
 #define TYPE_EXPAND     "org.conman.fsys:expand"
+#define TYPE_WAKEUP     "org.conman.fsys:wakeup"
 
 #if LUA_VERSION_NUM == 501
 #  define lua_rawlen(L,idx)       lua_objlen((L),(idx))
@@ -949,6 +955,204 @@ static int fsys_pipe(lua_State *L)
 #endif
 }
 
+/***********************************************************************
+* Usage:        wakeup,err = fsys.wakeup()
+* Desc:         Create an object to wake up a pollset from another thread,
+*               process or callback.
+* Return:       wakeup (userdata) wakeup object, nil on error
+*               err (integer) system error
+*
+* Note:         The object supports _tofd() and can be inserted into a
+*               pollset for reading.  Multiple calls to wakeup:signal()
+*               are coalesced into a single event until wakeup:drain()
+*               is called.  This uses an eventfd on Linux, otherwise a
+*               pipe.
+************************************************************************/
+
+typedef struct
+{
+  int rfh;
+  int wfh;
+} wakeup__t;
+
+static int fsys_wakeup(lua_State *L)
+{
+  wakeup__t *wake = lua_newuserdata(L,sizeof(wakeup__t));
+  
+  wake->rfh = -1;
+  wake->wfh = -1;
+  luaL_getmetatable(L,TYPE_WAKEUP);
+  lua_setmetatable(L,-2);
+  
+#ifdef __linux
+  wake->rfh = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake->rfh != -1)
+  {
+    wake->wfh = wake->rfh;
+    lua_pushinteger(L,0);
+    return 2;
+  }
+#endif
+
+  {
+    int fh[2];
+    
+    if (pipe(fh) == -1)
+    {
+      lua_pushnil(L);
+      lua_pushinteger(L,errno);
+      return 2;
+    }
+    
+    for (size_t i = 0 ; i < 2 ; i++)
+    {
+      fcntl(fh[i],F_SETFL,fcntl(fh[i],F_GETFL) | O_NONBLOCK);
+      fcntl(fh[i],F_SETFD,FD_CLOEXEC);
+    }
+    
+    wake->rfh = fh[0];
+    wake->wfh = fh[1];
+  }
+  
+  lua_pushinteger(L,0);
+  return 2;
+}
+
+/************************************************************************/
+
+static int wakeup_meta___tostring(lua_State *L)
+{
+  lua_pushfstring(L,"wakeup (%p)",lua_touserdata(L,1));
+  return 1;
+}
+
+/************************************************************************
+* Usage:        err = wakeup:close()
+* Desc:         Close the wakeup object (also called when collected)
+* Return:       err (integer) system error
+*************************************************************************/
+
+static int wakeup_meta_close(lua_State *L)
+{
+  wakeup__t *wake = luaL_checkudata(L,1,TYPE_WAKEUP);
+  int        rc   = 0;
+  
+  if (wake->wfh != wake->rfh)
+    close(wake->wfh);
+  if ((wake->rfh != -1) && (close(wake->rfh) == -1))
+    rc = errno;
+  wake->rfh = -1;
+  wake->wfh = -1;
+  lua_pushinteger(L,rc);
+  return 1;
+}
+
+/************************************************************************/
+
+static int wakeup_meta__tofd(lua_State *L)
+{
+  lua_pushinteger(L,((wakeup__t *)luaL_checkudata(L,1,TYPE_WAKEUP))->rfh);
+  return 1;
+}
+
+/************************************************************************
+* Usage:        err = wakeup:signal([n])
+* Desc:         Signal the wakeup object, making it readable
+* Input:        n (integer/optional) amount to add to counter (default 1)
+* Return:       err (integer) system error
+*
+* Note:         If the counter is full (or the pipe is full), the object
+*               is already readable, so this isn't considered an error.
+*************************************************************************/
+
+static int wakeup_meta_signal(lua_State *L)
+{
+  wakeup__t   *wake = luaL_checkudata(L,1,TYPE_WAKEUP);
+  lua_Integer  n    = luaL_optinteger(L,2,1);
+  
+  if (n < 1)
+    return luaL_error(L,"count must be positive");
+    
+#ifdef __linux
+  if (wake->wfh == wake->rfh)
+  {
+    uint64_t count = (uint64_t)n;
+    
+    if ((write(wake->wfh,&count,sizeof(count)) == -1) && (errno != EAGAIN))
+    {
+      lua_pushinteger(L,errno);
+      return 1;
+    }
+    
+    lua_pushinteger(L,0);
+    return 1;
+  }
+#endif
+
+  if ((write(wake->wfh,"",1) == -1) && (errno != EAGAIN))
+    lua_pushinteger(L,errno);
+  else
+    lua_pushinteger(L,0);
+  return 1;
+}
+
+/************************************************************************
+* Usage:        count,err = wakeup:drain()
+* Desc:         Reset the wakeup object so it's no longer readable
+* Return:       count (integer) sum of signals (eventfd), or number of
+*                       | signals (pipe) since last drain
+*               err (integer) system error
+*************************************************************************/
+
+static int wakeup_meta_drain(lua_State *L)
+{
+  wakeup__t   *wake  = luaL_checkudata(L,1,TYPE_WAKEUP);
+  lua_Integer  total = 0;
+  
+#ifdef __linux
+  if (wake->wfh == wake->rfh)
+  {
+    uint64_t count;
+    
+    if (read(wake->rfh,&count,sizeof(count)) == (ssize_t)sizeof(count))
+      total = (lua_Integer)count;
+    else if (errno != EAGAIN)
+    {
+      lua_pushinteger(L,0);
+      lua_pushinteger(L,errno);
+      return 2;
+    }
+    
+    lua_pushinteger(L,total);
+    lua_pushinteger(L,0);
+    return 2;
+  }
+#endif
+
+  while(true)
+  {
+    char    buffer[256];
+    ssize_t bytes = read(wake->rfh,buffer,sizeof(buffer));
+    
+    if (bytes > 0)
+      total += bytes;
+    else
+    {
+      if ((bytes == -1) && (errno != EAGAIN))
+      {
+        lua_pushinteger(L,total);
+        lua_pushinteger(L,errno);
+        return 2;
+      }
+      break;
+    }
+  }
+  
+  lua_pushinteger(L,total);
+  lua_pushinteger(L,0);
+  return 2;
+}
+
 /***********************************************************************/
 
 static int fsys_isatty(lua_State *L)
@@ -1389,6 +1593,7 @@ int luaopen_org_conman_fsys(lua_State *L)
     { "extension" , fsys_extension } ,
     { "filename"  , fsys_filename  } ,
     { "pipe"      , fsys_pipe      } ,
+    { "wakeup"    , fsys_wakeup    } ,
     { "redirect"  , fsys_redirect  } ,
     { "isatty"    , fsys_isatty    } ,
     { "fnmatch"   , fsys_fnmatch   } ,
@@ -1415,6 +1620,20 @@ int luaopen_org_conman_fsys(lua_State *L)
     { NULL                , NULL                  }
   };
   
+  static luaL_Reg const m_wakeup_meta[] =
+  {
+    { "__tostring"        , wakeup_meta___tostring } ,
+    { "__gc"              , wakeup_meta_close      } ,
+#if LUA_VERSION_NUM >= 504
+    { "__close"           , wakeup_meta_close      } ,
+#endif
+    { "_tofd"             , wakeup_meta__tofd      } ,
+    { "signal"            , wakeup_meta_signal     } ,
+    { "drain"             , wakeup_meta_drain      } ,
+    { "close"             , wakeup_meta_close      } ,
+    { NULL                , NULL                   }
+  };
+  
   static luaL_Reg const m_expand_meta[] =
   {
     { "__gc"              , expand_meta___gc      } ,
@@ -1441,6 +1660,11 @@ int luaopen_org_conman_fsys(lua_State *L)
   lua_pushvalue(L,-1);
   lua_setfield(L,-2,"__index");
   
+  luaL_newmetatable(L,TYPE_WAKEUP);
+  luaL_setfuncs(L,m_wakeup_meta,0);
+  lua_pushvalue(L,-1);
+  lua_setfield(L,-2,"__index");
+  
   luaL_newmetatable(L,TYPE_EXPAND);
   luaL_setfuncs(L,m_expand_meta,0);
   
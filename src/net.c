@@ -24,10 +24,12 @@
 #endif
 
 #ifdef __linux
+#  define _GNU_SOURCE
 #  define _DEFAULT_SOURCE
 #  define _BSD_SOURCE
 #  define _POSIX_SOURCE
 #  include <sys/ioctl.h>
+#  include <sys/sendfile.h>
 #  include <linux/sockios.h>
 #endif
 
@@ -46,6 +48,8 @@
 #include <netinet/tcp.h>
 #include <sys/un.h>
 #include <sys/poll.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 #include <net/if.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -64,6 +68,10 @@
 
 #define TYPE_SOCK       "org.conman.net:sock"
 #define TYPE_ADDR       "org.conman.net:addr"
+#define TYPE_RELAY      "org.conman.net:relay"
+#define SENDV_MAX       64
+#define RELAY_SIZE      65536uL
+#define RELAY_BUDGET    (1024uL * 1024uL)
 
 #ifdef __SunOS
 #  define SUN_LEN(x)    sizeof(struct sockaddr_un)
@@ -90,6 +98,16 @@ typedef struct sock
   int fh;
 } sock__t;
 
+typedef struct relay
+{
+  int     pipe[2];  /* splice() through this, unless ...      */
+  char   *buffer;   /* ... we're copying through this instead */
+  size_t  size;
+  size_t  head;
+  size_t  pending;
+  bool    eof;
+} relay__t;
+
 struct strint
 {
   char const *const text;
@@ -779,6 +797,9 @@ struct sockoptions
 static struct sockoptions const m_sockoptions[] =
 {
   { "broadcast"         , SOL_SOCKET    , 0             , SO_BROADCAST          , SOPT_FLAG     , true , true  } ,
+#ifdef SO_BUSY_POLL
+  { "busypoll"          , SOL_SOCKET    , 0             , SO_BUSY_POLL          , SOPT_INT      , true , true  } ,
+#endif
 #ifdef FD_CLOEXEC
   { "closeexec"         , F_GETFD       , F_SETFD       , FD_CLOEXEC            , SOPT_FCNTL    , true , true  } ,
 #endif
@@ -1199,9 +1220,14 @@ static int socklua_listen(lua_State *L)
 
 /**********************************************************************
 *
-*       newsock,addr,err = sock:accept()
+*       newsock,addr,err = sock:accept([nonblock])
 *
-*       sock = net.socket(...)
+*       sock     = net.socket(...)
+*       nonblock = boolean (optional) new socket is non-blocking and
+*                  close-on-exec (default false)
+*
+* Note: with nonblock, accept4() is used where available, otherwise the
+*       flags are set on the new socket after accept().
 *
 ***********************************************************************/
 
@@ -1211,8 +1237,10 @@ static int socklua_accept(lua_State *L)
   socklen_t        remsize;
   sock__t         *sock;
   sock__t         *newsock;
+  bool             nonblock;
   
-  sock = luaL_checkudata(L,1,TYPE_SOCK);
+  sock     = luaL_checkudata(L,1,TYPE_SOCK);
+  nonblock = lua_toboolean(L,2);
   
   newsock = lua_newuserdata(L,sizeof(sock__t));
   luaL_getmetatable(L,TYPE_SOCK);
@@ -1223,7 +1251,15 @@ static int socklua_accept(lua_State *L)
   luaL_getmetatable(L,TYPE_ADDR);
   lua_setmetatable(L,-2);
   
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+  if (nonblock)
+    newsock->fh = accept4(sock->fh,&remote->sa,&remsize,SOCK_NONBLOCK | SOCK_CLOEXEC);
+  else
+    newsock->fh = accept(sock->fh,&remote->sa,&remsize);
+#else
   newsock->fh = accept(sock->fh,&remote->sa,&remsize);
+#endif
+  
   if (newsock->fh == -1)
   {
     lua_pushnil(L);
@@ -1232,6 +1268,30 @@ static int socklua_accept(lua_State *L)
     return 3;
   }
   
+#if !defined(SOCK_NONBLOCK) || !defined(SOCK_CLOEXEC)
+  if (nonblock)
+  {
+    int flags = fcntl(newsock->fh,F_GETFL,0);
+    
+    if (
+            (flags == -1)
+         || (fcntl(newsock->fh,F_SETFL,flags | O_NONBLOCK) == -1)
+         || (fcntl(newsock->fh,F_SETFD,FD_CLOEXEC) == -1)
+       )
+    {
+      int err = errno;
+      close(newsock->fh);
+      newsock->fh = -1;
+      lua_pushnil(L);
+      lua_pushnil(L);
+      lua_pushinteger(L,err);
+      return 3;
+    }
+  }
+#else
+  (void)nonblock;
+#endif
+  
   lua_pushinteger(L,0);
   return 3;
 }
@@ -1350,6 +1410,195 @@ static int socklua_send(lua_State *L)
   return 2;
 }
 
+/**********************************************************************
+*
+*       bytes,err = sock:sendv(chunks[,first[,offset]])
+*
+*       sock   = net.socket(...)
+*       chunks = array of strings
+*       first  = integer (optional) first entry of chunks to send (1)
+*       offset = integer (optional) bytes of chunks[first] already
+*                sent (0)
+*       bytes  = number (bytes written, -1 on error)
+*       err    = number
+*
+* Note: The chunks are written in order with writev(), without being
+*       joined.  At most 64 chunks are written per call; the caller
+*       should check bytes to see how far it got.
+*
+**********************************************************************/
+
+static int socklua_sendv(lua_State *L)
+{
+  struct iovec  iov[SENDV_MAX];
+  sock__t      *sock;
+  lua_Integer   first;
+  lua_Integer   offset;
+  lua_Integer   max;
+  int           cnt;
+  ssize_t       bytes;
+  
+  sock   = luaL_checkudata(L,1,TYPE_SOCK);
+  luaL_checktype(L,2,LUA_TTABLE);
+  first  = luaL_optinteger(L,3,1);
+  offset = luaL_optinteger(L,4,0);
+  max    = (lua_Integer)lua_rawlen(L,2);
+  cnt    = 0;
+  
+  luaL_argcheck(L,first >= 1,3,"must be positive");
+  luaL_argcheck(L,offset >= 0,4,"can't be negative");
+  
+  for (lua_Integer i = first ; (i <= max) && (cnt < SENDV_MAX) ; i++)
+  {
+    char const *data;
+    size_t      len;
+    
+    lua_rawgeti(L,2,i);
+    if (lua_type(L,-1) != LUA_TSTRING)
+      return luaL_error(L,"chunk %d is not a string",(int)i);
+    
+    /*-----------------------------------------------------------------
+    ; The string is still referenced by chunks, so the pointer remains
+    ; valid after popping it.
+    ;------------------------------------------------------------------*/
+    
+    data = lua_tolstring(L,-1,&len);
+    lua_pop(L,1);
+    
+    if (i == first)
+    {
+      luaL_argcheck(L,(size_t)offset <= len,4,"past end of chunk");
+      data += offset;
+      len  -= (size_t)offset;
+    }
+    
+    if (len > 0)
+    {
+      iov[cnt].iov_base = (void *)data;
+      iov[cnt].iov_len  = len;
+      cnt++;
+    }
+  }
+  
+  if (cnt == 0)
+  {
+    lua_pushinteger(L,0);
+    lua_pushinteger(L,0);
+    return 2;
+  }
+  
+  bytes = writev(sock->fh,iov,cnt);
+  if (bytes < 0)
+  {
+    lua_pushinteger(L,-1);
+    lua_pushinteger(L,errno);
+    return 2;
+  }
+  
+  lua_pushinteger(L,bytes);
+  lua_pushinteger(L,0);
+  return 2;
+}
+
+/**********************************************************************
+*
+*       bytes,err = sock:sendfile(file[,offset[,length]])
+*
+*       sock   = net.socket(...)
+*       file   = integer file descriptor, or something with _tofd()
+*       offset = integer (optional) offset in file (0)
+*       length = integer (optional) bytes to send (rest of file)
+*       bytes  = number (bytes written, -1 on error)
+*       err    = number
+*
+* Note: The file offset isn't used or changed.  Under Linux, this uses
+*       sendfile(), so the data never leaves the kernel.  Elsewhere, up
+*       to 64K is read with pread() and sent.  Either way, fewer bytes
+*       than asked for may be sent, and 0 bytes means the end of the
+*       file was reached.
+*
+**********************************************************************/
+
+static int socklua_sendfile(lua_State *L)
+{
+  sock__t *sock;
+  int      fh;
+  off_t    offset;
+  size_t   length;
+  ssize_t  bytes;
+  
+  sock   = luaL_checkudata(L,1,TYPE_SOCK);
+  offset = (off_t)luaL_optinteger(L,3,0);
+  
+  if (lua_type(L,2) == LUA_TNUMBER)
+    fh = lua_tointeger(L,2);
+  else if (luaL_callmeta(L,2,"_tofd"))
+  {
+    fh = luaL_checkinteger(L,-1);
+    lua_pop(L,1);
+  }
+  else
+    return luaL_argerror(L,2,"file descriptor expected");
+    
+  luaL_argcheck(L,offset >= 0,3,"can't be negative");
+  
+  if (lua_isnoneornil(L,4))
+  {
+    struct stat status;
+    
+    if (fstat(fh,&status) == -1)
+    {
+      lua_pushinteger(L,-1);
+      lua_pushinteger(L,errno);
+      return 2;
+    }
+    
+    length = status.st_size > offset ? (size_t)(status.st_size - offset) : 0;
+  }
+  else
+  {
+    lua_Integer len = luaL_checkinteger(L,4);
+    luaL_argcheck(L,len >= 0,4,"can't be negative");
+    length = (size_t)len;
+  }
+  
+  if (length == 0)
+  {
+    lua_pushinteger(L,0);
+    lua_pushinteger(L,0);
+    return 2;
+  }
+  
+#ifdef __linux
+  bytes = sendfile(sock->fh,fh,&offset,length);
+#else
+  {
+    char    buffer[65536uL];
+    ssize_t rd;
+    
+    if (length > sizeof(buffer))
+      length = sizeof(buffer);
+      
+    rd = pread(fh,buffer,length,offset);
+    if (rd > 0)
+      bytes = send(sock->fh,buffer,(size_t)rd,0);
+    else
+      bytes = rd;
+  }
+#endif
+
+  if (bytes < 0)
+  {
+    lua_pushinteger(L,-1);
+    lua_pushinteger(L,errno);
+    return 2;
+  }
+  
+  lua_pushinteger(L,bytes);
+  lua_pushinteger(L,0);
+  return 2;
+}
+
 /**********************************************************************
 *
 *       err = sock:shutdown([how = "rw"])
@@ -1423,6 +1672,260 @@ static int socklua__dup(lua_State *L)
   return 2;
 }
 
+/***********************************************************************
+* Usage:        relay,err = net.relay([size][,splice])
+* Desc:         Create an object to move data from one socket to another
+* Input:        size (integer/optional) bytes moved per system call
+*               splice (boolean/optional) false to always copy data
+* Return:       relay (userdata(relay))
+*               err (integer) system error, 0 if okay
+*
+* Note:         Under Linux, data is moved with splice() through a pipe,
+*               so it never leaves the kernel.  If splice() isn't
+*               supported (or the sockets don't support it), the data is
+*               copied through a buffer instead.
+*
+*               A relay moves data in one direction; use two for a
+*               bidirectional relay.
+************************************************************************/
+
+static int netlua_relay(lua_State *L)
+{
+  lua_Integer  size   = luaL_optinteger(L,1,RELAY_SIZE);
+  bool         splice = lua_isnoneornil(L,2) || lua_toboolean(L,2);
+  relay__t    *relay;
+  
+  luaL_argcheck(L,size > 0,1,"must be positive");
+  
+  relay          = lua_newuserdata(L,sizeof(relay__t));
+  relay->pipe[0] = -1;
+  relay->pipe[1] = -1;
+  relay->buffer  = NULL;
+  relay->size    = (size_t)size;
+  relay->head    = 0;
+  relay->pending = 0;
+  relay->eof     = false;
+  luaL_getmetatable(L,TYPE_RELAY);
+  lua_setmetatable(L,-2);
+  
+#ifdef __linux
+  if (splice && (pipe2(relay->pipe,O_NONBLOCK | O_CLOEXEC) == 0))
+  {
+#  ifdef F_SETPIPE_SZ
+    int psize;
+    
+    fcntl(relay->pipe[1],F_SETPIPE_SZ,(int)relay->size);
+    psize = fcntl(relay->pipe[1],F_GETPIPE_SZ);
+    if (psize > 0)
+      relay->size = (size_t)psize;
+#  endif
+    lua_pushinteger(L,0);
+    return 2;
+  }
+#else
+  (void)splice;
+#endif
+
+  relay->buffer = malloc(relay->size);
+  if (relay->buffer == NULL)
+  {
+    lua_pushnil(L);
+    lua_pushinteger(L,ENOMEM);
+    return 2;
+  }
+  
+  lua_pushinteger(L,0);
+  return 2;
+}
+
+/***********************************************************************/
+
+static ssize_t relay_fill(relay__t *relay,int fh)
+{
+  ssize_t bytes;
+  
+  assert(relay         != NULL);
+  assert(relay->pending == 0);
+  
+#ifdef __linux
+  if (relay->buffer == NULL)
+  {
+    bytes = splice(fh,NULL,relay->pipe[1],NULL,relay->size,SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if ((bytes >= 0) || ((errno != EINVAL) && (errno != ENOSYS)))
+      return bytes;
+      
+    /*---------------------------------------------------------------------
+    ; We can't splice from this file, so switch to copying.  The pipe is
+    ; empty at this point so nothing is lost.
+    ;----------------------------------------------------------------------*/
+    
+    relay->buffer = malloc(relay->size);
+    if (relay->buffer == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+    
+    close(relay->pipe[0]);
+    close(relay->pipe[1]);
+    relay->pipe[0] = -1;
+    relay->pipe[1] = -1;
+  }
+#endif
+
+  relay->head = 0;
+  bytes       = recv(fh,relay->buffer,relay->size,0);
+  return bytes;
+}
+
+/***********************************************************************/
+
+static ssize_t relay_flush(relay__t *relay,int fh)
+{
+  ssize_t bytes;
+  
+  assert(relay          != NULL);
+  assert(relay->pending > 0);
+  
+#ifdef __linux
+  if (relay->buffer == NULL)
+    return splice(relay->pipe[0],NULL,fh,NULL,relay->pending,SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+#endif
+
+  bytes = send(fh,&relay->buffer[relay->head],relay->pending,0);
+  if (bytes > 0)
+    relay->head += (size_t)bytes;
+  return bytes;
+}
+
+/**********************************************************************
+*
+*       bytes,err,state = relay:move(src,dest)
+*
+*       relay = net.relay(...)
+*       src   = net.socket(...) (non-blocking) to read from
+*       dest  = net.socket(...) (non-blocking) to write to
+*       bytes = number (bytes written to dest)
+*       err   = number (system error, 0 if okay)
+*       state = "r"   src isn't readable; wait for it
+*             | "w"   dest isn't writable; wait for it
+*             | "eof" src was closed and all data has been written
+*             | nil   on error
+*
+* Note: Data is moved until either socket would block, or about 1M has
+*       been moved (so other sockets get a chance).  In the latter case,
+*       state is "r".
+*
+**********************************************************************/
+
+static int relaylua_move(lua_State *L)
+{
+  relay__t    *relay = luaL_checkudata(L,1,TYPE_RELAY);
+  sock__t     *src   = luaL_checkudata(L,2,TYPE_SOCK);
+  sock__t     *dest  = luaL_checkudata(L,3,TYPE_SOCK);
+  char const  *state = NULL;
+  lua_Integer  total = 0;
+  int          err   = 0;
+  ssize_t      bytes;
+  
+  luaL_argcheck(L,(relay->buffer != NULL) || (relay->pipe[0] != -1),1,"closed relay");
+  
+  while(true)
+  {
+    if (relay->pending == 0)
+    {
+      if (relay->eof)
+      {
+        state = "eof";
+        break;
+      }
+      
+      if (total >= (lua_Integer)RELAY_BUDGET)
+      {
+        state = "r";
+        break;
+      }
+      
+      bytes = relay_fill(relay,src->fh);
+      if (bytes == -1)
+      {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+          state = "r";
+        else
+          err = errno;
+        break;
+      }
+      
+      if (bytes == 0)
+      {
+        relay->eof = true;
+        continue;
+      }
+      
+      relay->pending = (size_t)bytes;
+    }
+    
+    bytes = relay_flush(relay,dest->fh);
+    if (bytes == -1)
+    {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        state = "w";
+      else
+        err = errno;
+      break;
+    }
+    
+    relay->pending -= (size_t)bytes;
+    total          += bytes;
+  }
+  
+  lua_pushinteger(L,total);
+  lua_pushinteger(L,err);
+  if (state != NULL)
+    lua_pushstring(L,state);
+  else
+    lua_pushnil(L);
+  return 3;
+}
+
+/***********************************************************************/
+
+static int relaylua_close(lua_State *L)
+{
+  relay__t *relay = luaL_checkudata(L,1,TYPE_RELAY);
+  
+  if (relay->pipe[0] != -1)
+  {
+    close(relay->pipe[0]);
+    close(relay->pipe[1]);
+    relay->pipe[0] = -1;
+    relay->pipe[1] = -1;
+  }
+  
+  free(relay->buffer);
+  relay->buffer  = NULL;
+  relay->pending = 0;
+  return 0;
+}
+
+/***********************************************************************/
+
+static int relaylua___len(lua_State *L)
+{
+  relay__t *relay = luaL_checkudata(L,1,TYPE_RELAY);
+  lua_pushinteger(L,relay->pending);
+  return 1;
+}
+
+/***********************************************************************/
+
+static int relaylua___tostring(lua_State *L)
+{
+  relay__t *relay = luaL_checkudata(L,1,TYPE_RELAY);
+  lua_pushfstring(L,"relay (%s): %p",relay->buffer != NULL ? "copy" : "splice",(void *)relay);
+  return 1;
+}
+
 /***********************************************************************/
 
 static int addrmeta_display(lua_State *L)
@@ -1616,6 +2119,7 @@ int luaopen_org_conman_net(lua_State *L)
     { "address"           , netlua_address        } ,
     { "addressraw"        , netlua_addressraw     } ,
     { "_fromfd"           , netlua__fromfd        } ,
+    { "relay"             , netlua_relay          } ,
     { NULL                , NULL                  }
   };
   
@@ -1636,6 +2140,8 @@ int luaopen_org_conman_net(lua_State *L)
     { "accept"            , socklua_accept        } ,
     { "recv"              , socklua_recv          } ,
     { "send"              , socklua_send          } ,
+    { "sendv"             , socklua_sendv         } ,
+    { "sendfile"          , socklua_sendfile      } ,
     { "shutdown"          , socklua_shutdown      } ,
     { "close"             , socklua_close         } ,
     { "_tofd"             , socklua__tofd         } ,
@@ -1654,6 +2160,19 @@ int luaopen_org_conman_net(lua_State *L)
     { NULL                , NULL                  }
   };
   
+  static luaL_Reg const m_relay_meta[] =
+  {
+    { "__gc"              , relaylua_close        } ,
+#if LUA_VERSION_NUM >= 504
+    { "__close"           , relaylua_close        } ,
+#endif
+    { "__len"             , relaylua___len        } ,
+    { "__tostring"        , relaylua___tostring   } ,
+    { "move"              , relaylua_move         } ,
+    { "close"             , relaylua_close        } ,
+    { NULL                , NULL                  }
+  };
+  
   static struct strint const m_errors[] =
   {
     { "EAI_BADFLAGS"      , EAI_BADFLAGS          } ,
@@ -1681,6 +2200,11 @@ int luaopen_org_conman_net(lua_State *L)
   luaL_newmetatable(L,TYPE_ADDR);
   luaL_setfuncs(L,m_addr_meta,0);
   
+  luaL_newmetatable(L,TYPE_RELAY);
+  luaL_setfuncs(L,m_relay_meta,0);
+  lua_pushvalue(L,-1);
+  lua_setfield(L,-2,"__index");
+  
 #if LUA_VERSION_NUM == 501
   luaL_register(L,"org.conman.net",m_net_reg);
 #else
@@ -0,0 +1,845 @@
+/***************************************************************************
+*
+* Copyright 2026 by Sean Conner.
+*
+* This library is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This library is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+* License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library; if not, see <http://www.gnu.org/licenses/>.
+*
+* Comments, questions and criticisms can be sent to: sean@conman.org
+*
+* ---------------------------------------------------------------------
+*
+* A small pool of threads to run blocking system calls without blocking
+* the calling Lua state.  Only a fixed set of operations can be run, all
+* in C---no Lua code is ever run on a pool thread.  Completed operations
+* make the pool readable, so it can be added to a pollset:
+*
+*       offload = require "org.conman.offload"
+*       pool    = offload.pool()
+*       id      = pool:submit('stat',"/etc/passwd")
+*       set:insert(pool,'r',function()
+*         while true do
+*           local id,info,err = pool:result()
+*           if not id then break end
+*           ...
+*         end
+*       end)
+*
+* The operations are:
+*
+*       list,err  = address2(host[,family[,proto[,port]]])
+*                       | same as org.conman.net.address2()
+*       info,err  = stat(file)
+*                       | file is a filename or something with _tofd
+*                       | info is a subset of org.conman.fsys.stat()
+*       err       = fsync(file)
+*                       | file is something with _tofd
+*       data,err  = read(filename[,max])
+*                       | read a file, up to max bytes (default all)
+*
+*************************************************************************/
+
+#ifndef __GNUC__
+#  define __attribute__(x)
+#endif
+
+#ifdef __linux
+#  define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#ifdef __linux
+#  include <sys/eventfd.h>
+#endif
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#if !defined(LUA_VERSION_NUM) || LUA_VERSION_NUM < 501
+#  error You need to compile against Lua 5.1 or higher
+#endif
+
+#if LUA_VERSION_NUM == 501
+#  define luaL_setfuncs(L,reg,up) luaL_register((L),NULL,(reg))
+#endif
+
+#define TYPE_POOL       "org.conman.offload:pool"
+#define TYPE_ADDR       "org.conman.net:addr"
+
+#define OFFLOAD_THREADS 4
+#define OFFLOAD_READ    65536uL
+
+/************************************************************************/
+
+typedef union sockaddr_all      /* must match org.conman.net */
+{
+  struct sockaddr     sa;
+  struct sockaddr_in  sin;
+  struct sockaddr_in6 sin6;
+  struct sockaddr_un  ssun;
+} sockaddr_all__t;
+
+typedef enum
+{
+  OP_ADDRESS2,
+  OP_STAT,
+  OP_FSYNC,
+  OP_READ,
+} opcode__t;
+
+typedef struct job
+{
+  struct job      *next;
+  lua_Integer      id;
+  opcode__t        op;
+  int              err;
+  char            *name;
+  char            *port;
+  int              fh;
+  size_t           max;
+  struct addrinfo  hints;
+  struct addrinfo *addr;
+  struct stat      status;
+  char            *data;
+  size_t           size;
+} job__t;
+
+typedef struct
+{
+  pthread_mutex_t  lock;
+  pthread_cond_t   cond;
+  job__t          *todo;
+  job__t         **todotail;
+  job__t          *done;
+  job__t         **donetail;
+  pthread_t       *threads;
+  size_t           nthreads;
+  bool             stop;
+  lua_Integer      nextid;
+  pid_t            pid;
+  int              rfh;
+  int              wfh;
+} pool__t;
+
+/************************************************************************/
+
+static void job_free(job__t *job)
+{
+  if (job->addr != NULL)
+    freeaddrinfo(job->addr);
+  free(job->data);
+  free(job->name);
+  free(job->port);
+  free(job);
+}
+
+/************************************************************************/
+
+static void job_read(job__t *job)
+{
+  int fh = open(job->name,O_RDONLY | O_CLOEXEC);
+  
+  if (fh == -1)
+  {
+    job->err = errno;
+    return;
+  }
+  
+  while((job->max == 0) || (job->size < job->max))
+  {
+    size_t  want = OFFLOAD_READ;
+    ssize_t bytes;
+    char   *data;
+    
+    if ((job->max != 0) && (job->max - job->size < want))
+      want = job->max - job->size;
+    
+    data = realloc(job->data,job->size + want);
+    if (data == NULL)
+    {
+      job->err = ENOMEM;
+      break;
+    }
+    
+    job->data = data;
+    bytes     = read(fh,job->data + job->size,want);
+    
+    if (bytes == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      job->err = errno;
+      break;
+    }
+    
+    if (bytes == 0)
+      break;
+    
+    job->size += (size_t)bytes;
+  }
+  
+  close(fh);
+}
+
+/************************************************************************
+* Run the operation.  This is called on a pool thread, so it can't touch
+* the Lua state.
+*************************************************************************/
+
+static void job_run(job__t *job)
+{
+  int rc;
+  
+  switch(job->op)
+  {
+    case OP_ADDRESS2:
+         errno = 0;
+         rc    = getaddrinfo(job->name,job->port,&job->hints,&job->addr);
+         if (rc != 0)
+           job->err = (rc == EAI_SYSTEM) ? errno : rc;
+         break;
+    
+    case OP_STAT:
+         if (job->name != NULL)
+           rc = stat(job->name,&job->status);
+         else
+           rc = fstat(job->fh,&job->status);
+         if (rc == -1)
+           job->err = errno;
+         break;
+    
+    case OP_FSYNC:
+         if (fsync(job->fh) == -1)
+           job->err = errno;
+         break;
+    
+    case OP_READ:
+         job_read(job);
+         break;
+  }
+}
+
+/************************************************************************
+* Make the pool readable.  If the eventfd counter or the pipe is full,
+* it's already readable, so errors are ignored.
+*************************************************************************/
+
+static void pool_signal(pool__t *pool)
+{
+  ssize_t rc;
+  
+#ifdef __linux
+  if (pool->wfh == pool->rfh)
+  {
+    uint64_t one = 1;
+    rc = write(pool->wfh,&one,sizeof(one));
+  }
+  else
+#endif
+  rc = write(pool->wfh,"",1);
+  (void)rc;
+}
+
+/************************************************************************/
+
+static void *pool_thread(void *data)
+{
+  pool__t *pool = data;
+  job__t  *job;
+  
+  pthread_mutex_lock(&pool->lock);
+  
+  while(true)
+  {
+    while(!pool->stop && (pool->todo == NULL))
+      pthread_cond_wait(&pool->cond,&pool->lock);
+    
+    if (pool->stop)
+      break;
+    
+    job        = pool->todo;
+    pool->todo = job->next;
+    if (pool->todo == NULL)
+      pool->todotail = &pool->todo;
+    pthread_mutex_unlock(&pool->lock);
+    
+    job->next = NULL;
+    job_run(job);
+    
+    pthread_mutex_lock(&pool->lock);
+    *pool->donetail = job;
+    pool->donetail  = &job->next;
+    pthread_mutex_unlock(&pool->lock);
+    
+    pool_signal(pool);
+    pthread_mutex_lock(&pool->lock);
+  }
+  
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/************************************************************************/
+
+static void pool_drain(pool__t *pool)
+{
+  char buffer[256];
+  
+  while(read(pool->rfh,buffer,sizeof(buffer)) > 0)
+    ;
+}
+
+/************************************************************************/
+
+static job__t *pool_pop(pool__t *pool)
+{
+  job__t *job;
+  
+  pthread_mutex_lock(&pool->lock);
+  job = pool->done;
+  if (job != NULL)
+  {
+    pool->done = job->next;
+    if (pool->done == NULL)
+      pool->donetail = &pool->done;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return job;
+}
+
+/************************************************************************
+* Usage:        pool,err = offload.pool([threads])
+* Desc:         Create a pool of threads
+* Input:        threads (integer/optional) number of threads (default 4)
+* Return:       pool (userdata) pool, nil on error
+*               err (integer) system error
+*************************************************************************/
+
+static int offloadlua_pool(lua_State *L)
+{
+  lua_Integer  threads = luaL_optinteger(L,1,OFFLOAD_THREADS);
+  pool__t     *pool;
+  sigset_t     all;
+  sigset_t     old;
+  int          rc;
+  
+  if (threads < 1)
+    return luaL_error(L,"thread count must be positive");
+  
+  pool = lua_newuserdata(L,sizeof(pool__t));
+  memset(pool,0,sizeof(pool__t));
+  pool->todotail = &pool->todo;
+  pool->donetail = &pool->done;
+  pool->rfh      = -1;
+  pool->wfh      = -1;
+  pool->nextid   = 1;
+  pool->pid      = getpid();
+  
+  pthread_mutex_init(&pool->lock,NULL);
+  pthread_cond_init(&pool->cond,NULL);
+  luaL_getmetatable(L,TYPE_POOL);
+  lua_setmetatable(L,-2);
+  
+#ifdef __linux
+  pool->rfh = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+  if (pool->rfh != -1)
+    pool->wfh = pool->rfh;
+  else
+#endif
+  {
+    int fh[2];
+    
+    if (pipe(fh) == -1)
+    {
+      lua_pushnil(L);
+      lua_pushinteger(L,errno);
+      return 2;
+    }
+    
+    for (size_t i = 0 ; i < 2 ; i++)
+    {
+      fcntl(fh[i],F_SETFL,fcntl(fh[i],F_GETFL) | O_NONBLOCK);
+      fcntl(fh[i],F_SETFD,FD_CLOEXEC);
+    }
+    
+    pool->rfh = fh[0];
+    pool->wfh = fh[1];
+  }
+  
+  pool->threads = calloc((size_t)threads,sizeof(pthread_t));
+  if (pool->threads == NULL)
+  {
+    lua_pushnil(L);
+    lua_pushinteger(L,ENOMEM);
+    return 2;
+  }
+  
+  /*----------------------------------------------------------------------
+  ; The threads inherit the signal mask, and signals should only ever be
+  ; handled by the thread running Lua.
+  ;-----------------------------------------------------------------------*/
+  
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK,&all,&old);
+  
+  for (rc = 0 ; pool->nthreads < (size_t)threads ; pool->nthreads++)
+  {
+    rc = pthread_create(&pool->threads[pool->nthreads],NULL,pool_thread,pool);
+    if (rc != 0)
+      break;
+  }
+  
+  pthread_sigmask(SIG_SETMASK,&old,NULL);
+  
+  if (pool->nthreads == 0)
+  {
+    lua_pushnil(L);
+    lua_pushinteger(L,rc);
+    return 2;
+  }
+  
+  lua_pushinteger(L,0);
+  return 2;
+}
+
+/************************************************************************/
+
+static int poollua___tostring(lua_State *L)
+{
+  lua_pushfstring(L,"offload (%p)",lua_touserdata(L,1));
+  return 1;
+}
+
+/************************************************************************
+* Usage:        pool:close()
+* Desc:         Stop the threads and free any pending operations.  An
+*               operation in progress is finished first.
+*
+* Note:         The threads don't exist in a child process after fork(),
+*               so there, only the file descriptors are closed.
+*************************************************************************/
+
+static int poollua_close(lua_State *L)
+{
+  pool__t *pool = luaL_checkudata(L,1,TYPE_POOL);
+  job__t  *job;
+  
+  if (pool->threads == NULL)
+    return 0;
+  
+  if (pool->pid != getpid())
+  {
+    pool->threads  = NULL;
+    pool->nthreads = 0;
+    if (pool->wfh != pool->rfh)
+      close(pool->wfh);
+    close(pool->rfh);
+    pool->rfh = -1;
+    pool->wfh = -1;
+    return 0;
+  }
+  
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+  
+  for (size_t i = 0 ; i < pool->nthreads ; i++)
+    pthread_join(pool->threads[i],NULL);
+  
+  free(pool->threads);
+  pool->threads  = NULL;
+  pool->nthreads = 0;
+  
+  while((job = pool->todo) != NULL)
+  {
+    pool->todo = job->next;
+    job_free(job);
+  }
+  
+  while((job = pool->done) != NULL)
+  {
+    pool->done = job->next;
+    job_free(job);
+  }
+  
+  if (pool->wfh != pool->rfh)
+    close(pool->wfh);
+  if (pool->rfh != -1)
+    close(pool->rfh);
+  pool->rfh = -1;
+  pool->wfh = -1;
+  
+  pthread_cond_destroy(&pool->cond);
+  pthread_mutex_destroy(&pool->lock);
+  return 0;
+}
+
+/************************************************************************/
+
+static int poollua__tofd(lua_State *L)
+{
+  lua_pushinteger(L,((pool__t *)luaL_checkudata(L,1,TYPE_POOL))->rfh);
+  return 1;
+}
+
+/************************************************************************/
+
+static int pool_tofd(lua_State *L,int idx)
+{
+  int fh;
+  
+  if (!luaL_callmeta(L,idx,"_tofd"))
+    luaL_argerror(L,idx,"_tofd() not supported");
+  fh = luaL_checkinteger(L,-1);
+  lua_pop(L,1);
+  return fh;
+}
+
+/************************************************************************/
+
+static char *pool_strdup(lua_State *L,int idx)
+{
+  size_t      len;
+  char const *s;
+  char       *d;
+  
+  if (lua_isnoneornil(L,idx))
+    return NULL;
+  
+  s = luaL_checklstring(L,idx,&len);
+  d = malloc(len + 1);
+  if (d != NULL)
+    memcpy(d,s,len + 1);
+  return d;
+}
+
+/************************************************************************/
+
+static bool pool_address2(lua_State *L,job__t *job)
+{
+  char const *family = luaL_optstring(L,4,"any");
+  
+  if (strcmp(family,"any") == 0)
+    job->hints.ai_family = AF_UNSPEC;
+  else if (strcmp(family,"ip") == 0)
+    job->hints.ai_family = AF_INET;
+  else if (strcmp(family,"ip6") == 0)
+    job->hints.ai_family = AF_INET6;
+  else
+    return false;
+  
+  if (lua_type(L,5) == LUA_TNUMBER)
+    job->hints.ai_protocol = lua_tointeger(L,5);
+  else if (!lua_isnoneornil(L,5))
+  {
+    struct protoent *e = getprotobyname(luaL_checkstring(L,5));
+    if (e == NULL)
+      return false;
+    job->hints.ai_protocol = e->p_proto;
+  }
+  
+  if (job->hints.ai_protocol == IPPROTO_TCP)
+    job->hints.ai_socktype = SOCK_STREAM;
+  else if (job->hints.ai_protocol == IPPROTO_UDP)
+    job->hints.ai_socktype = SOCK_DGRAM;
+#ifdef IPPROTO_SCTP
+  else if (job->hints.ai_protocol == IPPROTO_SCTP)
+    job->hints.ai_socktype = SOCK_SEQPACKET;
+#endif
+  else if (job->hints.ai_protocol != 0)
+    job->hints.ai_socktype = SOCK_RAW;
+  
+  luaL_checkstring(L,3);
+  if (!lua_isnoneornil(L,6))
+    luaL_checkstring(L,6);
+  job->name = pool_strdup(L,3);
+  job->port = pool_strdup(L,6);
+  return true;
+}
+
+/************************************************************************
+* Usage:        id,err = pool:submit(op,...)
+* Desc:         Submit an operation to the pool
+* Input:        op (string) 'address2', 'stat', 'fsync' or 'read'
+*               ... parameters for the operation
+* Return:       id (integer) request id, nil on error
+*               err (integer) system error
+*************************************************************************/
+
+static int poollua_submit(lua_State *L)
+{
+  static char const *const m_ops[] =
+  {
+    "address2",
+    "stat",
+    "fsync",
+    "read",
+    NULL
+  };
+  
+  pool__t   *pool = luaL_checkudata(L,1,TYPE_POOL);
+  opcode__t  op   = luaL_checkoption(L,2,NULL,m_ops);
+  job__t    *job;
+  
+  if (pool->threads == NULL)
+  {
+    lua_pushnil(L);
+    lua_pushinteger(L,EBADF);
+    return 2;
+  }
+  
+  job = calloc(1,sizeof(job__t));
+  if (job == NULL)
+  {
+    lua_pushnil(L);
+    lua_pushinteger(L,ENOMEM);
+    return 2;
+  }
+  
+  job->op = op;
+  job->fh = -1;
+  
+  switch(job->op)
+  {
+    case OP_ADDRESS2:
+         if (!pool_address2(L,job))
+         {
+           job_free(job);
+           lua_pushnil(L);
+           lua_pushinteger(L,EPROTONOSUPPORT);
+           return 2;
+         }
+         break;
+    
+    case OP_STAT:
+         if (lua_type(L,3) == LUA_TSTRING)
+           job->name = pool_strdup(L,3);
+         else
+           job->fh = pool_tofd(L,3);
+         break;
+    
+    case OP_FSYNC:
+         job->fh = pool_tofd(L,3);
+         break;
+    
+    case OP_READ:
+         luaL_checkstring(L,3);
+         job->name = pool_strdup(L,3);
+         job->max  = (size_t)luaL_optinteger(L,4,0);
+         break;
+  }
+  
+  if ((job->fh == -1) && (job->name == NULL))
+  {
+    int err = (job->op == OP_READ) || (job->op == OP_ADDRESS2) ? ENOMEM : EBADF;
+    job_free(job);
+    lua_pushnil(L);
+    lua_pushinteger(L,err);
+    return 2;
+  }
+  
+  pthread_mutex_lock(&pool->lock);
+  job->id         = pool->nextid++;
+  *pool->todotail = job;
+  pool->todotail  = &job->next;
+  pthread_cond_signal(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+  
+  lua_pushinteger(L,job->id);
+  lua_pushinteger(L,0);
+  return 2;
+}
+
+/************************************************************************/
+
+static int pool_pushresult(lua_State *L,job__t *job)
+{
+  lua_pushinteger(L,job->id);
+  
+  if (job->op == OP_FSYNC)
+  {
+    lua_pushinteger(L,job->err);
+    return 2;
+  }
+  
+  if (job->err != 0)
+  {
+    lua_pushnil(L);
+    lua_pushinteger(L,job->err);
+    return 3;
+  }
+  
+  switch(job->op)
+  {
+    case OP_ADDRESS2:
+         lua_createtable(L,0,0);
+         {
+           int i = 1;
+           for (struct addrinfo *a = job->addr ; a != NULL ; a = a->ai_next)
+           {
+             sockaddr_all__t *addr = lua_newuserdata(L,sizeof(sockaddr_all__t));
+             luaL_getmetatable(L,TYPE_ADDR);
+             lua_setmetatable(L,-2);
+             memcpy(&addr->sa,a->ai_addr,a->ai_addrlen);
+             lua_rawseti(L,-2,i++);
+           }
+         }
+         break;
+    
+    case OP_STAT:
+         lua_createtable(L,0,10);
+         lua_pushinteger(L,job->status.st_ino);     lua_setfield(L,-2,"inode");
+         lua_pushinteger(L,job->status.st_nlink);   lua_setfield(L,-2,"nlink");
+         lua_pushinteger(L,job->status.st_uid);     lua_setfield(L,-2,"uid");
+         lua_pushinteger(L,job->status.st_gid);     lua_setfield(L,-2,"gid");
+         lua_pushinteger(L,job->status.st_size);    lua_setfield(L,-2,"size");
+         lua_pushinteger(L,job->status.st_blksize); lua_setfield(L,-2,"blocksize");
+         lua_pushinteger(L,job->status.st_blocks);  lua_setfield(L,-2,"blocks");
+         lua_pushinteger(L,job->status.st_atime);   lua_setfield(L,-2,"atime");
+         lua_pushinteger(L,job->status.st_mtime);   lua_setfield(L,-2,"mtime");
+         lua_pushinteger(L,job->status.st_ctime);   lua_setfield(L,-2,"ctime");
+    
+         if (S_ISREG(job->status.st_mode))
+           lua_pushliteral(L,"file");
+         else if (S_ISDIR(job->status.st_mode))
+           lua_pushliteral(L,"dir");
+         else if (S_ISCHR(job->status.st_mode))
+           lua_pushliteral(L,"chardev");
+         else if (S_ISBLK(job->status.st_mode))
+           lua_pushliteral(L,"blockdev");
+         else if (S_ISFIFO(job->status.st_mode))
+           lua_pushliteral(L,"pipe");
+         else if (S_ISLNK(job->status.st_mode))
+           lua_pushliteral(L,"link");
+         else if (S_ISSOCK(job->status.st_mode))
+           lua_pushliteral(L,"socket");
+         else
+           lua_pushliteral(L,"?");
+         lua_setfield(L,-2,"type");
+         break;
+    
+    case OP_READ:
+         lua_pushlstring(L,job->data != NULL ? job->data : "",job->size);
+         break;
+    
+    case OP_FSYNC:
+         break;
+  }
+  
+  lua_pushinteger(L,0);
+  return 3;
+}
+
+/************************************************************************
+* Usage:        id,... = pool:result()
+* Desc:         Return the next completed operation
+* Return:       id (integer) request id, nil if none are complete
+*               ... results of the operation
+*
+* Note:         The pool is no longer readable once this returns nil.
+*************************************************************************/
+
+static int poollua_result(lua_State *L)
+{
+  pool__t *pool = luaL_checkudata(L,1,TYPE_POOL);
+  job__t  *job;
+  int      rc;
+  
+  if (pool->threads == NULL)
+    return 0;
+  
+  job = pool_pop(pool);
+  if (job == NULL)
+  {
+    /*-------------------------------------------------------------------
+    ; A thread signals after queuing a result, so anything that completes
+    ; after the drain either shows up below or leaves the pool readable.
+    ;--------------------------------------------------------------------*/
+    
+    pool_drain(pool);
+    job = pool_pop(pool);
+    if (job == NULL)
+      return 0;
+  }
+  
+  rc = pool_pushresult(L,job);
+  job_free(job);
+  return rc;
+}
+
+/************************************************************************/
+
+int luaopen_org_conman_offload(lua_State *L)
+{
+  static luaL_Reg const m_offloadlua[] =
+  {
+    { "pool"              , offloadlua_pool       } ,
+    { NULL                , NULL                  }
+  };
+  
+  static luaL_Reg const m_poollua[] =
+  {
+    { "__tostring"        , poollua___tostring    } ,
+    { "__gc"              , poollua_close         } ,
+#if LUA_VERSION_NUM >= 504
+    { "__close"           , poollua_close         } ,
+#endif
+    { "_tofd"             , poollua__tofd         } ,
+    { "submit"            , poollua_submit        } ,
+    { "result"            , poollua_result        } ,
+    { "close"             , poollua_close         } ,
+    { NULL                , NULL                  }
+  };
+  
+  /*---------------------------------------------------------------------
+  ; address2 returns org.conman.net addresses, so make sure its metatable
+  ; exists.
+  ;----------------------------------------------------------------------*/
+  
+  lua_getglobal(L,"require");
+  lua_pushliteral(L,"org.conman.net");
+  lua_call(L,1,0);
+  
+  luaL_newmetatable(L,TYPE_POOL);
+  luaL_setfuncs(L,m_poollua,0);
+  lua_pushvalue(L,-1);
+  lua_setfield(L,-2,"__index");
+  lua_pop(L,1);
+  
+#if LUA_VERSION_NUM == 501
+  luaL_register(L,"org.conman.offload",m_offloadlua);
+#else
+  luaL_newlib(L,m_offloadlua);
+#endif
+  
+  return 1;
+}
+
+/************************************************************************/
@@ -23,8 +23,25 @@
 #  define __attribute__(x)
 #endif
 
+#ifdef __linux
+#  define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
 #include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux
+#  include <sys/timerfd.h>
+#  include <sys/signalfd.h>
+#endif
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -40,14 +57,63 @@
 #endif
 
 #define TYPE_POLL       "org.conman.pollset"
-
-#if !defined(POLLSET_IMPL_EPOLL) && !defined(POLLSET_IMPL_KQUEUE) && !defined(POLLSET_IMPL_POLL) && !defined(POLLSET_IMPL_SELECT)
+#define TYPE_TIMER      "org.conman.pollset:timer"
+#define TYPE_SIGNAL     "org.conman.pollset:signal"
+#define MAXEVENTS       1024
+#define PS_HISTOGRAM    16
+#define RECVSIZE        65536
+
+#define PS_READ         0x0001
+#define PS_WRITE        0x0002
+#define PS_PRIORITY     0x0004
+#define PS_ERROR        0x0008
+#define PS_HANGUP       0x0010
+#define PS_INVALID      0x0020
+#define PS_RDHANGUP     0x0040
+#define PS_SIGNAL       0x0080
+#define PS_RECV         0x0100
+#define PS_SEND         0x0200
+#define PS_ACCEPT       0x0400
+#define PS_TIMER        0x0800
+#define PS_EDGE         0x1000
+#define PS_ONESHOT      0x2000
+#define PS_EXCLUSIVE    0x4000
+
+#define PS_COMPLETION   (PS_RECV | PS_SEND | PS_ACCEPT)
+#define PS_RESULT       (PS_COMPLETION | PS_TIMER | PS_SIGNAL)
+
+#define PSFD_FILE       0
+#define PSFD_TIMER      1
+#define PSFD_SIGNALFD   2
+#define PSFD_SIGPIPE    3
+
+/*-------------------------------------------------------------------------
+; Unless told otherwise, compile in every implementation the system
+; supports.  poll() and select() are always available.
+;--------------------------------------------------------------------------*/
+
+#if !defined(POLLSET_IMPL_EPOLL) && !defined(POLLSET_IMPL_URING) && !defined(POLLSET_IMPL_KQUEUE) && !defined(POLLSET_IMPL_POLL) && !defined(POLLSET_IMPL_SELECT)
 #  if defined(__linux)
 #    define POLLSET_IMPL_EPOLL
+#    if defined(__has_include)
+#      if __has_include(<linux/io_uring.h>)
+#        define POLLSET_IMPL_URING
+#      endif
+#    endif
 #  elif defined(__APPLE__)
 #    define POLLSET_IMPL_KQUEUE
-#  else
-#    define POLLSET_IMPL_POLL
+#  endif
+#  define POLLSET_IMPL_POLL
+#  define POLLSET_IMPL_SELECT
+#endif
+
+#ifdef POLLSET_IMPL_URING
+#  ifndef POLLSET_IMPL_EPOLL
+#    define POLLSET_IMPL_EPOLL
+#  endif
+#  include <linux/io_uring.h>
+#  if !defined(IORING_FEAT_EXT_ARG) || !defined(IORING_POLL_ADD_MULTI)
+#    undef POLLSET_IMPL_URING
 #  endif
 #endif
 
@@ -59,31 +125,94 @@
 *
 * So they're here in this module.
 *
-* Also, each of the implementations present the same API.  The
-* org.conman.net module indicates which implementation is in use, but as
-* long as you stick to select() type operations, you should be fine.
+* Also, each of the implementations present the same API.  Every
+* implementation the system supports is compiled in, and one is picked
+* when the event object is created; set._implementation says which one is
+* in use, but as long as you stick to select() type operations, you should
+* be fine.
 *
 *       event   meaning
 *       r       read ready
 *       w       write ready
 *       p       urgent data ready and/or error happened
+*       d       remote end closed its side (reported as 'rdhangup')
+*
+* The following modify how events are reported:
+*
+*       flag    meaning
+*       e       edge triggered---only report changes in readiness
+*       o       one shot---once reported, no more events are reported
+*               until the file is re-armed with set:update()
+*       x       exclusive---only wake up one of several sets waiting
+*               on the same file (can't be used with set:update())
+*
+*       event   epoll   uring   poll    select  kqueue
+*       r       x       x       x       x       x
+*       w       x       x       x       x       x
+*       p       x       x       x       x       x
+*       d       x       x       x[1]    -       -
+*       e       x       x       E       E       x
+*       o       x       x       e       e       x
+*       x       x       -       -       -       -
 *
-*       event   epoll   poll    select  kqueue
-*       r       x       x       x       x
-*       w       x       x       x       x
-*       p       x       x       x       x
+*       x  native support
+*       e  emulated
+*       E  not supported; set:insert() and set:update() return ENOTSUP
+*       -  ignored
+*       [1] Linux only
 *
-* Usage:        set,err = org.conman.pollset()
+* Edge triggered files can't be emulated without spinning (a file that
+* stays ready would wake up every wait without being reported), so they
+* are refused.  Exclusive is only a hint, so it's ignored where it's not
+* supported.  set._flags lists what the set actually supports.
+*
+* Usage:        set,err = org.conman.pollset([implementation][,options])
 * Desc:         Return a file descriptor based event object
+* Input:        implementation (string/optional) one of:
+*                       * 'epoll'
+*                       * 'uring' (falls back to 'epoll' if the kernel
+*                       |       doesn't support it)
+*                       * 'poll'
+*                       * 'select'
+*                       * 'kqueue'
+*                       | (defaults to 'epoll' on Linux, 'kqueue' on
+*                       | Mac OS-X, and 'poll' elsewhere; an
+*                       | implementation not available on the system
+*                       | returns ENOTSUP)
+*               options (table/optional) options for the event object
+*                       * maxevents (integer) maximum number of events
+*                       |       returned per set:wait() (default 1024);
+*                       |       any remaining events are returned on
+*                       |       the next call to set:wait()
+*                       | (only used for epoll, uring and kqueue)
+*                       * spin (number) maximum microseconds to poll
+*                       |       without blocking before set:wait()
+*                       |       blocks (default 0---don't spin); the
+*                       |       actual time adapts to how often events
+*                       |       are found while spinning
+*                       * timerfd (boolean) use a timerfd for each
+*                       |       timer (default true); if false, all
+*                       |       timers are kept by the set, which uses
+*                       |       no file descriptors and makes adding
+*                       |       and removing timers cheaper (Linux
+*                       |       only---other systems always keep the
+*                       |       timers in the set)
 * Return:       set (userdata/set) event object, nil on error
 *               err (integer) system error (0 - no error)
 *
-* Usage:        set._implemenation (string) one of:
+* Usage:        set._implementation (string) one of:
 *                       * 'epoll'
+*                       * 'uring'
 *                       * 'poll'
 *                       * 'select'
 *                       * 'kqueue'
 *
+* Usage:        set._iocp (boolean) true if set:recv(), set:send() and
+*                       | set:accept() are supported
+*
+* Usage:        set._flags (string) the events and flags (see above) the
+*                       | set supports, such as "rwpdeox" for epoll
+*
 * Usage:        err = set:insert(file,events[,obj])
 * Desc:         Insert a file into the event object
 * Input:        file (?) any object that has metatable field _tofd()
@@ -123,668 +252,1751 @@
 *                       * read (boolean) read event
 *                       * write (boolean) write event
 *                       * priority (boolean) priority data event
+*                       * timer (boolean) timer expired
+*                       * signal (boolean) signal caught
 *                       * obj (?) value registered with set:insert()
+*                       * result (?) result of set:recv(), set:send() or
+*                       |       set:accept(), or number of timer
+*                       |       expirations (see below)
 *
 * Note:         Other events may be reported, such as 'error' or 'hangup'.
 *               There is no exhaustive list, and the types of reports
-*               are implementation dependent.
+*               are implementation dependent.  Events for files removed
+*               from the set since the wait are skipped (as they are by
+*               set:ievents()).
+*
+* Usage:        for obj,events[,result] in set:ievents([format]) do ... end
+* Desc:         Return an event iterator that doesn't create a table per
+*               event.
+* Input:        format (enum/table/optional)
+*                       * 'integer' events as bit flags (default)
+*                       |       set.READ     read event
+*                       |       set.WRITE    write event
+*                       |       set.PRIORITY priority data event
+*                       |       set.ERROR    error
+*                       |       set.HANGUP   hangup
+*                       |       set.INVALID  invalid file
+*                       |       set.RDHANGUP remote end closed
+*                       |       set.RECV     set:recv() completed
+*                       |       set.SEND     set:send() completed
+*                       |       set.ACCEPT   set:accept() completed
+*                       |       set.TIMER    timer expired
+*                       |       set.SIGNAL   signal caught
+*                       * 'string' events as a string of flags:
+*                       |       'r' read, 'w' write, 'p' priority,
+*                       |       'e' error, 'h' hangup, 'i' invalid,
+*                       |       'd' remote end closed, 'R' recv,
+*                       |       'S' send, 'A' accept, 'T' timer,
+*                       |       'G' signal
+*                       * table, which is filled in (and reused) with
+*                       | the same fields as set:events() returns
+* Return:       ievents (function) used in "for obj,events in ievents ..."
+*               Each item is:
+*                       * obj (?) value registered with set:insert()
+*                       * events (integer/string/table) events per format
+*                       * result (?) for completed operations,
+*                       |       timers and signals (see below)
+*
+* Usage:        err = set:recv(file[,size])
+*               err = set:send(file,data)
+*               err = set:accept(file)
+* Desc:         Start an operation on a file in the event object.  When
+*               the operation finishes, an event is returned for the
+*               file with the recv, send or accept event set, and the
+*               result of the operation:
+*                       * recv - (string) data received ("" on EOF)
+*                       * send - (integer) number of bytes sent
+*                       * accept - (integer) file descriptor of the new
+*                       |       connection (non-blocking)
+*                       If the error event is set, the result is the
+*                       system error instead.
+* Input:        file (?) any object that reponds to _tofd()
+*               size (integer/optional) maximum amount to receive
+*                       | (default 65536)
+*               data (string) data to send
+* Return:       err (integer) system error value
+* Note:         Only supported if set._iocp is true; otherwise ENOTSUP is
+*               returned.  file must have been added with set:insert().
+*
+* Usage:        timer,err = set:timer(seconds[,obj[,interval]])
+* Desc:         Add a timer to the event object.  When it expires, an
+*               event is returned with the timer event set, and the
+*               result is the number of times the timer expired since
+*               it was last reported.
+* Input:        seconds (number) time until first expiration
+*               obj (?/optional) value to associate with event
+*                       | (defaults to timer)
+*               interval (number/optional) time between further
+*                       | expirations (default 0---timer only expires
+*                       | once)
+* Return:       timer (userdata) timer, nil on error
+*               err (integer) system error value
+* Note:         Use set:remove(timer) to cancel the timer.  On Linux, a
+*               timerfd is used, which takes a file descriptor; otherwise
+*               timers are kept by the event object and checked in
+*               set:wait().
+*
+* Usage:        handle,err = set:insert_signal(signals[,obj])
+* Desc:         Have signals reported as events.  Each signal caught is
+*               returned as an event with the signal event set, and the
+*               result is a table:
+*                       * signal (string) name of signal
+*                       * code (integer) si_code value
+*                       * errno (integer) si_errno value
+*                       * pid (integer) sending process
+*                       * uid (integer) user ID of sending process
+*                       * status (integer) exit value or signal (child)
+* Input:        signals (string/table) signal, or array of signals, such
+*                       | as 'hup', 'term', 'child' (or signal numbers)
+*               obj (?/optional) value to associate with event
+*                       | (defaults to handle)
+* Return:       handle (userdata) handle, nil on error
+*               err (integer) system error value
+* Note:         Use set:remove(handle) to stop reporting the signals.
+*               On Linux, the signals are blocked and read with a
+*               signalfd; otherwise, a handler writes them to a pipe, and
+*               a signal can only be handled by one set at a time (EBUSY).
+*               Don't mix this with org.conman.signal for the same
+*               signals.
+*
+* Usage:        stats = set:stats([reset])
+* Desc:         Return statistics collected by set:wait()
+* Input:        reset (boolean/optional) reset statistics
+* Return:       stats (table)
+*                       * waits (integer) calls to set:wait()
+*                       * events (integer) total events returned
+*                       * peak (integer) most events from one wait
+*                       * blocked (number) seconds spent in set:wait()
+*                       * between (number) seconds spent between calls
+*                       |       to set:wait() (i.e. running Lua code)
+*                       * spin (number) seconds spent spinning (part of
+*                       |       blocked)
+*                       * spinhits (integer) waits where spinning found
+*                       |       events
+*                       * histogram (array) waits by number of events;
+*                       |       [1] is no events, [2] is 1, [3] is 2-3,
+*                       |       [4] is 4-7, and so on; the last entry
+*                       |       counts anything larger
+*
+* Usage:        set:close()
+* Desc:         Release the set (also done by __gc and __close)
+* Note:         The kernel state behind a set (the epoll or io_uring
+*               instance) is shared with a child process after fork(),
+*               so the child must not use the set, only close it.  In a
+*               child, this releases the signal handles and timers in the
+*               set (restoring the signal mask), and closes what the set
+*               holds, without changing anything the parent still uses.
+*
+*************************************************************************/
+
+typedef struct pollset pollset__t;
+
+typedef struct
+{
+  int         fh;
+  int         id;
+  double      when;
+  double      interval;
+  size_t      heap;
+  lua_Integer count;
+} pstimer__t;
+
+typedef struct
+{
+  lua_Integer waits;
+  lua_Integer events;
+  lua_Integer peak;
+  double      blocked;
+  double      between;
+  double      spin;
+  lua_Integer spinhits;
+  double      last;
+  lua_Integer histogram[PS_HISTOGRAM];
+} psstats__t;
+
+typedef struct
+{
+  int      fh;
+  int      wfh;
+  sigset_t mask;
+  sigset_t blocked;
+} pssignal__t;
+
+typedef struct
+{
+  int  signo;
+  int  code;
+  int  err;
+  long pid;
+  long uid;
+  int  status;
+} pssiginfo__t;
+
+typedef struct pollops
+{
+  char const             *name;
+  unsigned int            events;
+  unsigned int            flags;
+  size_t                  size;
+  struct pollops const   *fallback;
+  int                   (*init)  (pollset__t *);
+  void                  (*free)  (pollset__t *);
+  void                  (*forget)(pollset__t *);
+  int                   (*insert)(pollset__t *,int,unsigned int);
+  int                   (*update)(pollset__t *,int,unsigned int);
+  int                   (*remove)(pollset__t *,int);
+  int                   (*wait)  (pollset__t *,lua_Number);
+  bool                  (*next)  (pollset__t *,int *,unsigned int *);
+  int                   (*submit)(pollset__t *,int,unsigned int,char const *,size_t);
+  void                  (*result)(pollset__t *,lua_State *);
+} pollops__t;
+
+struct pollset
+{
+  pollops__t const  *ops;
+  size_t             idx;
+  int                maxevents;
+  lua_Alloc          allocf;
+  void              *ud;
+  unsigned char     *fdkind;
+  size_t             nfdkind;
+  pstimer__t       **heap;
+  size_t             nheap;
+  size_t             maxheap;
+  pstimer__t       **expired;
+  size_t             nexpired;
+  size_t             iexpired;
+  size_t             maxexpired;
+  size_t             nemulated;
+  int                timerid;
+  lua_Integer        result;
+  pssiginfo__t       siginfo;
+  psstats__t         stats;
+  double             spinmax;
+  double             spin;
+  bool               timerfd;
+  bool               closed;
+  pid_t              pid;
+};
+
+/************************************************************************
+*
+* Each implementation supplies the functions in a pollops__t:
+*
+*       init()   - initialize the implementation specific part of the set;
+*                  returns 0 or system error.  If this fails, free() is
+*                  not called.
+*       free()   - release all resources; may be called more than once.
+*       forget() - release all resources in a child process after fork(),
+*                  without touching kernel state shared with the parent.
+*       insert() - add a file with the given PS_* flags; returns 0 or
+*                  system error.
+*       update() - change the PS_* flags for a file; returns 0 or system
+*                  error.
+*       remove() - remove a file; returns 0 or system error.
+*       wait()   - wait for events (timeout in seconds, < 0 to block);
+*                  returns number of events, or -1 on error (with errno).
+*       next()   - return the next file and its events as PS_* flags, or
+*                  false if no more events.
+*       submit() - (optional) start a PS_RECV, PS_SEND or PS_ACCEPT
+*                  operation on a file; returns 0 or system error.
+*       result() - (optional) push the result of the last completed
+*                  operation returned by next().
+*
+* The events field lists the events the implementation can report, flags
+* lists the PS_EDGE, PS_ONESHOT and PS_EXCLUSIVE flags it supports, and
+* fallback, if not NULL, is used if init() fails.
 *
 * LINUX implementation of pollset, using epoll()
 *
 *************************************************************************/
 
 #ifdef POLLSET_IMPL_EPOLL
-#define POLLSET_IMPL    "epoll"
-
-#include <stdbool.h>
 
 #include <unistd.h>
 #include <sys/epoll.h>
 
+#ifndef EPOLLRDHUP
+#  define EPOLLRDHUP 0
+#endif
+
+#ifndef EPOLLEXCLUSIVE
+#  define EPOLLEXCLUSIVE 0
+#endif
+
 typedef struct
 {
+  pollset__t          base;
   int                 efh;
-  size_t              idx;
   struct epoll_event *list;
+  int                 size;
   int                 max;
   int                 count;
-} pollset__t;
-
-/**********************************************************************/
-
-static int pollset_toevents(lua_State *L,int idx)
-{
-  int events = 0;
-  
-  for (char const *flags = luaL_checkstring(L,idx) ; *flags ; flags++)
-  {
-    switch(*flags)
-    {
-      case 'r': events |= EPOLLIN;      break;
-      case 'w': events |= EPOLLOUT;     break;
-      case 'p': events |= EPOLLPRI;     break;
-      default:  break;
-    }
-  }
-  
-  return events;
-}
-
-/**********************************************************************/
-
-static void pollset_pushevents(lua_State *L,int events)
-{
-  lua_createtable(L,0,5);
-  lua_pushboolean(L,(events & EPOLLIN)      != 0);
-  lua_setfield(L,-2,"read");
-  lua_pushboolean(L,(events & EPOLLOUT)     != 0);
-  lua_setfield(L,-2,"write");
-  lua_pushboolean(L,(events & EPOLLPRI)     != 0);
-  lua_setfield(L,-2,"priority");
-  lua_pushboolean(L,(events & EPOLLERR)     != 0);
-  lua_setfield(L,-2,"error");
-  lua_pushboolean(L,(events & EPOLLHUP)     != 0);
-  lua_setfield(L,-2,"hangup");
-}
+} pollset_epoll__t;
 
 /**********************************************************************/
 
-static int pollset_next(lua_State *L)
+static uint32_t psepoll_toevents(unsigned int flags)
 {
-  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
-  
-  if (set->count < set->max)
-  {
-    lua_getuservalue(L,1);
-    pollset_pushevents(L,set->list[set->count].events);
-    lua_pushinteger(L,set->list[set->count].data.fd);
-    lua_gettable(L,-3);
-    lua_setfield(L,-2,"obj");
-    set->count++;
-  }
-  else
-  {
-    free(set->list);
-    set->list = NULL;
-    lua_pushnil(L);
-  }
-  
-  return 1;
+  return ((flags & PS_READ)      ? EPOLLIN        : 0)
+       | ((flags & PS_WRITE)     ? EPOLLOUT       : 0)
+       | ((flags & PS_PRIORITY)  ? EPOLLPRI       : 0)
+       | ((flags & PS_RDHANGUP)  ? EPOLLRDHUP     : 0)
+       | ((flags & PS_EDGE)      ? EPOLLET        : 0)
+       | ((flags & PS_ONESHOT)   ? EPOLLONESHOT   : 0)
+       | ((flags & PS_EXCLUSIVE) ? EPOLLEXCLUSIVE : 0)
+       ;
 }
 
 /**********************************************************************/
 
-static int pollset_lua(lua_State *L)
+static int psepoll_init(pollset__t *base)
 {
-  pollset__t *set;
-  int         efh;
+  pollset_epoll__t *set = (pollset_epoll__t *)base;
   
-  efh = epoll_create(10);
-  if (efh == -1)
-  {
-    lua_pushnil(L);
-    lua_pushinteger(L,errno);
-    return 2;
-  }
-  
-  set        = lua_newuserdata(L,sizeof(pollset__t));
-  set->efh   = efh;
+  set->efh = epoll_create(10);
+  if (set->efh == -1)
+    return errno;
+    
   set->list  = NULL;
-  set->idx   = 0;
+  set->size  = 0;
   set->max   = 0;
   set->count = 0;
-  
-  lua_createtable(L,0,0);
-  lua_setuservalue(L,-2);
-  luaL_getmetatable(L,TYPE_POLL);
-  lua_setmetatable(L,-2);
-  lua_pushinteger(L,0);
-  return 2;
-}
-
-/**********************************************************************/
-
-static int polllua___len(lua_State *L)
-{
-  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
-  lua_pushinteger(L,set->idx);
-  return 1;
-}
-
-/**********************************************************************/
-
-static int polllua___tostring(lua_State *L)
-{
-  lua_pushfstring(L,"pollset (%p)",lua_touserdata(L,1));
-  return 1;
+  return 0;
 }
 
 /**********************************************************************/
 
-static int polllua___gc(lua_State *L)
+static void psepoll_free(pollset__t *base)
 {
-  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
+  pollset_epoll__t *set = (pollset_epoll__t *)base;
+  
   free(set->list);
   if (set->efh != -1)
     close(set->efh);
   set->list = NULL;
   set->efh  = -1;
-  return 0;
 }
 
 /**********************************************************************/
 
-static int polllua_insert(lua_State *L)
+static int psepoll_insert(pollset__t *base,int fh,unsigned int flags)
 {
-  pollset__t         *set = luaL_checkudata(L,1,TYPE_POLL);
-  int                 fh;
+  pollset_epoll__t   *set = (pollset_epoll__t *)base;
   struct epoll_event  event;
   
-  lua_settop(L,4);
-  
-  if (!luaL_callmeta(L,2,"_tofd"))
-  {
-    lua_pushinteger(L,EINVAL);
-    return 1;
-  }
-  
-  fh            = luaL_checkinteger(L,-1);
-  event.events  = pollset_toevents(L,3);
+  event.events  = psepoll_toevents(flags);
   event.data.fd = fh;
   
-  if (epoll_ctl(set->efh,EPOLL_CTL_ADD,event.data.fd,&event) < 0)
-  {
-    lua_pushinteger(L,errno);
-    return 1;
-  }
-  
-  lua_getuservalue(L,1);
-  lua_pushinteger(L,fh);
-  
-  if (lua_isnil(L,4))
-    lua_pushinteger(L,fh);
-  else
-    lua_pushvalue(L,4);
-    
-  lua_settable(L,-3);
-  
-  set->idx++;
-  lua_pushinteger(L,0);
-  return 1;
+  if (epoll_ctl(set->efh,EPOLL_CTL_ADD,fh,&event) < 0)
+    return errno;
+  return 0;
 }
 
 /**********************************************************************/
 
-static int polllua_update(lua_State *L)
+static int psepoll_update(pollset__t *base,int fh,unsigned int flags)
 {
-  pollset__t         *set = luaL_checkudata(L,1,TYPE_POLL);
-  int                 fh;
+  pollset_epoll__t   *set = (pollset_epoll__t *)base;
   struct epoll_event  event;
   
-  lua_settop(L,3);
-  if (!luaL_callmeta(L,2,"_tofd"))
-  {
-    lua_pushinteger(L,EINVAL);
-    return 1;
-  }
-  
-  fh            = luaL_checkinteger(L,-1);
-  event.events  = pollset_toevents(L,3);
+  event.events  = psepoll_toevents(flags) & ~EPOLLEXCLUSIVE;
   event.data.fd = fh;
-  errno         = 0;
   
-  epoll_ctl(set->efh,EPOLL_CTL_MOD,fh,&event);
-  lua_pushinteger(L,errno);
-  return 1;
+  if (epoll_ctl(set->efh,EPOLL_CTL_MOD,fh,&event) < 0)
+    return errno;
+  return 0;
 }
 
 /**********************************************************************/
 
-static int polllua_remove(lua_State *L)
+static int psepoll_remove(pollset__t *base,int fh)
 {
-  pollset__t         *set = luaL_checkudata(L,1,TYPE_POLL);
-  int                 fh;
+  pollset_epoll__t   *set = (pollset_epoll__t *)base;
   struct epoll_event  event;
   
-  if (!luaL_callmeta(L,2,"_tofd"))
-  {
-    lua_pushinteger(L,EINVAL);
-    return 1;
-  }
-  
-  fh = luaL_checkinteger(L,-1);
-  
   if (epoll_ctl(set->efh,EPOLL_CTL_DEL,fh,&event) < 0)
-  {
-    lua_pushinteger(L,errno);
-    return 1;
-  }
-  
-  lua_getuservalue(L,1);
-  lua_pushinteger(L,fh);
-  lua_pushnil(L);
-  lua_settable(L,-3);
-  
-  set->idx--;
-  lua_pushinteger(L,0);
-  return 1;
+    return errno;
+  return 0;
 }
 
 /**********************************************************************/
 
-static int polllua_wait(lua_State *L)
+static int psepoll_wait(pollset__t *base,lua_Number dtimeout)
 {
-  pollset__t *set      = luaL_checkudata(L,1,TYPE_POLL);
-  lua_Number  dtimeout = luaL_optnumber(L,2,-1.0);
-  int         timeout;
-  
-  free(set->list);
-  set->list = NULL;
+  pollset_epoll__t *set = (pollset_epoll__t *)base;
+  int               timeout;
+  int               want;
   
   if (dtimeout < 0)
     timeout = -1;
   else
     timeout = (int)(dtimeout * 1000.0);
-    
-  if (set->idx > 0)
-  {
-    set->list = calloc(set->idx,sizeof(struct epoll_event));
-    if (set->list == NULL)
-      set->max = -1;
-    else
-      set->max = epoll_wait(set->efh,set->list,set->idx,timeout);
-  }
-  else
-    set->max = 0;
-    
+  
+  /*----------------------------------------------------------------------
+  ; The event buffer is kept between calls, and only grows (doubling) as
+  ; more files are registered, up to maxevents.  Anything that didn't fit
+  ; this time around will be returned on the next call.
+  ;-----------------------------------------------------------------------*/
+  
+  want = set->base.idx < (size_t)set->base.maxevents
+       ? (int)set->base.idx
+       : set->base.maxevents;
+  
+  set->max   = 0;
   set->count = 0;
   
-  if (set->max < 0)
+  if (want > set->size)
   {
-    lua_pushboolean(L,false);
-    lua_pushinteger(L,errno);
-    free(set->list);
-    set->list = NULL;
-    return 2;
+    struct epoll_event *list;
+    int                 size = set->size > 0 ? set->size : 16;
+    
+    while(size < want)
+      size *= 2;
+    if (size > set->base.maxevents)
+      size = set->base.maxevents;
+      
+    list = realloc(set->list,(size_t)size * sizeof(struct epoll_event));
+    if (list == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+    
+    set->list = list;
+    set->size = size;
   }
-  else
+  
+  if (want > 0)
   {
-    lua_pushboolean(L,true);
-    lua_pushboolean(L,set->max == 0);
-    return 2;
+    int max = epoll_wait(set->efh,set->list,want,timeout);
+    if (max < 0)
+      return -1;
+    set->max = max;
   }
+  
+  return set->max;
 }
 
 /**********************************************************************/
 
-static int polllua_events(lua_State *L)
+static bool psepoll_next(pollset__t *base,int *pfh,unsigned int *pevents)
 {
-  luaL_checkudata(L,1,TYPE_POLL);
-  lua_pushcfunction(L,pollset_next);
-  lua_pushvalue(L,1);
-  lua_pushnil(L);
-  return 3;
+  pollset_epoll__t *set = (pollset_epoll__t *)base;
+  
+  if (set->count < set->max)
+  {
+    uint32_t events = set->list[set->count].events;
+    
+    *pfh     = set->list[set->count].data.fd;
+    *pevents = ((events & EPOLLIN)    ? PS_READ     : 0)
+             | ((events & EPOLLOUT)   ? PS_WRITE    : 0)
+             | ((events & EPOLLPRI)   ? PS_PRIORITY : 0)
+             | ((events & EPOLLERR)   ? PS_ERROR    : 0)
+             | ((events & EPOLLHUP)   ? PS_HANGUP   : 0)
+             | ((events & EPOLLRDHUP) ? PS_RDHANGUP : 0)
+             ;
+    set->count++;
+    return true;
+  }
+  
+  return false;
 }
 
+/**********************************************************************/
+
+static pollops__t const m_epoll_ops =
+{
+  .name     = "epoll",
+  .events   = PS_READ | PS_WRITE | PS_PRIORITY | PS_ERROR | PS_HANGUP | (EPOLLRDHUP ? PS_RDHANGUP : 0),
+  .flags    = PS_EDGE | PS_ONESHOT | (EPOLLEXCLUSIVE ? PS_EXCLUSIVE : 0),
+  .size     = sizeof(pollset_epoll__t),
+  .fallback = NULL,
+  .init     = psepoll_init,
+  .free     = psepoll_free,
+  .forget   = psepoll_free,
+  .insert   = psepoll_insert,
+  .update   = psepoll_update,
+  .remove   = psepoll_remove,
+  .wait     = psepoll_wait,
+  .next     = psepoll_next,
+  .submit   = NULL,
+  .result   = NULL,
+};
+
 #endif
 
-/*********************************************************************
+/************************************************************************
 *
-* kqueue() based version, used for *BSD and Mac OS-X
+* LINUX implementation of pollset, using io_uring.
 *
-*********************************************************************/
-
-#ifdef POLLSET_IMPL_KQUEUE
-#define POLLSET_IMPL    "kqueue"
+* Files are watched with IORING_OP_POLL_ADD.  Level triggered files use a
+* single shot poll that is re-armed as soon as it's reaped (the re-arm is
+* submitted at the next set:wait(), and completes right away if the file
+* is still ready), edge triggered files use a multishot poll, and one shot
+* files use a single shot poll that isn't re-armed until set:update().
+*
+* Since there's no way to modify a pending poll request, set:update()
+* removes the old one and submits a new one.  Each file has a generation
+* number, encoded in the user_data field of each request, so any stale
+* completions from an old request are ignored.
+*
+* This also supports completion based I/O with set:recv(), set:send() and
+* set:accept().  Each operation in flight has a slot in set->ops[], which
+* holds the buffer for the operation and its result.
+*
+* If the kernel doesn't support the features we need (or io_uring is
+* disabled), creation fails and we fall back to using epoll.
+*
+*************************************************************************/
 
-#include <math.h>
-#include <stdbool.h>
+#ifdef POLLSET_IMPL_URING
 
-#include <sys/types.h>
-#include <sys/event.h>
-#include <sys/time.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
+#include <poll.h>
+#include <endian.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#ifndef POLLRDHUP
+#  define POLLRDHUP 0
+#endif
+
+#define URING_POLL      0uLL
+#define URING_OP        1uLL
+#define URING_IGNORE    2uLL
+#define URING_MINEVENTS 64
 
 typedef struct
 {
-  int            qfh;
-  size_t         idx;
-  struct kevent *list;
-  int            max;
-  int            count;
-} pollset__t;
+  unsigned int gen;       /* bumped when the poll request changes */
+  unsigned int instance;  /* bumped each time the file is inserted */
+  unsigned int flags;
+  bool         used;
+  bool         armed;
+} psuring_file__t;
+
+typedef struct
+{
+  int          fh;
+  unsigned int gen;     /* file gen for polls, instance for operations */
+  unsigned int events;
+  int          op;
+} psuring_event__t;
+
+typedef struct
+{
+  int          fh;
+  unsigned int kind;
+  char        *buf;
+  size_t       len;
+  int          res;
+  bool         inflight;
+  bool         cancelled;
+  int          next;
+} psuring_op__t;
+
+typedef struct
+{
+  pollset__t             base;
+  int                    rfh;
+  void                  *ring;
+  size_t                 ringsize;
+  struct io_uring_sqe   *sqes;
+  size_t                 sqesize;
+  unsigned int          *sq_head;
+  unsigned int          *sq_ktail;
+  unsigned int          *sq_array;
+  unsigned int           sq_mask;
+  unsigned int           sq_entries;
+  unsigned int           sq_tail;
+  unsigned int           pending;
+  unsigned int          *cq_head;
+  unsigned int          *cq_tail;
+  unsigned int           cq_mask;
+  struct io_uring_cqe   *cqes;
+  psuring_file__t       *files;
+  size_t                 nfiles;
+  bool                   rearm;
+  psuring_event__t      *list;
+  int                    size;
+  int                    max;
+  int                    count;
+  psuring_op__t         *ops;
+  int                    nops;
+  int                    freeop;
+  int                    inflight;
+  unsigned int           curkind;
+  char                  *curbuf;
+  int                    curres;
+} pollset_uring__t;
+
+/**********************************************************************/
+
+static inline uint64_t psuring_ud(uint64_t kind,unsigned int gen,unsigned int idx)
+{
+  return (kind << 56) | ((uint64_t)(gen & 0xFFFFFFu) << 32) | idx;
+}
+
+/**********************************************************************/
+
+static int psuring_enter(
+        pollset_uring__t *set,
+        unsigned int      mincomplete,
+        unsigned int      flags,
+        void             *arg,
+        size_t            argsize
+)
+{
+  int rc = syscall(
+                    __NR_io_uring_enter,
+                    set->rfh,
+                    set->pending,
+                    mincomplete,
+                    flags,
+                    arg,
+                    argsize
+                  );
+  if (rc > 0)
+    set->pending -= (unsigned int)rc < set->pending ? (unsigned int)rc : set->pending;
+  return rc;
+}
 
 /**********************************************************************/
 
-static void pollset_toevents(lua_State *L,int idx,struct kevent filters[2])
+static struct io_uring_sqe *psuring_sqe(pollset_uring__t *set)
 {
-  bool do_read  = false;
-  bool do_write = false;
-  bool do_pri   = false;
+  struct io_uring_sqe *sqe;
   
-  for (char const *flags = luaL_checkstring(L,idx) ; *flags ; flags++)
+  if (set->sq_tail - __atomic_load_n(set->sq_head,__ATOMIC_ACQUIRE) >= set->sq_entries)
   {
-    switch(*flags)
+    if (psuring_enter(set,0,0,NULL,0) < 0)
+      return NULL;
+    if (set->sq_tail - __atomic_load_n(set->sq_head,__ATOMIC_ACQUIRE) >= set->sq_entries)
     {
-      case 'r': do_read  = true; break;
-      case 'w': do_write = true; break;
-      case 'p': do_pri   = true; break;
-      default: break;
+      errno = EBUSY;
+      return NULL;
     }
   }
   
-  filters[0].flags |= (do_read || do_pri) ? EV_ENABLE : EV_DISABLE;
-  filters[1].flags |= (do_write)          ? EV_ENABLE : EV_DISABLE;
+  sqe = &set->sqes[set->sq_tail & set->sq_mask];
+  memset(sqe,0,sizeof(struct io_uring_sqe));
+  return sqe;
 }
 
 /**********************************************************************/
 
-static void pollset_pushevents(lua_State *L,struct kevent const *event)
+static void psuring_queue(pollset_uring__t *set)
 {
-  bool read = event->filter == EVFILT_READ;
-  bool pri  = event->flags & EV_OOBAND;
-  bool eof  = event->flags & EV_EOF;
-  
-  lua_createtable(L,0,4);
-  lua_pushboolean(L,read & pri);
-  lua_setfield(L,-2,"priority");
-  lua_pushboolean(L,read & !pri);
-  lua_setfield(L,-2,"read");
-  lua_pushboolean(L,!read);
-  lua_setfield(L,-2,"write");
-  lua_pushboolean(L,eof);
-  lua_setfield(L,-2,"hangup");
+  set->sq_tail++;
+  set->pending++;
+  __atomic_store_n(set->sq_ktail,set->sq_tail,__ATOMIC_RELEASE);
 }
 
 /**********************************************************************/
 
-static int pollset_next(lua_State *L)
+static int psuring_cancel(pollset_uring__t *set,uint8_t opcode,uint64_t ud)
 {
-  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
-  
-  if (set->count < set->max)
-  {
-    lua_getuservalue(L,1);
-    pollset_pushevents(L,&set->list[set->count]);
-    lua_pushinteger(L,set->list[set->count].ident);
-    lua_gettable(L,-3);
-    lua_setfield(L,-2,"obj");
-    set->count++;
-  }
-  else
-  {
-    free(set->list);
-    set->list = NULL;
-    lua_pushnil(L);
-  }
+  struct io_uring_sqe *sqe = psuring_sqe(set);
   
-  return 1;
+  if (sqe == NULL)
+    return errno;
+    
+  sqe->opcode    = opcode;
+  sqe->fd        = -1;
+  sqe->addr      = ud;
+  sqe->user_data = psuring_ud(URING_IGNORE,0,0);
+  psuring_queue(set);
+  return 0;
 }
 
 /**********************************************************************/
 
-static int pollset_lua(lua_State *L)
+static inline uint32_t psuring_pollmask(uint32_t mask)
+{
+#if __BYTE_ORDER == __BIG_ENDIAN
+  mask = (mask << 16) | (mask >> 16);
+#endif
+  return mask;
+}
+
+/**********************************************************************/
+
+static int psuring_arm(pollset_uring__t *set,int fh)
 {
-  pollset__t *set;
-  int         qfh;
+  psuring_file__t     *file = &set->files[fh];
+  struct io_uring_sqe *sqe;
+  uint32_t             mask;
   
-  qfh = kqueue();
-  if (qfh == -1)
+  mask = ((file->flags & PS_READ)     ? POLLIN    : 0)
+       | ((file->flags & PS_WRITE)    ? POLLOUT   : 0)
+       | ((file->flags & PS_PRIORITY) ? POLLPRI   : 0)
+       | ((file->flags & PS_RDHANGUP) ? POLLRDHUP : 0)
+       ;
+  mask = psuring_pollmask(mask);
+  sqe  = psuring_sqe(set);
+  if (sqe == NULL)
   {
-    lua_pushnil(L);
-    lua_pushinteger(L,errno);
-    return 2;
+    set->rearm = true;
+    return errno;
   }
   
-  set        = lua_newuserdata(L,sizeof(pollset__t));
-  set->qfh   = qfh;
-  set->list  = NULL;
-  set->idx   = 0;
-  set->max   = 0;
-  set->count = 0;
+  sqe->opcode        = IORING_OP_POLL_ADD;
+  sqe->fd            = fh;
+  sqe->poll32_events = mask;
+  sqe->user_data     = psuring_ud(URING_POLL,file->gen,(unsigned int)fh);
   
-  lua_createtable(L,0,0);
-  lua_setuservalue(L,1);
-  luaL_getmetatable(L,TYPE_POLL);
-  lua_setmetatable(L,-2);
-  lua_pushinteger(L,0);
-  return 2;
+  if ((file->flags & (PS_EDGE | PS_ONESHOT)) == PS_EDGE)
+    sqe->len = IORING_POLL_ADD_MULTI;
+    
+  psuring_queue(set);
+  file->armed = true;
+  return 0;
 }
 
 /**********************************************************************/
 
-static int polllua___len(lua_State *L)
+static int psuring_disarm(pollset_uring__t *set,int fh)
 {
-  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
-  lua_pushinteger(L,set->idx);
-  return 1;
+  psuring_file__t *file = &set->files[fh];
+  int              rc   = 0;
+  
+  if (file->armed)
+    rc = psuring_cancel(
+                         set,
+                         IORING_OP_POLL_REMOVE,
+                         psuring_ud(URING_POLL,file->gen,(unsigned int)fh)
+                       );
+  file->armed = false;
+  file->gen++;
+  return rc;
 }
 
 /**********************************************************************/
 
-static int polllua___tostring(lua_State *L)
+static void psuring_freeop(pollset_uring__t *set,int idx)
 {
-  lua_pushfstring(L,"pollset (%p)",luaL_checkudata(L,1,TYPE_POLL));
-  return 1;
+  psuring_op__t *op = &set->ops[idx];
+  
+  if ((op->kind == PS_ACCEPT) && op->cancelled && (op->res >= 0))
+    close(op->res);
+    
+  free(op->buf);
+  op->buf       = NULL;
+  op->kind      = 0;
+  op->cancelled = false;
+  op->next      = set->freeop;
+  set->freeop   = idx;
 }
 
 /**********************************************************************/
 
-static int polllua___gc(lua_State *L)
+static bool psuring_addevent(pollset_uring__t *set,int fh,unsigned int events,int op)
 {
-  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
-  free(set->list);
-  if (set->qfh != -1)
-    close(set->qfh);
-  set->list = NULL;
-  set->qfh  = -1;
-  return 0;
+  if (set->max == set->size)
+  {
+    psuring_event__t *list;
+    int               size;
+    
+    if (set->size == set->base.maxevents)
+      return false;
+    
+    size = set->size > set->base.maxevents / 2
+         ? set->base.maxevents
+         : set->size * 2;
+    list = realloc(set->list,(size_t)size * sizeof(psuring_event__t));
+    if (list == NULL)
+      return false;
+    set->list = list;
+    set->size = size;
+  }
+  
+  set->list[set->max].fh     = fh;
+  set->list[set->max].gen    = op < 0 ? set->files[fh].gen : set->files[fh].instance;
+  set->list[set->max].events = events;
+  set->list[set->max].op     = op;
+  set->max++;
+  return true;
 }
 
 /**********************************************************************/
 
-static int polllua_insert(lua_State *L)
+static void psuring_reap(pollset_uring__t *set)
 {
-  pollset__t    *set;
-  int            backlog;
-  struct kevent  filters[2];
-  int            fh;
-  
-  lua_settop(L,4);
+  unsigned int head = *set->cq_head;
+  unsigned int tail = __atomic_load_n(set->cq_tail,__ATOMIC_ACQUIRE);
   
-  if (!luaL_callmeta(L,2,"_tofd"))
+  while(head != tail)
   {
-    lua_pushinteger(L,EINVAL);
-    return 1;
+    struct io_uring_cqe *cqe  = &set->cqes[head & set->cq_mask];
+    uint64_t             kind = cqe->user_data >> 56;
+    unsigned int         gen  = (cqe->user_data >> 32) & 0xFFFFFFu;
+    unsigned int         idx  = cqe->user_data & 0xFFFFFFFFu;
+    
+    if (kind == URING_POLL)
+    {
+      psuring_file__t *file;
+      unsigned int     events;
+      
+      if (
+              (idx >= set->nfiles)
+           || !set->files[idx].used
+           || ((set->files[idx].gen & 0xFFFFFFu) != gen)
+         )
+      {
+        head++;
+        continue;
+      }
+      
+      file = &set->files[idx];
+      
+      if (cqe->res == -ECANCELED)
+        events = 0;
+      else if (cqe->res < 0)
+        events = PS_ERROR | ((cqe->res == -EBADF) ? PS_INVALID : 0);
+      else
+        events = ((cqe->res & POLLIN)    ? PS_READ     : 0)
+               | ((cqe->res & POLLOUT)   ? PS_WRITE    : 0)
+               | ((cqe->res & POLLPRI)   ? PS_PRIORITY : 0)
+               | ((cqe->res & POLLERR)   ? PS_ERROR    : 0)
+               | ((cqe->res & POLLHUP)   ? PS_HANGUP   : 0)
+               | ((cqe->res & POLLNVAL)  ? PS_INVALID  : 0)
+               | ((cqe->res & POLLRDHUP) ? PS_RDHANGUP : 0)
+               ;
+               
+      if ((events != 0) && !psuring_addevent(set,(int)idx,events,-1))
+        break;
+        
+      if ((cqe->flags & IORING_CQE_F_MORE) == 0)
+      {
+        file->armed = false;
+        if (((file->flags & PS_ONESHOT) == 0) || (events == 0))
+          psuring_arm(set,(int)idx);
+      }
+    }
+    
+    else if (kind == URING_OP)
+    {
+      psuring_op__t *op = &set->ops[idx];
+      
+      op->res = cqe->res;
+      
+      if (op->cancelled)
+      {
+        op->inflight = false;
+        set->inflight--;
+        psuring_freeop(set,(int)idx);
+      }
+      else
+      {
+        if (!psuring_addevent(set,op->fh,op->kind | ((cqe->res < 0) ? PS_ERROR : 0),(int)idx))
+          break;
+        op->inflight = false;
+        set->inflight--;
+      }
+    }
+    
+    head++;
   }
   
-  set     = luaL_checkudata(L,1,TYPE_POLL);
-  fh      = luaL_checkinteger(L,-1);
-  backlog = luaL_optinteger(L,5,0);
+  __atomic_store_n(set->cq_head,head,__ATOMIC_RELEASE);
+}
+
+/**********************************************************************/
+
+static void psuring_free(pollset__t *base)
+{
+  pollset_uring__t *set   = (pollset_uring__t *)base;
+  bool              drain = true;
   
-  filters[0].ident  = fh;
-  filters[0].filter = EVFILT_READ;
-  filters[0].flags  = EV_ADD;
-  filters[0].fflags = 0;
-  filters[0].data   = backlog;
-  filters[0].udata  = NULL;
+  if (set->rfh == -1)
+    return;
+    
+  /*----------------------------------------------------------------------
+  ; Anything reaped but not yet seen is released now (closing any accepted
+  ; sockets).  The kernel may still write into the buffers of operations
+  ; in flight, so cancel them, and wait in the kernel for the cancellations
+  ; to complete---operations on sockets are cancelled right away.  If we
+  ; can't cancel an operation, its buffer is leaked rather than freed out
+  ; from under the kernel.
+  ;-----------------------------------------------------------------------*/
   
-  filters[1].ident  = fh;
-  filters[1].filter = EVFILT_WRITE;
-  filters[1].flags  = EV_ADD;
-  filters[1].fflags = 0;
-  filters[1].data   = 0;
-  filters[1].udata  = NULL;
+  for (size_t fh = 0 ; fh < set->nfiles ; fh++)
+    set->files[fh].used = false;
+    
+  for (int i = set->count ; i < set->max ; i++)
+  {
+    if (set->list[i].op >= 0)
+    {
+      set->ops[set->list[i].op].cancelled = true;
+      psuring_freeop(set,set->list[i].op);
+    }
+  }
   
-  pollset_toevents(L,3,filters);
+  set->max   = 0;
+  set->count = 0;
   
-  if (kevent(set->qfh,filters,2,NULL,0,NULL) == -1)
+  for (int i = 0 ; i < set->nops ; i++)
   {
-    lua_pushinteger(L,errno);
-    return 1;
+    if (set->ops[i].inflight && !set->ops[i].cancelled)
+    {
+      set->ops[i].cancelled = true;
+      if (psuring_cancel(
+                          set,
+                          IORING_OP_ASYNC_CANCEL,
+                          psuring_ud(URING_OP,0,(unsigned int)i)
+                        ) != 0)
+        drain = false;
+    }
   }
   
-  lua_getuservalue(L,1);
-  lua_pushinteger(L,fh);
+  while(drain && (set->inflight > 0))
+  {
+    if (psuring_enter(set,1,IORING_ENTER_GETEVENTS,NULL,0) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    psuring_reap(set);
+  }
   
-  if (lua_isnil(L,4))
-    lua_pushinteger(L,4);
-  else
-    lua_pushvalue(L,4);
-    
-  lua_settable(L,-3);
+  for (int i = 0 ; i < set->nops ; i++)
+    if (!set->ops[i].inflight)
+      free(set->ops[i].buf);
+      
+  munmap(set->sqes,set->sqesize);
+  munmap(set->ring,set->ringsize);
+  close(set->rfh);
+  free(set->files);
+  free(set->list);
+  free(set->ops);
+  free(set->curbuf);
+  set->rfh    = -1;
+  set->files  = NULL;
+  set->list   = NULL;
+  set->ops    = NULL;
+  set->curbuf = NULL;
+}
+
+/**********************************************************************
+*
+* In a child process, cancelling operations would cancel them for the
+* parent, and the kernel writes into the parent's buffers, not ours, so
+* just let go of everything.
+*
+***********************************************************************/
+
+static void psuring_forget(pollset__t *base)
+{
+  pollset_uring__t *set = (pollset_uring__t *)base;
   
-  set->idx++;
-  lua_pushinteger(L,0);
-  return 1;
+  if (set->rfh == -1)
+    return;
+    
+  for (int i = 0 ; i < set->nops ; i++)
+    free(set->ops[i].buf);
+    
+  munmap(set->sqes,set->sqesize);
+  munmap(set->ring,set->ringsize);
+  close(set->rfh);
+  free(set->files);
+  free(set->list);
+  free(set->ops);
+  free(set->curbuf);
+  set->rfh    = -1;
+  set->files  = NULL;
+  set->list   = NULL;
+  set->ops    = NULL;
+  set->curbuf = NULL;
+  set->max    = 0;
+  set->count  = 0;
 }
 
-/**********************************************************************/
+/**********************************************************************
+*
+* Edge triggered files need multishot polls (Linux 5.13), and there's no
+* feature flag for them, so try one.  A multishot poll on a ready
+* eventfd completes right away, flagged with IORING_CQE_F_MORE; older
+* kernels reject it.
+*
+***********************************************************************/
 
-static int polllua_update(lua_State *L)
+static bool psuring_multishot(pollset_uring__t *set)
 {
-  pollset__t    *set;
-  struct kevent  filters[2];
-  int            fh;
+  struct io_uring_sqe *sqe;
+  bool                 okay = false;
+  int                  fh   = eventfd(1,EFD_NONBLOCK | EFD_CLOEXEC);
   
-  lua_settop(L,3);
-  if (!luaL_callmeta(L,2,"_tofd"))
+  if (fh == -1)
+    return false;
+    
+  sqe = psuring_sqe(set);
+  if (sqe != NULL)
   {
-    lua_pushinteger(L,EINVAL);
-    return 1;
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = fh;
+    sqe->poll32_events = psuring_pollmask(POLLIN);
+    sqe->len           = IORING_POLL_ADD_MULTI;
+    sqe->user_data     = psuring_ud(URING_IGNORE,0,1);
+    psuring_queue(set);
+    
+    if (psuring_enter(set,1,IORING_ENTER_GETEVENTS,NULL,0) >= 0)
+    {
+      unsigned int head = *set->cq_head;
+      unsigned int tail = __atomic_load_n(set->cq_tail,__ATOMIC_ACQUIRE);
+      
+      if (head != tail)
+      {
+        struct io_uring_cqe *cqe = &set->cqes[head & set->cq_mask];
+        
+        okay = (cqe->res > 0) && ((cqe->flags & IORING_CQE_F_MORE) != 0);
+        __atomic_store_n(set->cq_head,head + 1,__ATOMIC_RELEASE);
+      }
+    }
+    
+    /*--------------------------------------------------------------------
+    ; Any further completions from this are ignored by psuring_reap().
+    ;---------------------------------------------------------------------*/
+    
+    if (okay && (psuring_cancel(set,IORING_OP_POLL_REMOVE,psuring_ud(URING_IGNORE,0,1)) == 0))
+      psuring_enter(set,0,0,NULL,0);
   }
   
-  set    = luaL_checkudata(L,1,TYPE_POLL);
-  fh     = luaL_checkinteger(L,-1);
-  
-  filters[0].ident  = fh;
-  filters[0].filter = EVFILT_READ;
-  filters[0].flags  = EV_ADD;
-  filters[0].fflags = 0;
-  filters[0].data   = 0;
-  filters[0].udata  = NULL;
-  
-  filters[1].ident  = fh;
-  filters[1].filter = EVFILT_WRITE;
-  filters[1].flags  = EV_ADD;
-  filters[1].fflags = 0;
-  filters[1].data   = 0;
-  filters[1].udata  = NULL;
-  
-  pollset_toevents(L,3,filters);
-  errno = 0;
-  kevent(set->qfh,filters,2,NULL,0,NULL);
-  lua_pushinteger(L,errno);
-  return 1;
+  close(fh);
+  return okay;
 }
 
 /**********************************************************************/
 
-static int polllua_remove(lua_State *L)
+static int psuring_init(pollset__t *base)
 {
-  pollset__t    *set;
-  struct kevent  filters[2];
-  int            fh;
+  pollset_uring__t       *set = (pollset_uring__t *)base;
+  struct io_uring_params  params;
+  unsigned int            entries;
+  unsigned int            features;
+  size_t                  sqsize;
+  size_t                  cqsize;
+  char                   *ring;
   
-  if (!luaL_callmeta(L,2,"_tofd"))
+  features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+
+  for (entries = 8 ; (entries < 4096) && (entries < (unsigned int)set->base.maxevents) ; entries *= 2)
+    ;
+    
+  memset(&params,0,sizeof(params));
+  set->rfh = syscall(__NR_io_uring_setup,entries,&params);
+  if (set->rfh == -1)
+    return errno;
+    
+  if ((params.features & features) != features)
   {
-    lua_pushinteger(L,EINVAL);
-    return 1;
+    close(set->rfh);
+    set->rfh = -1;
+    return ENOSYS;
   }
   
-  set = luaL_checkudata(L,1,TYPE_POLL);
-  fh  = luaL_checkinteger(L,-1);
+  sqsize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  cqsize = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
   
-  filters[0].ident  = fh;
-  filters[0].filter = EVFILT_READ;
-  filters[0].flags  = EV_DELETE;
-  filters[0].fflags = 0;
-  filters[0].data   = 0;
-  filters[0].udata  = NULL;
+  set->ringsize = sqsize > cqsize ? sqsize : cqsize;
+  set->ring     = mmap(
+                        NULL,
+                        set->ringsize,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        set->rfh,
+                        IORING_OFF_SQ_RING
+                      );
+  if (set->ring == MAP_FAILED)
+  {
+    int err = errno;
+    close(set->rfh);
+    set->rfh = -1;
+    return err;
+  }
   
-  filters[1].ident  = fh;
-  filters[1].filter = EVFILT_WRITE;
-  filters[1].flags  = EV_DELETE;
-  filters[1].fflags = 0;
-  filters[1].data   = 0;
-  filters[1].udata  = NULL;
+  set->sqesize = params.sq_entries * sizeof(struct io_uring_sqe);
+  set->sqes    = mmap(
+                       NULL,
+                       set->sqesize,
+                       PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE,
+                       set->rfh,
+                       IORING_OFF_SQES
+                     );
+  if (set->sqes == MAP_FAILED)
+  {
+    int err = errno;
+    munmap(set->ring,set->ringsize);
+    close(set->rfh);
+    set->rfh = -1;
+    return err;
+  }
   
-  if (kevent(set->qfh,filters,2,NULL,0,NULL) == -1)
+  ring            = set->ring;
+  set->sq_head    = (unsigned int *)(ring + params.sq_off.head);
+  set->sq_ktail   = (unsigned int *)(ring + params.sq_off.tail);
+  set->sq_array   = (unsigned int *)(ring + params.sq_off.array);
+  set->sq_mask    = *(unsigned int *)(ring + params.sq_off.ring_mask);
+  set->sq_entries = params.sq_entries;
+  set->sq_tail    = *set->sq_ktail;
+  set->pending    = 0;
+  set->cq_head    = (unsigned int *)(ring + params.cq_off.head);
+  set->cq_tail    = (unsigned int *)(ring + params.cq_off.tail);
+  set->cq_mask    = *(unsigned int *)(ring + params.cq_off.ring_mask);
+  set->cqes       = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+  
+  for (unsigned int i = 0 ; i < params.sq_entries ; i++)
+    set->sq_array[i] = i;
+    
+  set->files    = NULL;
+  set->nfiles   = 0;
+  set->rearm    = false;
+  set->list     = NULL;
+  set->size     = 0;
+  set->max      = 0;
+  set->count    = 0;
+  set->ops      = NULL;
+  set->nops     = 0;
+  set->freeop   = -1;
+  set->inflight = 0;
+  set->curkind  = 0;
+  set->curbuf   = NULL;
+  set->curres   = 0;
+  
+  set->size = set->base.maxevents < URING_MINEVENTS ? set->base.maxevents : URING_MINEVENTS;
+  set->list = malloc((size_t)set->size * sizeof(psuring_event__t));
+  if (set->list == NULL)
   {
-    lua_pushinteger(L,errno);
-    return 1;
+    psuring_free(base);
+    return ENOMEM;
   }
   
-  lua_getuservalue(L,1);
-  lua_pushinteger(L,fh);
-  lua_pushnil(L);
-  lua_settable(L,-3);
+  if (!psuring_multishot(set))
+  {
+    psuring_free(base);
+    return ENOSYS;
+  }
   
-  set->idx--;
-  lua_pushinteger(L,0);
-  return 1;
+  return 0;
 }
 
 /**********************************************************************/
 
-static int polllua_wait(lua_State *L)
+static int psuring_insert(pollset__t *base,int fh,unsigned int flags)
 {
-  pollset__t      *set      = luaL_checkudata(L,1,TYPE_POLL);
-  lua_Number       dtimeout = luaL_optnumber(L,2,-1.0);
-  struct timespec *ptimeout;
-  struct timespec  timeout;
+  pollset_uring__t *set = (pollset_uring__t *)base;
   
-  if (dtimeout >= 0)
-  {
-    double seconds;
-    double fract    = modf(dtimeout,&seconds);
-    timeout.tv_sec  = (time_t)seconds;
-    timeout.tv_nsec = (long)(fract * 1000000000.0);
-    ptimeout        = &timeout;
-  }
-  else
-    ptimeout = NULL;
+  if (fh < 0)
+    return EBADF;
     
-  if (set->idx > 0)
+  if ((size_t)fh >= set->nfiles)
   {
-    set->list = calloc(set->idx,sizeof(struct kevent));
-    if (set->list == NULL)
-      set->max = -1;
-    else
-      set->max = kevent(set->qfh,NULL,0,set->list,set->idx,ptimeout);
+    psuring_file__t *files;
+    size_t           nfiles = set->nfiles > 0 ? set->nfiles : 64;
+    
+    while(nfiles <= (size_t)fh)
+      nfiles *= 2;
+      
+    files = realloc(set->files,nfiles * sizeof(psuring_file__t));
+    if (files == NULL)
+      return ENOMEM;
+    memset(&files[set->nfiles],0,(nfiles - set->nfiles) * sizeof(psuring_file__t));
+    set->files  = files;
+    set->nfiles = nfiles;
   }
-  else
-    set->max = 0;
+  
+  if (set->files[fh].used)
+    return EEXIST;
     
-  set->count = 0;
+  set->files[fh].used  = true;
+  set->files[fh].flags = flags;
+  set->files[fh].gen++;
+  set->files[fh].instance++;
+  return psuring_arm(set,fh);
+}
+
+/**********************************************************************/
+
+static int psuring_update(pollset__t *base,int fh,unsigned int flags)
+{
+  pollset_uring__t *set = (pollset_uring__t *)base;
   
-  if (set->max < 0)
-  {
-    lua_pushboolean(L,false);
-    lua_pushinteger(L,errno);
-    free(set->list);
-    set->list = NULL;
-    return 2;
-  }
-  else
-  {
-    lua_pushboolean(L,true);
-    lua_pushboolean(L,set->max == 0);
-    return 2;
-  }
+  if ((fh < 0) || ((size_t)fh >= set->nfiles) || !set->files[fh].used)
+    return ENOENT;
+    
+  psuring_disarm(set,fh);
+  set->files[fh].flags = flags;
+  return psuring_arm(set,fh);
 }
 
 /**********************************************************************/
 
-static int polllua_events(lua_State *L)
+static int psuring_remove(pollset__t *base,int fh)
 {
-  luaL_checkudata(L,1,TYPE_POLL);
-  lua_pushcfunction(L,pollset_next);
-  lua_pushvalue(L,1);
-  lua_pushnil(L);
-  return 3;
+  pollset_uring__t *set = (pollset_uring__t *)base;
+  
+  if ((fh < 0) || ((size_t)fh >= set->nfiles) || !set->files[fh].used)
+    return ENOENT;
+    
+  for (int i = 0 ; i < set->nops ; i++)
+  {
+    if ((set->ops[i].fh == fh) && set->ops[i].inflight && !set->ops[i].cancelled)
+    {
+      set->ops[i].cancelled = true;
+      psuring_cancel(
+                      set,
+                      IORING_OP_ASYNC_CANCEL,
+                      psuring_ud(URING_OP,0,(unsigned int)i)
+                    );
+    }
+  }
+  
+  psuring_disarm(set,fh);
+  set->files[fh].used = false;
+  return 0;
+}
+
+/**********************************************************************/
+
+static int psuring_wait(pollset__t *base,lua_Number dtimeout)
+{
+  pollset_uring__t *set = (pollset_uring__t *)base;
+  struct timespec   deadline;
+  
+  /*----------------------------------------------------------------------
+  ; Any events not consumed from the last call are kept---they may be the
+  ; results of set:recv() and friends, which can't be generated again.
+  ;-----------------------------------------------------------------------*/
+  
+  if (set->count > 0)
+  {
+    memmove(
+             &set->list[0],
+             &set->list[set->count],
+             (size_t)(set->max - set->count) * sizeof(psuring_event__t)
+           );
+    set->max  -= set->count;
+    set->count = 0;
+  }
+  
+  if (set->rearm)
+  {
+    set->rearm = false;
+    for (size_t fh = 0 ; fh < set->nfiles ; fh++)
+      if (set->files[fh].used && !set->files[fh].armed && !(set->files[fh].flags & PS_ONESHOT))
+        psuring_arm(set,(int)fh);
+  }
+  
+  if (set->max > 0)
+    dtimeout = 0;
+    
+  if (dtimeout > 0)
+  {
+    clock_gettime(CLOCK_MONOTONIC,&deadline);
+    deadline.tv_sec  += (time_t)dtimeout;
+    deadline.tv_nsec += (long)((dtimeout - (time_t)dtimeout) * 1000000000.0);
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+  
+  while(true)
+  {
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec      ts;
+    unsigned int                  flags = 0;
+    
+    memset(&arg,0,sizeof(arg));
+    
+    if (
+            (dtimeout != 0)
+         && ((set->base.idx > 0) || (set->inflight > 0))
+         && (*set->cq_head == __atomic_load_n(set->cq_tail,__ATOMIC_ACQUIRE))
+       )
+    {
+      flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+      
+      if (dtimeout > 0)
+      {
+        struct timespec now;
+        
+        clock_gettime(CLOCK_MONOTONIC,&now);
+        ts.tv_sec  = deadline.tv_sec  - now.tv_sec;
+        ts.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+        if (ts.tv_nsec < 0)
+        {
+          ts.tv_sec--;
+          ts.tv_nsec += 1000000000L;
+        }
+        if (ts.tv_sec < 0)
+          break;
+        arg.ts = (uintptr_t)&ts;
+      }
+    }
+    
+    if ((flags != 0) || (set->pending > 0))
+    {
+      int rc = flags != 0
+             ? psuring_enter(set,1,flags,&arg,sizeof(arg))
+             : psuring_enter(set,0,0,NULL,0);
+             
+      if (rc < 0)
+      {
+        if (errno == ETIME)
+          flags = 0;
+        else if ((errno != EBUSY) && (errno != EAGAIN))
+          return -1;
+      }
+    }
+    
+    psuring_reap(set);
+    
+    if ((set->max > 0) || (flags == 0))
+      break;
+  }
+  
+  return set->max;
+}
+
+/**********************************************************************/
+
+static bool psuring_next(pollset__t *base,int *pfh,unsigned int *pevents)
+{
+  pollset_uring__t *set = (pollset_uring__t *)base;
+  
+  free(set->curbuf);
+  set->curbuf  = NULL;
+  set->curkind = 0;
+  
+  while(set->count < set->max)
+  {
+    psuring_event__t *event = &set->list[set->count++];
+    
+    if (event->op >= 0)
+    {
+      psuring_op__t *op = &set->ops[event->op];
+      
+      /*-------------------------------------------------------------------
+      ; The file was removed (and maybe added again) after the operation
+      ; completed.
+      ;--------------------------------------------------------------------*/
+      
+      if (
+              op->cancelled
+           || !set->files[event->fh].used
+           || (set->files[event->fh].instance != event->gen)
+         )
+      {
+        op->cancelled = true;
+        psuring_freeop(set,event->op);
+        continue;
+      }
+      
+      set->curkind = op->kind;
+      set->curbuf  = op->buf;
+      set->curres  = op->res;
+      op->buf      = NULL;
+      psuring_freeop(set,event->op);
+    }
+    
+    else if (!set->files[event->fh].used || (set->files[event->fh].gen != event->gen))
+      continue;
+      
+    *pfh     = event->fh;
+    *pevents = event->events;
+    return true;
+  }
+  
+  return false;
+}
+
+/**********************************************************************/
+
+static int psuring_submit(
+        pollset__t   *base,
+        int           fh,
+        unsigned int  kind,
+        char const   *data,
+        size_t        len
+)
+{
+  pollset_uring__t    *set = (pollset_uring__t *)base;
+  struct io_uring_sqe *sqe;
+  psuring_op__t       *op;
+  int                  idx;
+  
+  if ((fh < 0) || ((size_t)fh >= set->nfiles) || !set->files[fh].used)
+    return EINVAL;
+    
+  if (set->freeop == -1)
+  {
+    psuring_op__t *ops;
+    int            nops = set->nops > 0 ? set->nops * 2 : 16;
+    
+    ops = realloc(set->ops,(size_t)nops * sizeof(psuring_op__t));
+    if (ops == NULL)
+      return ENOMEM;
+      
+    for (int i = set->nops ; i < nops ; i++)
+    {
+      ops[i].buf       = NULL;
+      ops[i].kind      = 0;
+      ops[i].inflight  = false;
+      ops[i].cancelled = false;
+      ops[i].next      = i + 1 < nops ? i + 1 : -1;
+    }
+    
+    set->ops    = ops;
+    set->freeop = set->nops;
+    set->nops   = nops;
+  }
+  
+  idx = set->freeop;
+  op  = &set->ops[idx];
+  
+  if (kind != PS_ACCEPT)
+  {
+    op->buf = malloc(len > 0 ? len : 1);
+    if (op->buf == NULL)
+      return ENOMEM;
+    if (data != NULL)
+      memcpy(op->buf,data,len);
+  }
+  
+  sqe = psuring_sqe(set);
+  if (sqe == NULL)
+  {
+    int err = errno;
+    free(op->buf);
+    op->buf = NULL;
+    return err;
+  }
+  
+  set->freeop   = op->next;
+  op->fh        = fh;
+  op->kind      = kind;
+  op->len       = len;
+  op->res       = 0;
+  op->inflight  = true;
+  op->cancelled = false;
+  set->inflight++;
+  
+  sqe->fd        = fh;
+  sqe->user_data = psuring_ud(URING_OP,0,(unsigned int)idx);
+  
+  switch(kind)
+  {
+    case PS_RECV:
+         sqe->opcode = IORING_OP_RECV;
+         sqe->addr   = (uintptr_t)op->buf;
+         sqe->len    = (uint32_t)len;
+         break;
+         
+    case PS_SEND:
+         sqe->opcode    = IORING_OP_SEND;
+         sqe->addr      = (uintptr_t)op->buf;
+         sqe->len       = (uint32_t)len;
+         sqe->msg_flags = MSG_NOSIGNAL;
+         break;
+         
+    case PS_ACCEPT:
+         sqe->opcode       = IORING_OP_ACCEPT;
+         sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+         break;
+  }
+  
+  psuring_queue(set);
+  return 0;
+}
+
+/**********************************************************************/
+
+static void psuring_result(pollset__t *base,lua_State *L)
+{
+  pollset_uring__t *set = (pollset_uring__t *)base;
+  
+  if (set->curkind == 0)
+    lua_pushnil(L);
+  else if (set->curres < 0)
+    lua_pushinteger(L,-set->curres);
+  else if (set->curkind == PS_RECV)
+    lua_pushlstring(L,set->curbuf,(size_t)set->curres);
+  else
+    lua_pushinteger(L,set->curres);
+}
+
+/**********************************************************************/
+
+static pollops__t const m_uring_ops =
+{
+  .name     = "uring",
+  .events   = PS_READ | PS_WRITE | PS_PRIORITY | PS_ERROR | PS_HANGUP | PS_INVALID | PS_RDHANGUP | PS_COMPLETION,
+  .flags    = PS_EDGE | PS_ONESHOT,
+  .size     = sizeof(pollset_uring__t),
+  .fallback = &m_epoll_ops,
+  .init     = psuring_init,
+  .free     = psuring_free,
+  .forget   = psuring_forget,
+  .insert   = psuring_insert,
+  .update   = psuring_update,
+  .remove   = psuring_remove,
+  .wait     = psuring_wait,
+  .next     = psuring_next,
+  .submit   = psuring_submit,
+  .result   = psuring_result,
+};
+
+#endif
+
+/*********************************************************************
+*
+* kqueue() based version, used for *BSD and Mac OS-X
+*
+*********************************************************************/
+
+#ifdef POLLSET_IMPL_KQUEUE
+
+#include <math.h>
+
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+typedef struct
+{
+  pollset__t     base;
+  int            qfh;
+  struct kevent *list;
+  int            size;
+  int            max;
+  int            count;
+} pollset_kqueue__t;
+
+/**********************************************************************/
+
+static void pskqueue_filters(
+        struct kevent  filters[2],
+        int            fh,
+        unsigned short action,
+        unsigned int   flags
+)
+{
+  unsigned short mode = ((flags & PS_EDGE)    ? EV_CLEAR    : 0)
+                      | ((flags & PS_ONESHOT) ? EV_DISPATCH : 0)
+                      ;
+                      
+  filters[0].ident  = fh;
+  filters[0].filter = EVFILT_READ;
+  filters[0].flags  = action;
+  filters[0].fflags = 0;
+  filters[0].data   = 0;
+  filters[0].udata  = NULL;
+  
+  filters[1].ident  = fh;
+  filters[1].filter = EVFILT_WRITE;
+  filters[1].flags  = action;
+  filters[1].fflags = 0;
+  filters[1].data   = 0;
+  filters[1].udata  = NULL;
+  
+  if (action == EV_ADD)
+  {
+    filters[0].flags |= mode | ((flags & (PS_READ | PS_PRIORITY)) ? EV_ENABLE : EV_DISABLE);
+    filters[1].flags |= mode | ((flags & PS_WRITE)                ? EV_ENABLE : EV_DISABLE);
+  }
+}
+
+/**********************************************************************/
+
+static int pskqueue_init(pollset__t *base)
+{
+  pollset_kqueue__t *set = (pollset_kqueue__t *)base;
+  
+  set->qfh = kqueue();
+  if (set->qfh == -1)
+    return errno;
+    
+  set->list  = NULL;
+  set->size  = 0;
+  set->max   = 0;
+  set->count = 0;
+  return 0;
+}
+
+/**********************************************************************/
+
+static void pskqueue_free(pollset__t *base)
+{
+  pollset_kqueue__t *set = (pollset_kqueue__t *)base;
+  
+  free(set->list);
+  if (set->qfh != -1)
+    close(set->qfh);
+  set->list = NULL;
+  set->qfh  = -1;
+}
+
+/**********************************************************************
+*
+* A kqueue isn't inherited by a child process, so there's no descriptor
+* to close.
+*
+***********************************************************************/
+
+static void pskqueue_forget(pollset__t *base)
+{
+  pollset_kqueue__t *set = (pollset_kqueue__t *)base;
+  
+  free(set->list);
+  set->list = NULL;
+  set->qfh  = -1;
+}
+
+/**********************************************************************/
+
+static int pskqueue_insert(pollset__t *base,int fh,unsigned int flags)
+{
+  pollset_kqueue__t *set = (pollset_kqueue__t *)base;
+  struct kevent      filters[2];
+  
+  pskqueue_filters(filters,fh,EV_ADD,flags);
+  if (kevent(set->qfh,filters,2,NULL,0,NULL) == -1)
+    return errno;
+  return 0;
+}
+
+/**********************************************************************/
+
+static int pskqueue_remove(pollset__t *base,int fh)
+{
+  pollset_kqueue__t *set = (pollset_kqueue__t *)base;
+  struct kevent      filters[2];
+  
+  pskqueue_filters(filters,fh,EV_DELETE,0);
+  if (kevent(set->qfh,filters,2,NULL,0,NULL) == -1)
+    return errno;
+  return 0;
+}
+
+/**********************************************************************/
+
+static int pskqueue_wait(pollset__t *base,lua_Number dtimeout)
+{
+  pollset_kqueue__t *set = (pollset_kqueue__t *)base;
+  struct timespec   *ptimeout;
+  struct timespec    timeout;
+  int                want;
+  
+  if (dtimeout >= 0)
+  {
+    double seconds;
+    double fract    = modf(dtimeout,&seconds);
+    timeout.tv_sec  = (time_t)seconds;
+    timeout.tv_nsec = (long)(fract * 1000000000.0);
+    ptimeout        = &timeout;
+  }
+  else
+    ptimeout = NULL;
+    
+  /*----------------------------------------------------------------------
+  ; See the comment in psepoll_wait().
+  ;-----------------------------------------------------------------------*/
+  
+  want = set->base.idx < (size_t)set->base.maxevents
+       ? (int)set->base.idx
+       : set->base.maxevents;
+       
+  set->max   = 0;
+  set->count = 0;
+  
+  if (want > set->size)
+  {
+    struct kevent *list;
+    int            size = set->size > 0 ? set->size : 16;
+    
+    while(size < want)
+      size *= 2;
+    if (size > set->base.maxevents)
+      size = set->base.maxevents;
+      
+    list = realloc(set->list,(size_t)size * sizeof(struct kevent));
+    if (list == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+    
+    set->list = list;
+    set->size = size;
+  }
+  
+  if (want > 0)
+  {
+    int max = kevent(set->qfh,NULL,0,set->list,want,ptimeout);
+    if (max < 0)
+      return -1;
+    set->max = max;
+  }
+  
+  return set->max;
+}
+
+/**********************************************************************/
+
+static bool pskqueue_next(pollset__t *base,int *pfh,unsigned int *pevents)
+{
+  pollset_kqueue__t *set = (pollset_kqueue__t *)base;
+  
+  if (set->count < set->max)
+  {
+    struct kevent const *event = &set->list[set->count];
+    bool                 read  = event->filter == EVFILT_READ;
+    bool                 pri   = event->flags & EV_OOBAND;
+    bool                 eof   = event->flags & EV_EOF;
+    
+    *pfh     = event->ident;
+    *pevents = ((read &&  pri) ? PS_PRIORITY : 0)
+             | ((read && !pri) ? PS_READ     : 0)
+             | ((!read)        ? PS_WRITE    : 0)
+             | ((eof)          ? PS_HANGUP   : 0)
+             ;
+    set->count++;
+    return true;
+  }
+  
+  return false;
 }
 
+/**********************************************************************/
+
+static pollops__t const m_kqueue_ops =
+{
+  .name     = "kqueue",
+  .events   = PS_READ | PS_WRITE | PS_PRIORITY | PS_HANGUP,
+  .flags    = PS_EDGE | PS_ONESHOT,
+  .size     = sizeof(pollset_kqueue__t),
+  .fallback = NULL,
+  .init     = pskqueue_init,
+  .free     = pskqueue_free,
+  .forget   = pskqueue_forget,
+  .insert   = pskqueue_insert,
+  .update   = pskqueue_insert,
+  .remove   = pskqueue_remove,
+  .wait     = pskqueue_wait,
+  .next     = pskqueue_next,
+  .submit   = NULL,
+  .result   = NULL,
+};
+
 #endif
 
 /*********************************************************************
@@ -796,84 +2008,1362 @@ static int polllua_events(lua_State *L)
 * given Lua state.  I felt this was a Good Idea(TM), since if a Lua
 * instance is using a particular memory allocation scheme, there is
 * probably a good reason for it.
+*
+* To keep set:insert(), set:update() and set:remove() O(1), set->slot[]
+* maps a file descriptor to its index in set->set[] (-1 if it's not in
+* the set), removal moves the last entry into the hole, and the arrays
+* grow geometrically.
 *********************************************************************/
 
 #ifdef POLLSET_IMPL_POLL
-#define POLLSET_IMPL    "poll"
 
-#include <stdbool.h>
-#include <string.h>
 #include <poll.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <unistd.h>
 
-typedef struct
+#ifndef POLLRDHUP
+#  define POLLRDHUP 0
+#endif
+
+/*-------------------------------------------------------------------------
+; POSIX states POLLNVAL is ignored in the events field, so we use it to mark
+; one shot files.  Once an event is reported for such a file, the file
+; descriptor is stored as ~fd, which poll() will ignore, until the file is
+; re-armed with set:update().
+;--------------------------------------------------------------------------*/
+
+#define POLL_ONESHOT    POLLNVAL
+
+/*-------------------------------------------------------------------------
+; nfds is the number of entries in set[].  It can't be base.idx, since that
+; also counts emulated timers, which never make it here.
+;--------------------------------------------------------------------------*/
+
+typedef struct
+{
+  pollset__t     base;
+  struct pollfd *set;
+  size_t         nfds;
+  size_t         max;
+  size_t         count;
+  int           *slot;
+  size_t         nslot;
+} pollset_poll__t;
+
+/**********************************************************************/
+
+static short pspoll_toevents(unsigned int flags)
+{
+  return ((flags & PS_READ)     ? POLLIN       : 0)
+       | ((flags & PS_WRITE)    ? POLLOUT      : 0)
+       | ((flags & PS_PRIORITY) ? POLLPRI      : 0)
+       | ((flags & PS_RDHANGUP) ? POLLRDHUP    : 0)
+       | ((flags & PS_ONESHOT)  ? POLL_ONESHOT : 0)
+       ;
+}
+
+/**********************************************************************/
+
+static int pspoll_find(pollset_poll__t *set,int fh)
+{
+  if ((fh < 0) || ((size_t)fh >= set->nslot))
+    return -1;
+  return set->slot[fh];
+}
+
+/**********************************************************************/
+
+static void pspoll_move(pollset_poll__t *set,size_t to,size_t from)
+{
+  int fh = set->set[from].fd;
+  
+  set->set[to]                 = set->set[from];
+  set->slot[fh < 0 ? ~fh : fh] = (int)to;
+}
+
+/**********************************************************************/
+
+static int pspoll_init(pollset__t *base)
+{
+  pollset_poll__t *set = (pollset_poll__t *)base;
+  
+  set->set   = NULL;
+  set->nfds  = 0;
+  set->max   = 0;
+  set->count = 0;
+  set->slot  = NULL;
+  set->nslot = 0;
+  return 0;
+}
+
+/**********************************************************************/
+
+static void pspoll_free(pollset__t *base)
+{
+  pollset_poll__t *set = (pollset_poll__t *)base;
+  
+  (*set->base.allocf)(set->base.ud,set->set,set->max * sizeof(struct pollfd),0);
+  (*set->base.allocf)(set->base.ud,set->slot,set->nslot * sizeof(int),0);
+  set->set   = NULL;
+  set->nfds  = 0;
+  set->max   = 0;
+  set->slot  = NULL;
+  set->nslot = 0;
+}
+
+/**********************************************************************/
+
+static int pspoll_insert(pollset__t *base,int fh,unsigned int flags)
+{
+  pollset_poll__t *set = (pollset_poll__t *)base;
+  size_t           idx = set->nfds;
+  
+  if (fh < 0)
+    return EBADF;
+    
+  if ((size_t)fh >= set->nslot)
+  {
+    int    *new;
+    size_t  newmax = set->nslot > 0 ? set->nslot : 64;
+    
+    while(newmax <= (size_t)fh)
+      newmax *= 2;
+      
+    new = (*set->base.allocf)(
+                set->base.ud,
+                set->slot,
+                set->nslot * sizeof(int),
+                newmax     * sizeof(int)
+        );
+        
+    if (new == NULL)
+      return ENOMEM;
+      
+    for (size_t i = set->nslot ; i < newmax ; i++)
+      new[i] = -1;
+      
+    set->slot  = new;
+    set->nslot = newmax;
+  }
+  
+  if (set->slot[fh] != -1)
+    return EEXIST;
+    
+  if (idx == set->max)
+  {
+    struct pollfd *new;
+    size_t         newmax;
+    struct rlimit  limit;
+    
+    if (getrlimit(RLIMIT_NOFILE,&limit) < 0)
+      return errno;
+      
+    if (set->max >= limit.rlim_cur)
+      return ENOMEM;
+      
+    newmax = set->max > 0 ? set->max * 2 : 16;
+    
+    if (newmax > limit.rlim_cur)
+      newmax = limit.rlim_cur;
+      
+    new = (*set->base.allocf)(
+                set->base.ud,
+                set->set,
+                set->max * sizeof(struct pollfd),
+                newmax   * sizeof(struct pollfd)
+        );
+        
+    if (new == NULL)
+      return ENOMEM;
+      
+    set->set = new;
+    set->max = newmax;
+  }
+  
+  set->set[idx].events  = pspoll_toevents(flags);
+  set->set[idx].revents = 0;
+  set->set[idx].fd      = fh;
+  set->slot[fh]         = (int)idx;
+  set->nfds++;
+  return 0;
+}
+
+/**********************************************************************/
+
+static int pspoll_update(pollset__t *base,int fh,unsigned int flags)
+{
+  pollset_poll__t *set = (pollset_poll__t *)base;
+  int              i   = pspoll_find(set,fh);
+  
+  if (i == -1)
+    return EINVAL;
+    
+  set->set[i].fd     = fh;
+  set->set[i].events = pspoll_toevents(flags);
+  return 0;
+}
+
+/**********************************************************************/
+
+static int pspoll_remove(pollset__t *base,int fh)
+{
+  pollset_poll__t *set  = (pollset_poll__t *)base;
+  int              i    = pspoll_find(set,fh);
+  size_t           last;
+  
+  if (i == -1)
+    return EINVAL;
+    
+  last          = --set->nfds;
+  set->slot[fh] = -1;
+  
+  /*----------------------------------------------------------------------
+  ; Files can be removed while the events are being reported.  If this
+  ; file has already been seen, fill the hole with the last file seen, and
+  ; that hole with the last file, so no file still to be seen is skipped.
+  ;-----------------------------------------------------------------------*/
+  
+  if ((size_t)i < set->count)
+  {
+    size_t seen = --set->count;
+    
+    if ((size_t)i != seen)
+      pspoll_move(set,(size_t)i,seen);
+    i = (int)seen;
+  }
+  
+  if ((size_t)i != last)
+    pspoll_move(set,(size_t)i,last);
+    
+  return 0;
+}
+
+/**********************************************************************/
+
+static int pspoll_wait(pollset__t *base,lua_Number dtimeout)
+{
+  pollset_poll__t *set = (pollset_poll__t *)base;
+  int              timeout;
+  
+  if (dtimeout < 0)
+    timeout = -1;
+  else
+    timeout = (int)(dtimeout * 1000.0);
+    
+  set->count = 0;
+  return poll(set->set,set->nfds,timeout);
+}
+
+/**********************************************************************/
+
+static bool pspoll_next(pollset__t *base,int *pfh,unsigned int *pevents)
+{
+  pollset_poll__t *set = (pollset_poll__t *)base;
+  
+  while(set->count < set->nfds)
+  {
+    struct pollfd *pfd    = &set->set[set->count];
+    int            events = pfd->revents;
+    
+    if ((events != 0) && (pfd->fd >= 0))
+    {
+      *pfh     = pfd->fd;
+      *pevents = ((events & POLLIN)    ? PS_READ     : 0)
+               | ((events & POLLOUT)   ? PS_WRITE    : 0)
+               | ((events & POLLPRI)   ? PS_PRIORITY : 0)
+               | ((events & POLLERR)   ? PS_ERROR    : 0)
+               | ((events & POLLHUP)   ? PS_HANGUP   : 0)
+               | ((events & POLLNVAL)  ? PS_INVALID  : 0)
+               | ((events & POLLRDHUP) ? PS_RDHANGUP : 0)
+               ;
+      if ((pfd->events & POLL_ONESHOT) != 0)
+        pfd->fd = ~pfd->fd;
+      set->count++;
+      return true;
+    }
+    set->count++;
+  }
+  
+  return false;
+}
+
+/**********************************************************************/
+
+static pollops__t const m_poll_ops =
+{
+  .name     = "poll",
+  .events   = PS_READ | PS_WRITE | PS_PRIORITY | PS_ERROR | PS_HANGUP | PS_INVALID | (POLLRDHUP ? PS_RDHANGUP : 0),
+  .flags    = PS_ONESHOT,
+  .size     = sizeof(pollset_poll__t),
+  .fallback = NULL,
+  .init     = pspoll_init,
+  .free     = pspoll_free,
+  .forget   = pspoll_free,
+  .insert   = pspoll_insert,
+  .update   = pspoll_update,
+  .remove   = pspoll_remove,
+  .wait     = pspoll_wait,
+  .next     = pspoll_next,
+  .submit   = NULL,
+  .result   = NULL,
+};
+
+#endif
+
+/**********************************************************************
+*
+* And finally the version based on select(), for those really old Unix
+* systems that just can't handle poll().
+*
+***********************************************************************/
+
+#ifdef POLLSET_IMPL_SELECT
+
+#include <math.h>
+#include <sys/select.h>
+
+typedef struct
+{
+  pollset__t base;
+  fd_set     read;
+  fd_set     write;
+  fd_set     except;
+  fd_set     sread;
+  fd_set     swrite;
+  fd_set     sexcept;
+  fd_set     files;
+  fd_set     oneshot;
+  int        min;
+  int        max;
+  int        count;
+} pollset_select__t;
+
+/**********************************************************************/
+
+static void psselect_toevents(pollset_select__t *set,int fh,unsigned int flags)
+{
+  FD_CLR(fh,&set->read);
+  FD_CLR(fh,&set->write);
+  FD_CLR(fh,&set->except);
+  FD_CLR(fh,&set->oneshot);
+  
+  if (flags & PS_READ)     FD_SET(fh,&set->read);
+  if (flags & PS_WRITE)    FD_SET(fh,&set->write);
+  if (flags & PS_PRIORITY) FD_SET(fh,&set->except);
+  if (flags & PS_ONESHOT)  FD_SET(fh,&set->oneshot);
+}
+
+/**********************************************************************/
+
+static int psselect_init(pollset__t *base)
+{
+  pollset_select__t *set = (pollset_select__t *)base;
+  
+  FD_ZERO(&set->read);
+  FD_ZERO(&set->write);
+  FD_ZERO(&set->except);
+  FD_ZERO(&set->sread);
+  FD_ZERO(&set->swrite);
+  FD_ZERO(&set->sexcept);
+  FD_ZERO(&set->files);
+  FD_ZERO(&set->oneshot);
+  set->min   = INT_MAX;
+  set->max   = 0;
+  set->count = 0;
+  return 0;
+}
+
+/**********************************************************************/
+
+static void psselect_free(pollset__t *base)
+{
+  (void)base;
+}
+
+/**********************************************************************/
+
+static int psselect_insert(pollset__t *base,int fh,unsigned int flags)
+{
+  pollset_select__t *set = (pollset_select__t *)base;
+  
+  if ((fh < 0) || (fh >= FD_SETSIZE))
+    return EINVAL;
+    
+  if (fh < set->min) set->min = fh;
+  if (fh > set->max) set->max = fh;
+  
+  FD_SET(fh,&set->files);
+  psselect_toevents(set,fh,flags);
+  return 0;
+}
+
+/**********************************************************************/
+
+static int psselect_update(pollset__t *base,int fh,unsigned int flags)
+{
+  pollset_select__t *set = (pollset_select__t *)base;
+  
+  if ((fh < 0) || (fh >= FD_SETSIZE) || !FD_ISSET(fh,&set->files))
+    return EINVAL;
+    
+  psselect_toevents(set,fh,flags);
+  return 0;
+}
+
+/**********************************************************************/
+
+static int psselect_remove(pollset__t *base,int fh)
+{
+  pollset_select__t *set = (pollset_select__t *)base;
+  
+  if ((fh < 0) || (fh >= FD_SETSIZE) || !FD_ISSET(fh,&set->files))
+    return EINVAL;
+    
+  psselect_toevents(set,fh,0);
+  FD_CLR(fh,&set->files);
+  return 0;
+}
+
+/**********************************************************************/
+
+static int psselect_wait(pollset__t *base,lua_Number timeout)
+{
+  pollset_select__t *set = (pollset_select__t *)base;
+  struct timeval     tout;
+  struct timeval    *ptout;
+  int                events;
+  
+  if (timeout < 0)
+    ptout = NULL;
+  else
+  {
+    double seconds;
+    double fract;
+    
+    fract        = modf(timeout,&seconds);
+    tout.tv_sec  = (long)seconds;
+    tout.tv_usec = (long)(fract * 1000000.0);
+    ptout        = &tout;
+  }
+  
+  set->sread   = set->read;
+  set->swrite  = set->write;
+  set->sexcept = set->except;
+  set->count   = 0;
+  events       = select(FD_SETSIZE,&set->sread,&set->swrite,&set->sexcept,ptout);
+  
+  if (events == -1)
+  {
+    FD_ZERO(&set->sread);
+    FD_ZERO(&set->swrite);
+    FD_ZERO(&set->sexcept);
+  }
+  
+  return events;
+}
+
+/**********************************************************************/
+
+static bool psselect_next(pollset__t *base,int *pfh,unsigned int *pevents)
+{
+  pollset_select__t *set = (pollset_select__t *)base;
+  
+  while(set->count <= set->max)
+  {
+    int fh = set->count++;
+    
+    if (FD_ISSET(fh,&set->sread) || FD_ISSET(fh,&set->swrite) || FD_ISSET(fh,&set->sexcept))
+    {
+      *pfh     = fh;
+      *pevents = (FD_ISSET(fh,&set->sread)   ? PS_READ     : 0)
+               | (FD_ISSET(fh,&set->swrite)  ? PS_WRITE    : 0)
+               | (FD_ISSET(fh,&set->sexcept) ? PS_PRIORITY : 0)
+               ;
+      if (FD_ISSET(fh,&set->oneshot))
+      {
+        FD_CLR(fh,&set->read);
+        FD_CLR(fh,&set->write);
+        FD_CLR(fh,&set->except);
+      }
+      return true;
+    }
+  }
+  
+  return false;
+}
+
+/**********************************************************************/
+
+static pollops__t const m_select_ops =
+{
+  .name     = "select",
+  .events   = PS_READ | PS_WRITE | PS_PRIORITY,
+  .flags    = PS_ONESHOT,
+  .size     = sizeof(pollset_select__t),
+  .fallback = NULL,
+  .init     = psselect_init,
+  .free     = psselect_free,
+  .forget   = psselect_free,
+  .insert   = psselect_insert,
+  .update   = psselect_update,
+  .remove   = psselect_remove,
+  .wait     = psselect_wait,
+  .next     = psselect_next,
+  .submit   = NULL,
+  .result   = NULL,
+};
+
+#endif
+
+/**********************************************************************
+*
+* The implementations compiled in, in order of preference.  The first one
+* is the default.
+*
+***********************************************************************/
+
+static pollops__t const *const m_ops[] =
+{
+#ifdef POLLSET_IMPL_EPOLL
+  &m_epoll_ops,
+#endif
+#ifdef POLLSET_IMPL_URING
+  &m_uring_ops,
+#endif
+#ifdef POLLSET_IMPL_KQUEUE
+  &m_kqueue_ops,
+#endif
+#ifdef POLLSET_IMPL_POLL
+  &m_poll_ops,
+#endif
+#ifdef POLLSET_IMPL_SELECT
+  &m_select_ops,
+#endif
+  NULL
+};
+
+/**********************************************************************
+*
+* Once a set is closed (with close(), __close or __gc), the implementation
+* has released everything (for io_uring, the rings are unmapped), so any
+* further use is an error.
+*
+***********************************************************************/
+
+static pollset__t *pollset_check(lua_State *L,int idx)
+{
+  pollset__t *set = luaL_checkudata(L,idx,TYPE_POLL);
+  
+  if (set->closed)
+    luaL_error(L,"attempt to use a closed pollset");
+  return set;
+}
+
+/**********************************************************************
+*
+* Bookkeeping for file descriptors the set creates for itself (like a
+* timerfd), which need some handling before being reported.
+*
+***********************************************************************/
+
+static int pollset_setkind(pollset__t *set,int fh,unsigned char kind)
+{
+  if ((size_t)fh >= set->nfdkind)
+  {
+    unsigned char *fdkind;
+    size_t         nfdkind = set->nfdkind > 0 ? set->nfdkind : 64;
+    
+    if (kind == PSFD_FILE)
+      return 0;
+      
+    while(nfdkind <= (size_t)fh)
+      nfdkind *= 2;
+      
+    fdkind = realloc(set->fdkind,nfdkind);
+    if (fdkind == NULL)
+      return ENOMEM;
+      
+    memset(&fdkind[set->nfdkind],PSFD_FILE,nfdkind - set->nfdkind);
+    set->fdkind  = fdkind;
+    set->nfdkind = nfdkind;
+  }
+  
+  set->fdkind[fh] = kind;
+  return 0;
+}
+
+/**********************************************************************/
+
+static unsigned char pollset_getkind(pollset__t *set,int fh)
+{
+  if ((fh < 0) || ((size_t)fh >= set->nfdkind))
+    return PSFD_FILE;
+  return set->fdkind[fh];
+}
+
+/**********************************************************************
+*
+* Timers without a timerfd are kept in a heap, ordered by expiration
+* time.  set:wait() won't wait past the earliest one, and afterwards moves
+* any that have expired to set->expired[], to be reported after the
+* events from the implementation.
+*
+***********************************************************************/
+
+static double pollset_now(void)
+{
+  struct timespec now;
+  
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1000000000.0;
+}
+
+/**********************************************************************/
+
+static void pstimer_set(pollset__t *set,size_t idx,pstimer__t *timer)
+{
+  set->heap[idx] = timer;
+  timer->heap    = idx;
+}
+
+/**********************************************************************/
+
+static void pstimer_up(pollset__t *set,size_t idx)
+{
+  pstimer__t *timer = set->heap[idx];
+  
+  while(idx > 0)
+  {
+    size_t parent = (idx - 1) / 4;
+    if (set->heap[parent]->when <= timer->when)
+      break;
+    pstimer_set(set,idx,set->heap[parent]);
+    idx = parent;
+  }
+  
+  pstimer_set(set,idx,timer);
+}
+
+/**********************************************************************/
+
+static void pstimer_down(pollset__t *set,size_t idx)
+{
+  pstimer__t *timer = set->heap[idx];
+  
+  while(true)
+  {
+    size_t first = idx * 4 + 1;
+    size_t child = first;
+    
+    if (first >= set->nheap)
+      break;
+    for (size_t i = first + 1 ; (i < first + 4) && (i < set->nheap) ; i++)
+      if (set->heap[i]->when < set->heap[child]->when)
+        child = i;
+    if (timer->when <= set->heap[child]->when)
+      break;
+    pstimer_set(set,idx,set->heap[child]);
+    idx = child;
+  }
+  
+  pstimer_set(set,idx,timer);
+}
+
+/**********************************************************************/
+
+static int pstimer_insert(pollset__t *set,pstimer__t *timer)
+{
+  if (set->nheap == set->maxheap)
+  {
+    pstimer__t **heap;
+    size_t       maxheap = set->maxheap > 0 ? set->maxheap * 2 : 16;
+    
+    heap = realloc(set->heap,maxheap * sizeof(pstimer__t *));
+    if (heap == NULL)
+      return ENOMEM;
+    set->heap    = heap;
+    set->maxheap = maxheap;
+  }
+  
+  set->heap[set->nheap] = timer;
+  pstimer_up(set,set->nheap++);
+  return 0;
+}
+
+/**********************************************************************/
+
+static void pstimer_delete(pollset__t *set,pstimer__t *timer)
+{
+  size_t idx = timer->heap;
+  
+  if (idx >= set->nheap)
+    return;
+    
+  timer->heap = SIZE_MAX;
+  if (idx < --set->nheap)
+  {
+    pstimer__t *last = set->heap[set->nheap];
+    
+    pstimer_set(set,idx,last);
+    pstimer_down(set,idx);
+    pstimer_up(set,last->heap);
+  }
+}
+
+/**********************************************************************/
+
+static lua_Number pstimer_timeout(pollset__t *set,lua_Number timeout)
+{
+  if (set->iexpired < set->nexpired)
+    return 0;
+    
+  if (set->nheap > 0)
+  {
+    double left = set->heap[0]->when - pollset_now();
+    
+    /*---------------------------------------------------------------------
+    ; Some implementations only wait in milliseconds, so round up to avoid
+    ; waking up just before the timer expires.
+    ;----------------------------------------------------------------------*/
+    
+    if (left < 0)
+      left = 0;
+    else
+      left = (double)((long)(left * 1000.0) + 1) / 1000.0;
+      
+    if ((timeout < 0) || (left < timeout))
+      timeout = left;
+  }
+  
+  return timeout;
+}
+
+/**********************************************************************/
+
+static int pstimer_expire(pollset__t *set)
+{
+  double now;
+  
+  if (set->iexpired > 0)
+  {
+    memmove(
+             &set->expired[0],
+             &set->expired[set->iexpired],
+             (set->nexpired - set->iexpired) * sizeof(pstimer__t *)
+           );
+    set->nexpired -= set->iexpired;
+    set->iexpired  = 0;
+  }
+  
+  if (set->nheap == 0)
+    return (int)set->nexpired;
+    
+  now = pollset_now();
+  
+  while((set->nheap > 0) && (set->heap[0]->when <= now))
+  {
+    pstimer__t *timer = set->heap[0];
+    
+    if (set->nexpired == set->maxexpired)
+    {
+      pstimer__t **expired;
+      size_t       maxexpired = set->maxexpired > 0 ? set->maxexpired * 2 : 16;
+      
+      expired = realloc(set->expired,maxexpired * sizeof(pstimer__t *));
+      if (expired == NULL)
+        break;
+      set->expired    = expired;
+      set->maxexpired = maxexpired;
+    }
+    
+    pstimer_delete(set,timer);
+    
+    if (timer->interval > 0)
+    {
+      timer->count = 1 + (lua_Integer)((now - timer->when) / timer->interval);
+      timer->when += (double)timer->count * timer->interval;
+      pstimer_insert(set,timer);
+    }
+    else
+      timer->count = 1;
+      
+    set->expired[set->nexpired++] = timer;
+  }
+  
+  return (int)set->nexpired;
+}
+
+/**********************************************************************
+*
+* Signals.  Where there's no signalfd(), the handler writes the siginfo_t
+* to a pipe, which is watched by the set.  Since the handler needs to know
+* which pipe to use, each signal can only be used by one set at a time.
+*
+***********************************************************************/
+
+static volatile sig_atomic_t m_sigpipe[NSIG];
+static struct sigaction      m_sigold [NSIG];
+
+/*-------------------------------------------------
+; NOTE: the following list must be kept sorted.
+;--------------------------------------------------*/
+
+static struct
+{
+  char const *const text;
+  int  const        value;
+} const m_signals[] =
+{
+  { "abrt"              , SIGABRT       } ,
+  { "alrm"              , SIGALRM       } ,
+  { "child"             , SIGCHLD       } ,
+  { "cont"              , SIGCONT       } ,
+  { "hup"               , SIGHUP        } ,
+#ifdef SIGINFO
+  { "info"              , SIGINFO       } ,
+#endif
+  { "int"               , SIGINT        } ,
+#ifdef SIGIO
+  { "io"                , SIGIO         } ,
+#endif
+  { "pipe"              , SIGPIPE       } ,
+  { "prof"              , SIGPROF       } ,
+#ifdef SIGPWR
+  { "pwr"               , SIGPWR        } ,
+#endif
+  { "quit"              , SIGQUIT       } ,
+  { "sys"               , SIGSYS        } ,
+  { "term"              , SIGTERM       } ,
+  { "trap"              , SIGTRAP       } ,
+  { "tstp"              , SIGTSTP       } ,
+  { "ttin"              , SIGTTIN       } ,
+  { "ttou"              , SIGTTOU       } ,
+  { "urg"               , SIGURG        } ,
+  { "usr1"              , SIGUSR1       } ,
+  { "usr2"              , SIGUSR2       } ,
+  { "vtalrm"            , SIGVTALRM     } ,
+#ifdef SIGWINCH
+  { "winch"             , SIGWINCH      } ,
+#endif
+  { "xcpu"              , SIGXCPU       } ,
+  { "xfsz"              , SIGXFSZ       } ,
+};
+
+#define MAX_SIGNALS     (sizeof(m_signals) / sizeof(m_signals[0]))
+
+/**********************************************************************/
+
+static int pollset_sigcmp(void const *needle,void const *haystack)
+{
+  return strcmp(needle,*(char const *const *)haystack);
+}
+
+/**********************************************************************/
+
+static int pollset_tosignal(lua_State *L,int idx)
+{
+  if (lua_type(L,idx) == LUA_TNUMBER)
+  {
+    lua_Integer sig = lua_tointeger(L,idx);
+    if ((sig < 1) || (sig >= NSIG) || (sig == SIGKILL) || (sig == SIGSTOP))
+      return luaL_error(L,"signal %d not supported",(int)sig);
+    return (int)sig;
+  }
+  else
+  {
+    char const *name = luaL_checkstring(L,idx);
+    void const *entry;
+    
+    entry = bsearch(name,m_signals,MAX_SIGNALS,sizeof(m_signals[0]),pollset_sigcmp);
+    if (entry == NULL)
+      return luaL_error(L,"signal '%s' not supported",name);
+    return m_signals[((char const *)entry - (char const *)m_signals) / sizeof(m_signals[0])].value;
+  }
+}
+
+/**********************************************************************/
+
+static void pollset_pushsiginfo(lua_State *L,pssiginfo__t const *info)
+{
+  lua_createtable(L,0,6);
+  
+  lua_pushinteger(L,info->signo);
+  for (size_t i = 0 ; i < MAX_SIGNALS ; i++)
+  {
+    if (m_signals[i].value == info->signo)
+    {
+      lua_pop(L,1);
+      lua_pushstring(L,m_signals[i].text);
+      break;
+    }
+  }
+  lua_setfield(L,-2,"signal");
+  
+  lua_pushinteger(L,info->code);
+  lua_setfield(L,-2,"code");
+  lua_pushinteger(L,info->err);
+  lua_setfield(L,-2,"errno");
+  lua_pushinteger(L,info->pid);
+  lua_setfield(L,-2,"pid");
+  lua_pushinteger(L,info->uid);
+  lua_setfield(L,-2,"uid");
+  lua_pushinteger(L,info->status);
+  lua_setfield(L,-2,"status");
+}
+
+/**********************************************************************/
+
+static void pollset_sighandler(int sig,siginfo_t *info,void *context)
+{
+  int saved = errno;
+  
+  (void)context;
+  if ((sig > 0) && (sig < NSIG) && (m_sigpipe[sig] > 0))
+  {
+    ssize_t rc = write(m_sigpipe[sig] - 1,info,sizeof(siginfo_t));
+    (void)rc;
+  }
+  errno = saved;
+}
+
+/**********************************************************************/
+
+static void pollset_signal_release(pssignal__t *handle)
+{
+  if (handle->fh == -1)
+    return;
+    
+  if (handle->wfh == -1)
+    sigprocmask(SIG_UNBLOCK,&handle->blocked,NULL);
+  else
+  {
+    for (int sig = 1 ; sig < NSIG ; sig++)
+    {
+      if (sigismember(&handle->mask,sig) == 1)
+      {
+        sigaction(sig,&m_sigold[sig],NULL);
+        m_sigpipe[sig] = 0;
+      }
+    }
+    close(handle->wfh);
+  }
+  
+  close(handle->fh);
+  handle->fh  = -1;
+  handle->wfh = -1;
+}
+
+/**********************************************************************/
+
+static int pollset_sigpipe(pssignal__t *handle)
+{
+  struct sigaction act;
+  int              pipes[2];
+  
+  for (int sig = 1 ; sig < NSIG ; sig++)
+    if ((sigismember(&handle->mask,sig) == 1) && (m_sigpipe[sig] > 0))
+      return EBUSY;
+      
+  if (pipe(pipes) == -1)
+    return errno;
+    
+  for (int i = 0 ; i < 2 ; i++)
+  {
+    fcntl(pipes[i],F_SETFL,fcntl(pipes[i],F_GETFL) | O_NONBLOCK);
+    fcntl(pipes[i],F_SETFD,FD_CLOEXEC);
+  }
+  
+  handle->fh  = pipes[0];
+  handle->wfh = pipes[1];
+  
+  memset(&act,0,sizeof(act));
+  sigfillset(&act.sa_mask);
+  act.sa_sigaction = pollset_sighandler;
+  act.sa_flags     = SA_SIGINFO | SA_RESTART;
+  
+  for (int sig = 1 ; sig < NSIG ; sig++)
+  {
+    if (sigismember(&handle->mask,sig) == 1)
+    {
+      m_sigpipe[sig] = handle->wfh + 1;
+      sigaction(sig,&act,&m_sigold[sig]);
+    }
+  }
+  
+  return 0;
+}
+
+/**********************************************************************/
+
+static int polllua_insert_signal(lua_State *L)
+{
+  pollset__t  *set = pollset_check(L,1);
+  pssignal__t *handle;
+  sigset_t     mask;
+  int          kind;
+  int          rc;
+  
+  lua_settop(L,3);
+  sigemptyset(&mask);
+  
+  if (lua_istable(L,2))
+  {
+    for (int i = 1 ; ; i++)
+    {
+      lua_rawgeti(L,2,i);
+      if (lua_isnil(L,-1))
+        break;
+      sigaddset(&mask,pollset_tosignal(L,-1));
+      lua_pop(L,1);
+    }
+    lua_pop(L,1);
+  }
+  else
+    sigaddset(&mask,pollset_tosignal(L,2));
+    
+  handle          = lua_newuserdata(L,sizeof(pssignal__t));
+  handle->fh      = -1;
+  handle->wfh     = -1;
+  handle->mask    = mask;
+  sigemptyset(&handle->blocked);
+  luaL_getmetatable(L,TYPE_SIGNAL);
+  lua_setmetatable(L,-2);
+  
+#ifdef __linux
+  {
+    sigset_t old;
+    
+    /*---------------------------------------------------------------------
+    ; Signals must be blocked to be read from a signalfd.  Only unblock
+    ; those we blocked when we're done.
+    ;----------------------------------------------------------------------*/
+    
+    sigprocmask(SIG_BLOCK,&mask,&old);
+    for (int sig = 1 ; sig < NSIG ; sig++)
+      if ((sigismember(&mask,sig) == 1) && (sigismember(&old,sig) == 0))
+        sigaddset(&handle->blocked,sig);
+        
+    handle->fh = signalfd(-1,&mask,SFD_NONBLOCK | SFD_CLOEXEC);
+    if (handle->fh == -1)
+      sigprocmask(SIG_UNBLOCK,&handle->blocked,NULL);
+  }
+#endif
+
+  if (handle->fh != -1)
+    kind = PSFD_SIGNALFD;
+  else
+  {
+    kind = PSFD_SIGPIPE;
+    rc   = pollset_sigpipe(handle);
+    if (rc != 0)
+    {
+      lua_pushnil(L);
+      lua_pushinteger(L,rc);
+      return 2;
+    }
+  }
+  
+  rc = pollset_setkind(set,handle->fh,kind);
+  if (rc == 0)
+  {
+    rc = (*set->ops->insert)(set,handle->fh,PS_READ);
+    if (rc != 0)
+      pollset_setkind(set,handle->fh,PSFD_FILE);
+  }
+  
+  if (rc != 0)
+  {
+    pollset_signal_release(handle);
+    lua_pushnil(L);
+    lua_pushinteger(L,rc);
+    return 2;
+  }
+  
+  set->idx++;
+  
+  lua_getuservalue(L,1);
+  lua_pushinteger(L,handle->fh);
+  if (lua_isnil(L,3))
+    lua_pushvalue(L,4);
+  else
+    lua_pushvalue(L,3);
+  lua_settable(L,-3);
+  lua_pushvalue(L,4);
+  lua_pushboolean(L,true);
+  lua_settable(L,-3);
+  lua_pop(L,1);
+  
+  lua_pushinteger(L,0);
+  return 2;
+}
+
+/**********************************************************************/
+
+static int pollset_signal_remove(lua_State *L,pollset__t *set,pssignal__t *handle)
+{
+  lua_getuservalue(L,1);
+  lua_pushvalue(L,2);
+  lua_rawget(L,-2);
+  
+  if (lua_isnil(L,-1) || (handle->fh == -1))
+  {
+    lua_pushinteger(L,EINVAL);
+    return 1;
+  }
+  
+  lua_pop(L,1);
+  
+  (*set->ops->remove)(set,handle->fh);
+  pollset_setkind(set,handle->fh,PSFD_FILE);
+  
+  lua_pushinteger(L,handle->fh);
+  lua_pushnil(L);
+  lua_settable(L,-3);
+  lua_pushvalue(L,2);
+  lua_pushnil(L);
+  lua_settable(L,-3);
+  
+  pollset_signal_release(handle);
+  set->idx--;
+  lua_pushinteger(L,0);
+  return 1;
+}
+
+/**********************************************************************/
+
+static int signallua___tostring(lua_State *L)
+{
+  lua_pushfstring(L,"signal (%p)",lua_touserdata(L,1));
+  return 1;
+}
+
+/**********************************************************************/
+
+static int signallua___gc(lua_State *L)
+{
+  pollset_signal_release(luaL_checkudata(L,1,TYPE_SIGNAL));
+  return 0;
+}
+
+/**********************************************************************
+*
+* Return the next event, handling any file descriptors the set created,
+* followed by any expired timers.
+*
+***********************************************************************/
+
+static bool pollset_nextevent(pollset__t *set,int *pfh,unsigned int *pevents)
+{
+  while((*set->ops->next)(set,pfh,pevents))
+  {
+    if ((*pevents & PS_COMPLETION) != 0)
+      return true;
+      
+    switch(pollset_getkind(set,*pfh))
+    {
+      case PSFD_TIMER:
+           {
+             uint64_t count;
+             
+             if (read(*pfh,&count,sizeof(count)) != (ssize_t)sizeof(count))
+               continue;
+             set->result = (lua_Integer)count;
+             *pevents    = PS_TIMER;
+           }
+           break;
+           
+#ifdef __linux
+      case PSFD_SIGNALFD:
+           {
+             struct signalfd_siginfo info;
+             
+             if (read(*pfh,&info,sizeof(info)) != (ssize_t)sizeof(info))
+               continue;
+             set->siginfo.signo  = (int)info.ssi_signo;
+             set->siginfo.code   = info.ssi_code;
+             set->siginfo.err    = info.ssi_errno;
+             set->siginfo.pid    = (long)info.ssi_pid;
+             set->siginfo.uid    = (long)info.ssi_uid;
+             set->siginfo.status = info.ssi_status;
+             *pevents            = PS_SIGNAL;
+           }
+           break;
+#endif
+
+      case PSFD_SIGPIPE:
+           {
+             siginfo_t info;
+             
+             if (read(*pfh,&info,sizeof(info)) != (ssize_t)sizeof(info))
+               continue;
+             set->siginfo.signo  = info.si_signo;
+             set->siginfo.code   = info.si_code;
+             set->siginfo.err    = info.si_errno;
+             set->siginfo.pid    = (long)info.si_pid;
+             set->siginfo.uid    = (long)info.si_uid;
+             set->siginfo.status = info.si_status;
+             *pevents            = PS_SIGNAL;
+           }
+           break;
+           
+      default:
+           break;
+    }
+    
+    return true;
+  }
+  
+  while(set->iexpired < set->nexpired)
+  {
+    pstimer__t *timer = set->expired[set->iexpired++];
+    
+    if (timer != NULL)
+    {
+      set->result = timer->count;
+      *pfh        = timer->id;
+      *pevents    = PS_TIMER;
+      return true;
+    }
+  }
+  
+  return false;
+}
+
+/**********************************************************************
+*
+* Event reporting, common to all implementations.  Each implementation
+* supplies next() to return the next file and its events (as PS_* flags),
+* and the events it can report.
+*
+***********************************************************************/
+
+static struct
+{
+  unsigned int      event;
+  char              flag;
+  char const *const name;
+} const m_events[] =
+{
+  { PS_READ     , 'r' , "read"     } ,
+  { PS_WRITE    , 'w' , "write"    } ,
+  { PS_PRIORITY , 'p' , "priority" } ,
+  { PS_ERROR    , 'e' , "error"    } ,
+  { PS_HANGUP   , 'h' , "hangup"   } ,
+  { PS_INVALID  , 'i' , "invalid"  } ,
+  { PS_RDHANGUP , 'd' , "rdhangup" } ,
+  { PS_RECV     , 'R' , "recv"     } ,
+  { PS_SEND     , 'S' , "send"     } ,
+  { PS_ACCEPT   , 'A' , "accept"   } ,
+  { PS_TIMER    , 'T' , "timer"    } ,
+  { PS_SIGNAL   , 'G' , "signal"   } ,
+};
+
+#define MAX_EVENTS      (sizeof(m_events) / sizeof(m_events[0]))
+
+/**********************************************************************/
+
+static void pollset_pushevents(lua_State *L,pollset__t *set,unsigned int events)
+{
+  for (size_t i = 0 ; i < MAX_EVENTS ; i++)
+  {
+    if (((set->ops->events | PS_TIMER | PS_SIGNAL) & m_events[i].event) != 0)
+    {
+      lua_pushboolean(L,(events & m_events[i].event) != 0);
+      lua_setfield(L,-2,m_events[i].name);
+    }
+  }
+}
+
+/**********************************************************************/
+
+static void pollset_pushresult(lua_State *L,pollset__t *set,unsigned int events)
+{
+  if ((events & PS_TIMER) != 0)
+    lua_pushinteger(L,set->result);
+  else if ((events & PS_SIGNAL) != 0)
+    pollset_pushsiginfo(L,&set->siginfo);
+  else if (((events & PS_COMPLETION) != 0) && (set->ops->result != NULL))
+    (*set->ops->result)(set,L);
+  else
+    lua_pushnil(L);
+}
+
+/**********************************************************************/
+
+static void pollset_pushobj(lua_State *L,int fh)
 {
-  struct pollfd *set;
-  size_t         idx;
-  size_t         max;
-  size_t         count;
-} pollset__t;
+  lua_getuservalue(L,1);
+  lua_pushinteger(L,fh);
+  lua_gettable(L,-2);
+  lua_replace(L,-2);
+}
 
-/**********************************************************************/
+/**********************************************************************
+*
+* The object is used as the control variable in set:ievents(), so a nil
+* would end the loop early.  A nil object means the file was removed from
+* the set after the wait, so skip such events.  set:events() skips them as
+* well, so both report the same events.
+*
+***********************************************************************/
 
-static int pollset_toevents(lua_State *L,int idx)
+static bool pollset_nextobj(lua_State *L,pollset__t *set,unsigned int *pevents)
 {
-  int events = 0;
+  int fh;
   
-  for (char const *flags = luaL_checkstring(L,idx) ; *flags ; flags++)
+  while(pollset_nextevent(set,&fh,pevents))
   {
-    switch(*flags)
-    {
-      case 'r': events |= POLLIN;   break;
-      case 'w': events |= POLLOUT;  break;
-      case 'p': events |= POLLPRI;  break;
-      default:  break;
-    }
+    pollset_pushobj(L,fh);
+    if (!lua_isnil(L,-1))
+      return true;
+    lua_pop(L,1);
   }
   
-  return events;
+  return false;
 }
 
 /**********************************************************************/
 
-static void pollset_pushevents(lua_State *L,int events)
+static int pollset_next(lua_State *L)
 {
-  lua_createtable(L,0,7);
-  lua_pushboolean(L,(events & POLLIN)   != 0);
-  lua_setfield(L,-2,"read");
-  lua_pushboolean(L,(events & POLLOUT)  != 0);
-  lua_setfield(L,-2,"write");
-  lua_pushboolean(L,(events & POLLPRI)  != 0);
-  lua_setfield(L,-2,"priority");
-  lua_pushboolean(L,(events & POLLERR)  != 0);
-  lua_setfield(L,-2,"error");
-  lua_pushboolean(L,(events & POLLHUP)  != 0);
-  lua_setfield(L,-2,"hangup");
-  lua_pushboolean(L,(events & POLLNVAL) != 0);
-  lua_setfield(L,-2,"invalid");
+  pollset__t   *set = pollset_check(L,1);
+  unsigned int  events;
+  
+  if (pollset_nextobj(L,set,&events))
+  {
+    lua_createtable(L,0,MAX_EVENTS + 2);
+    pollset_pushevents(L,set,events);
+    lua_pushvalue(L,-2);
+    lua_setfield(L,-2,"obj");
+    if ((events & PS_RESULT) != 0)
+    {
+      pollset_pushresult(L,set,events);
+      lua_setfield(L,-2,"result");
+    }
+  }
+  else
+    lua_pushnil(L);
+    
+  return 1;
 }
 
 /**********************************************************************/
 
-static int pollset_next(lua_State *L)
+static int pollset_inext(lua_State *L)
 {
-  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
+  pollset__t   *set = pollset_check(L,1);
+  unsigned int  events;
   
-  while(set->count < set->idx)
+  if (pollset_nextobj(L,set,&events))
   {
-    if (set->set[set->count].revents != 0)
+    lua_pushinteger(L,events);
+    if ((events & PS_RESULT) != 0)
     {
-      lua_getuservalue(L,1);
-      pollset_pushevents(L,set->set[set->count].revents);
-      lua_pushinteger(L,set->set[set->count].fd);
-      lua_gettable(L,-3);
-      lua_setfield(L,-2,"obj");
-      set->count++;
-      return 1;
+      pollset_pushresult(L,set,events);
+      return 3;
     }
-    set->count++;
+    return 2;
   }
   
   lua_pushnil(L);
@@ -882,343 +3372,519 @@ static int pollset_next(lua_State *L)
 
 /**********************************************************************/
 
-static int pollset_lua(lua_State *L)
+static int pollset_snext(lua_State *L)
 {
-  pollset__t *set;
+  pollset__t   *set = pollset_check(L,1);
+  unsigned int  events;
   
-  set = lua_newuserdata(L,sizeof(pollset__t));
-  set->set = NULL;
-  set->idx = 0;
-  set->max = 0;
+  if (pollset_nextobj(L,set,&events))
+  {
+    char   flags[MAX_EVENTS];
+    size_t len = 0;
+    
+    for (size_t i = 0 ; i < MAX_EVENTS ; i++)
+      if ((events & m_events[i].event) != 0)
+        flags[len++] = m_events[i].flag;
+        
+    lua_pushlstring(L,flags,len);
+    if ((events & PS_RESULT) != 0)
+    {
+      pollset_pushresult(L,set,events);
+      return 3;
+    }
+    return 2;
+  }
   
-  lua_createtable(L,0,0);
-  lua_setuservalue(L,1);
-  luaL_getmetatable(L,TYPE_POLL);
-  lua_setmetatable(L,-2);
+  lua_pushnil(L);
   return 1;
 }
 
 /**********************************************************************/
 
-static int polllua___len(lua_State *L)
+static int pollset_tnext(lua_State *L)
 {
-  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
-  lua_pushinteger(L,set->idx);
+  pollset__t   *set = pollset_check(L,1);
+  unsigned int  events;
+  
+  if (pollset_nextobj(L,set,&events))
+  {
+    lua_pushvalue(L,lua_upvalueindex(1));
+    pollset_pushevents(L,set,events);
+    lua_pushvalue(L,-2);
+    lua_setfield(L,-2,"obj");
+    pollset_pushresult(L,set,events);
+    if ((events & PS_RESULT) != 0)
+    {
+      lua_pushvalue(L,-1);
+      lua_setfield(L,-3,"result");
+      return 3;
+    }
+    lua_setfield(L,-2,"result");
+    return 2;
+  }
+  
+  lua_pushnil(L);
   return 1;
 }
 
 /**********************************************************************/
 
-static int polllua___tostring(lua_State *L)
+static int polllua_events(lua_State *L)
 {
-  lua_pushfstring(L,"pollset (%p)",lua_touserdata(L,1));
-  return 1;
+  pollset_check(L,1);
+  lua_pushcfunction(L,pollset_next);
+  lua_pushvalue(L,1);
+  lua_pushnil(L);
+  return 3;
 }
 
 /**********************************************************************/
 
-static int polllua___gc(lua_State *L)
+static int polllua_ievents(lua_State *L)
 {
-  void       *ud;
-  pollset__t *set    = luaL_checkudata(L,1,TYPE_POLL);
-  lua_Alloc   allocf = lua_getallocf(L,&ud);
-  (*allocf)(ud,set->set,set->max * sizeof(struct pollfd),0);
-  set->set = NULL;
-  set->max = 0;
-  return 0;
+  pollset_check(L,1);
+  
+  if (lua_istable(L,2))
+  {
+    lua_pushvalue(L,2);
+    lua_pushcclosure(L,pollset_tnext,1);
+  }
+  else
+  {
+    static char const *const m_fmt[] = { "integer" , "string" , NULL };
+    
+    if (luaL_checkoption(L,2,"integer",m_fmt) == 0)
+      lua_pushcfunction(L,pollset_inext);
+    else
+      lua_pushcfunction(L,pollset_snext);
+  }
+  
+  lua_pushvalue(L,1);
+  lua_pushnil(L);
+  return 3;
 }
 
-/**********************************************************************/
+/**********************************************************************
+*
+* Read the timerfd option from the options table (true if not given).
+*
+*************************************************************************/
 
-static int polllua_insert(lua_State *L)
+static bool pollset_timerfd(lua_State *L,int idx)
 {
-  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
-  int         fh;
-  
-  lua_settop(L,4);
+  bool timerfd = true;
   
-  if (!luaL_callmeta(L,2,"_tofd"))
+  if (lua_istable(L,idx))
   {
-    lua_pushinteger(L,EINVAL);
-    return 1;
+    lua_getfield(L,idx,"timerfd");
+    if (!lua_isnil(L,-1))
+      timerfd = lua_toboolean(L,-1);
+    lua_pop(L,1);
   }
   
-  fh = luaL_checkinteger(L,-1);
+  return timerfd;
+}
+
+/**********************************************************************/
+
+static double pollset_spinmax(lua_State *L,int idx)
+{
+  lua_Number spin = 0.0;
   
-  if (set->idx == set->max)
+  if (lua_istable(L,idx))
   {
-    struct pollfd *new;
-    size_t         newmax;
-    lua_Alloc      allocf;
-    void          *ud;
-    struct rlimit  limit;
-    
-    if (getrlimit(RLIMIT_NOFILE,&limit) < 0)
-    {
-      lua_pushinteger(L,errno);
-      return 1;
-    }
-    
-    if (set->max == limit.rlim_cur)
-    {
-      lua_pushinteger(L,ENOMEM);
-      return 1;
-    }
-    
-    allocf = lua_getallocf(L,&ud);
-    newmax = set->max + 10;
-    
-    if (newmax > limit.rlim_cur)
-      newmax = limit.rlim_cur;
-      
-    new = (*allocf)(
-                ud,
-                set->set,
-                set->max * sizeof(struct pollfd),
-                newmax   * sizeof(struct pollfd)
-        );
-        
-    if (new == NULL)
-    {
-      lua_pushinteger(L,ENOMEM);
-      return 1;
-    }
-    
-    set->set = new;
-    set->max = newmax;
+    lua_getfield(L,idx,"spin");
+    spin = luaL_optnumber(L,-1,0.0);
+    lua_pop(L,1);
+    if (spin < 0.0)
+      spin = 0.0;
   }
   
-  set->set[set->idx].events = pollset_toevents(L,3);
-  set->set[set->idx].fd     = fh;
-  
-  lua_getuservalue(L,1);
-  lua_pushinteger(L,fh);
-  
-  if (lua_isnil(L,4))
-    lua_pushinteger(L,fh);
-  else
-    lua_pushvalue(L,4);
-    
-  lua_settable(L,-3);
-  
-  set->idx++;
-  lua_pushinteger(L,0);
-  return 1;
+  return spin / 1000000.0;
 }
 
-/**********************************************************************/
+/**********************************************************************
+*
+* Return the maximum number of events to return from a single wait, as
+* given by the optional options table passed to org.conman.pollset().
+*
+*************************************************************************/
 
-static int polllua_update(lua_State *L)
+static int pollset_maxevents(lua_State *L,int idx)
 {
-  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
-  int         fh;
-  
-  lua_settop(L,3);
+  lua_Integer maxevents = MAXEVENTS;
   
-  if (!luaL_callmeta(L,2,"_tofd"))
+  if (lua_istable(L,idx))
   {
-    lua_pushinteger(L,EINVAL);
-    return 1;
+    lua_getfield(L,idx,"maxevents");
+    maxevents = luaL_optinteger(L,-1,MAXEVENTS);
+    lua_pop(L,1);
+    if (maxevents < 1)
+      maxevents = 1;
+    else if (maxevents > INT_MAX)
+      maxevents = INT_MAX;
   }
   
-  fh = luaL_checkinteger(L,-1);
+  return (int)maxevents;
+}
+
+/**********************************************************************/
+
+static unsigned int pollset_toflags(lua_State *L,int idx)
+{
+  unsigned int flags = 0;
   
-  for (size_t i = 0 ; i < set->idx ; i++)
+  for (char const *s = luaL_checkstring(L,idx) ; *s ; s++)
   {
-    if (set->set[i].fd == fh)
+    switch(*s)
     {
-      set->set[i].events = pollset_toevents(L,3);
-      lua_pushinteger(L,0);
-      return 1;
+      case 'r': flags |= PS_READ;      break;
+      case 'w': flags |= PS_WRITE;     break;
+      case 'p': flags |= PS_PRIORITY;  break;
+      case 'd': flags |= PS_RDHANGUP;  break;
+      case 'e': flags |= PS_EDGE;      break;
+      case 'o': flags |= PS_ONESHOT;   break;
+      case 'x': flags |= PS_EXCLUSIVE; break;
+      default:  break;
     }
   }
   
-  lua_pushinteger(L,EINVAL);
-  return 1;
+  return flags;
 }
 
 /**********************************************************************/
 
-static int polllua_remove(lua_State *L)
+static int pollset_flags(lua_State *L,pollset__t *set,int idx,unsigned int *pflags)
 {
-  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
-  int         fh;
+  *pflags = pollset_toflags(L,idx);
+  if (((*pflags & PS_EDGE) != 0) && ((set->ops->flags & PS_EDGE) == 0))
+    return ENOTSUP;
+  return 0;
+}
+
+/**********************************************************************/
+
+static int pollset_lua(lua_State *L)
+{
+  pollops__t const *ops    = m_ops[0];
+  int               optidx = 1;
+  pollset__t       *set;
+  int               maxevents;
+  double            spinmax;
+  bool              timerfd;
+  int               rc;
   
-  if (!luaL_callmeta(L,2,"_tofd"))
+  if (lua_type(L,1) == LUA_TSTRING)
   {
-    lua_pushinteger(L,EINVAL);
-    return 1;
+    char const *name = lua_tostring(L,1);
+    
+    for (ops = NULL , rc = 0 ; m_ops[rc] != NULL ; rc++)
+    {
+      if (strcmp(name,m_ops[rc]->name) == 0)
+      {
+        ops = m_ops[rc];
+        break;
+      }
+    }
+    
+    if (ops == NULL)
+    {
+      lua_pushnil(L);
+      lua_pushinteger(L,ENOTSUP);
+      return 2;
+    }
+    
+    optidx = 2;
   }
   
-  fh = luaL_checkinteger(L,-1);
+  maxevents = pollset_maxevents(L,optidx);
+  spinmax   = pollset_spinmax(L,optidx);
+  timerfd   = pollset_timerfd(L,optidx);
+  
+  /*----------------------------------------------------------------------
+  ; If the implementation can't be created (say, io_uring is disabled by
+  ; the kernel), try its fallback, if any.
+  ;-----------------------------------------------------------------------*/
   
-  for (size_t i = 0 ; i < set->idx ; i++)
+  while(true)
   {
-    if (set->set[i].fd == fh)
+    set             = lua_newuserdata(L,ops->size);
+    set->ops        = ops;
+    set->idx        = 0;
+    set->maxevents  = maxevents;
+    set->allocf     = lua_getallocf(L,&set->ud);
+    set->fdkind     = NULL;
+    set->nfdkind    = 0;
+    set->heap       = NULL;
+    set->nheap      = 0;
+    set->maxheap    = 0;
+    set->expired    = NULL;
+    set->nexpired   = 0;
+    set->iexpired   = 0;
+    set->maxexpired = 0;
+    set->nemulated  = 0;
+    set->timerid    = 0;
+    set->result     = 0;
+    set->spinmax    = spinmax;
+    set->spin       = spinmax;
+    set->timerfd    = timerfd;
+    set->closed     = false;
+    set->pid        = getpid();
+    memset(&set->stats,0,sizeof(set->stats));
+    
+    rc = (*ops->init)(set);
+    if (rc == 0)
+      break;
+      
+    lua_pop(L,1);
+    
+    if (ops->fallback == NULL)
     {
-      lua_getuservalue(L,1);
-      lua_pushinteger(L,fh);
       lua_pushnil(L);
-      lua_settable(L,-3);
-      
-      memmove(
-               &set->set[i],
-               &set->set[i+1],
-               (set->idx - i - 1) * sizeof(struct pollfd)
-            );
-            
-      set->idx--;
-      lua_pushinteger(L,0);
-      return 1;
+      lua_pushinteger(L,rc);
+      return 2;
     }
+    
+    ops = ops->fallback;
   }
   
-  lua_pushinteger(L,EINVAL);
-  return 1;
+  lua_createtable(L,0,0);
+  lua_setuservalue(L,-2);
+  luaL_getmetatable(L,TYPE_POLL);
+  lua_setmetatable(L,-2);
+  lua_pushinteger(L,0);
+  return 2;
 }
 
 /**********************************************************************/
 
-static int polllua_wait(lua_State *L)
+static bool pollset_isa(lua_State *L,int idx,char const *type)
 {
-  pollset__t *set      = luaL_checkudata(L,1,TYPE_POLL);
-  lua_Number  dtimeout = luaL_optnumber(L,2,-1.0);
-  int         timeout;
-  int         events;
+  bool isa = false;
   
-  if (dtimeout < 0)
-    timeout = -1;
-  else
-    timeout = (int)(dtimeout * 1000.0);
-    
-  set->count = 0;
-  events     = poll(set->set,set->idx,timeout);
-  if (events == -1)
-  {
-    lua_pushboolean(L,false);
-    lua_pushinteger(L,errno);
-  }
-  else
+  if (lua_getmetatable(L,idx))
   {
-    lua_pushboolean(L,true);
-    lua_pushboolean(L,events == 0);
+    luaL_getmetatable(L,type);
+    isa = lua_rawequal(L,-1,-2);
+    lua_pop(L,2);
   }
-  return 2;
+  
+  return isa;
 }
 
 /**********************************************************************/
 
-static int polllua_events(lua_State *L)
+static void pollset_totimespec(struct timespec *ts,lua_Number seconds)
 {
-  luaL_checkudata(L,1,TYPE_POLL);
-  lua_pushcfunction(L,pollset_next);
-  lua_pushvalue(L,1);
-  lua_pushnil(L);
-  return 3;
+  ts->tv_sec  = (time_t)seconds;
+  ts->tv_nsec = (long)((seconds - (lua_Number)ts->tv_sec) * 1000000000.0);
+}
+
+/**********************************************************************/
+
+static int polllua_timer(lua_State *L)
+{
+  pollset__t *set      = pollset_check(L,1);
+  lua_Number  seconds  = luaL_checknumber(L,2);
+  lua_Number  interval = luaL_optnumber(L,4,0.0);
+  int const   obj      = 3;
+  pstimer__t *timer;
+  
+  luaL_argcheck(L,seconds  >= 0,2,"negative time");
+  luaL_argcheck(L,interval >= 0,4,"negative interval");
+  lua_settop(L,4);
+  
+  timer           = lua_newuserdata(L,sizeof(pstimer__t));
+  timer->fh       = -1;
+  timer->id       = 0;
+  timer->when     = 0;
+  timer->interval = interval;
+  timer->heap     = SIZE_MAX;
+  timer->count    = 0;
+  luaL_getmetatable(L,TYPE_TIMER);
+  lua_setmetatable(L,-2);
+  
+#ifdef __linux
+  if (set->timerfd)
+    timer->fh = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer->fh != -1)
+  {
+    struct itimerspec its;
+    int               rc;
+    
+    pollset_totimespec(&its.it_value,seconds);
+    pollset_totimespec(&its.it_interval,interval);
+    
+    /*---------------------------------------------------------------------
+    ; A zero value disarms a timerfd, so make it expire right away.
+    ;----------------------------------------------------------------------*/
+    
+    if ((its.it_value.tv_sec == 0) && (its.it_value.tv_nsec == 0))
+      its.it_value.tv_nsec = 1;
+      
+    if (timerfd_settime(timer->fh,0,&its,NULL) == -1)
+      rc = errno;
+    else if ((rc = pollset_setkind(set,timer->fh,PSFD_TIMER)) == 0)
+    {
+      rc = (*set->ops->insert)(set,timer->fh,PS_READ);
+      if (rc != 0)
+        pollset_setkind(set,timer->fh,PSFD_FILE);
+    }
+    
+    if (rc != 0)
+    {
+      close(timer->fh);
+      timer->fh = -1;
+      lua_pushnil(L);
+      lua_pushinteger(L,rc);
+      return 2;
+    }
+    
+    timer->id = timer->fh;
+  }
+  else
+#endif
+  {
+    int rc;
+    
+    timer->when = pollset_now() + seconds;
+    rc          = pstimer_insert(set,timer);
+    
+    if (rc != 0)
+    {
+      lua_pushnil(L);
+      lua_pushinteger(L,rc);
+      return 2;
+    }
+    
+    if (set->timerid == INT_MIN)
+      set->timerid = 0;
+    timer->id = --set->timerid;
+    set->nemulated++;
+  }
+  
+  set->idx++;
+  
+  lua_getuservalue(L,1);
+  lua_pushinteger(L,timer->id);
+  if (lua_isnil(L,obj))
+    lua_pushvalue(L,5);
+  else
+    lua_pushvalue(L,obj);
+  lua_settable(L,-3);
+  lua_pushvalue(L,5);
+  lua_pushboolean(L,true);
+  lua_settable(L,-3);
+  lua_pop(L,1);
+  
+  lua_pushinteger(L,0);
+  return 2;
 }
 
-#endif
-
-/**********************************************************************
-*
-* And finally the version based on select(), for those really old Unix
-* systems that just can't handle poll().
-*
-***********************************************************************/
-
-#ifdef POLLSET_IMPL_SELECT
-#define POLLSET_IMPL    "select"
-
-#include <stdbool.h>
-#include <math.h>
-#include <sys/select.h>
-
-typedef struct
-{
-  fd_set read;
-  fd_set write;
-  fd_set except;
-  fd_set sread;
-  fd_set swrite;
-  fd_set sexcept;
-  int    min;
-  int    max;
-  int    count;
-  size_t idx;
-} pollset__t;
-
 /**********************************************************************/
 
-static void pollset_toevents(lua_State *L,int idx,pollset__t *set,int fd)
+static int pollset_timer_remove(lua_State *L,pollset__t *set,pstimer__t *timer)
 {
-  for (char const *flags = luaL_checkstring(L,idx) ; *flags ; flags++)
+  lua_getuservalue(L,1);
+  lua_pushvalue(L,2);
+  lua_rawget(L,-2);
+  
+  if (lua_isnil(L,-1))
   {
-    switch(*flags)
-    {
-      case 'r': FD_SET(fd,&set->read);   break;
-      case 'w': FD_SET(fd,&set->write);  break;
-      case 'p': FD_SET(fd,&set->except); break;
-      default:  break;
-    }
+    lua_pushinteger(L,EINVAL);
+    return 1;
+  }
+  
+  lua_pop(L,1);
+  
+  if (timer->fh != -1)
+  {
+    (*set->ops->remove)(set,timer->fh);
+    pollset_setkind(set,timer->fh,PSFD_FILE);
+    close(timer->fh);
+    timer->fh = -1;
+  }
+  else
+  {
+    pstimer_delete(set,timer);
+    set->nemulated--;
   }
+  
+  for (size_t i = set->iexpired ; i < set->nexpired ; i++)
+    if (set->expired[i] == timer)
+      set->expired[i] = NULL;
+      
+  lua_pushinteger(L,timer->id);
+  lua_pushnil(L);
+  lua_settable(L,-3);
+  lua_pushvalue(L,2);
+  lua_pushnil(L);
+  lua_settable(L,-3);
+  
+  set->idx--;
+  lua_pushinteger(L,0);
+  return 1;
 }
 
 /**********************************************************************/
 
-static void pollset_pushevents(lua_State *L,pollset__t *set,int fd)
+static int timerlua___tostring(lua_State *L)
 {
-  lua_createtable(L,0,4);
-  lua_pushboolean(L,FD_ISSET(fd,&set->read));
-  lua_setfield(L,-2,"read");
-  lua_pushboolean(L,FD_ISSET(fd,&set->write));
-  lua_setfield(L,-2,"write");
-  lua_pushboolean(L,FD_ISSET(fd,&set->except));
-  lua_setfield(L,-2,"priority");
+  lua_pushfstring(L,"timer (%p)",lua_touserdata(L,1));
+  return 1;
 }
 
 /**********************************************************************/
 
-static int pollset_next(lua_State *L)
+static int timerlua___gc(lua_State *L)
 {
-  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
+  pstimer__t *timer = luaL_checkudata(L,1,TYPE_TIMER);
   
-  while(set->count <= set->max)
+  if (timer->fh != -1)
   {
-    if (FD_ISSET(set->count,&set->sread) || FD_ISSET(set->count,&set->swrite) || FD_ISSET(set->count,&set->sexcept))
-    {
-      lua_getuservalue(L,1);
-      pollset_pushevents(L,set,set->count);
-      lua_pushinteger(L,set->count);
-      lua_gettable(L,-3);
-      lua_setfield(L,-2,"obj");
-      set->count++;
-      return 1;
-    }
-    set->count++;
+    close(timer->fh);
+    timer->fh = -1;
   }
-  
-  lua_pushnil(L);
-  return 1;
+  return 0;
 }
 
 /**********************************************************************/
 
-static int pollset_lua(lua_State *L)
+static int polllua___index(lua_State *L)
 {
-  pollset__t *set;
+  pollset__t *set = lua_touserdata(L,1);
   
-  set = lua_newuserdata(L,sizeof(pollset__t));
-  FD_ZERO(&set->read);
-  FD_ZERO(&set->write);
-  FD_ZERO(&set->except);
-  set->idx = 0;
-  set->min = INT_MAX;
-  set->max = 0;
+  lua_pushvalue(L,2);
+  lua_rawget(L,lua_upvalueindex(1));
+  
+  if (lua_isnil(L,-1) && (lua_type(L,2) == LUA_TSTRING))
+  {
+    char const *key = lua_tostring(L,2);
+    
+    if (strcmp(key,"_implementation") == 0)
+      lua_pushstring(L,set->ops->name);
+    else if (strcmp(key,"_iocp") == 0)
+      lua_pushboolean(L,set->ops->submit != NULL);
+    else if (strcmp(key,"_flags") == 0)
+    {
+      char   flags[8];
+      size_t n = 0;
+      
+      flags[n++] = 'r';
+      flags[n++] = 'w';
+      flags[n++] = 'p';
+      if (set->ops->events & PS_RDHANGUP)
+        flags[n++] = 'd';
+      if (set->ops->flags & PS_EDGE)
+        flags[n++] = 'e';
+      if (set->ops->flags & PS_ONESHOT)
+        flags[n++] = 'o';
+      if (set->ops->flags & PS_EXCLUSIVE)
+        flags[n++] = 'x';
+      lua_pushlstring(L,flags,n);
+    }
+  }
   
-  lua_createtable(L,0,0);
-  lua_setuservalue(L,1);
-  luaL_getmetatable(L,TYPE_POLL);
-  lua_setmetatable(L,-2);
   return 1;
 }
 
@@ -1241,9 +3907,66 @@ static int polllua___tostring(lua_State *L)
 
 /**********************************************************************/
 
+/**********************************************************************
+*
+* In a child process after fork(), release the timers and signal handles
+* in the set---nothing else in the child will.  They're keys in the
+* uservalue table.
+*
+***********************************************************************/
+
+static void pollset_forget(lua_State *L,pollset__t *set)
+{
+  lua_getuservalue(L,1);
+  lua_pushnil(L);
+  
+  while(lua_next(L,-2) != 0)
+  {
+    lua_pop(L,1);
+    if (pollset_isa(L,-1,TYPE_TIMER))
+    {
+      pstimer__t *timer = lua_touserdata(L,-1);
+      if (timer->fh != -1)
+      {
+        close(timer->fh);
+        timer->fh = -1;
+      }
+    }
+    else if (pollset_isa(L,-1,TYPE_SIGNAL))
+      pollset_signal_release(lua_touserdata(L,-1));
+  }
+  
+  lua_pop(L,1);
+  (*set->ops->forget)(set);
+}
+
+/**********************************************************************/
+
 static int polllua___gc(lua_State *L)
 {
-  (void)L;
+  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
+  
+  if (set->closed)
+    return 0;
+    
+  set->closed = true;
+  
+  if (set->pid != getpid())
+    pollset_forget(L,set);
+  else
+    (*set->ops->free)(set);
+    
+  free(set->fdkind);
+  free(set->heap);
+  free(set->expired);
+  set->fdkind   = NULL;
+  set->nfdkind  = 0;
+  set->heap     = NULL;
+  set->nheap    = 0;
+  set->maxheap  = 0;
+  set->expired  = NULL;
+  set->nexpired = 0;
+  set->iexpired = 0;
   return 0;
 }
 
@@ -1251,8 +3974,10 @@ static int polllua___gc(lua_State *L)
 
 static int polllua_insert(lua_State *L)
 {
-  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
-  int         fh;
+  pollset__t   *set = pollset_check(L,1);
+  unsigned int  flags;
+  int           fh;
+  int           rc;
   
   lua_settop(L,4);
   
@@ -1263,18 +3988,16 @@ static int polllua_insert(lua_State *L)
   }
   
   fh = luaL_checkinteger(L,-1);
+  rc = pollset_flags(L,set,3,&flags);
+  if (rc == 0)
+    rc = (*set->ops->insert)(set,fh,flags);
   
-  if (fh > FD_SETSIZE)
+  if (rc != 0)
   {
-    lua_pushinteger(L,EINVAL);
+    lua_pushinteger(L,rc);
     return 1;
   }
   
-  if (fh < set->min) set->min = fh;
-  if (fh > set->max) set->max = fh;
-  
-  pollset_toevents(L,3,set,fh);
-  
   lua_getuservalue(L,1);
   lua_pushinteger(L,fh);
   
@@ -1294,8 +4017,12 @@ static int polllua_insert(lua_State *L)
 
 static int polllua_update(lua_State *L)
 {
-  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
-  int         fh;
+  pollset__t   *set = pollset_check(L,1);
+  unsigned int  flags;
+  int           fh;
+  int           rc;
+  
+  lua_settop(L,3);
   
   if (!luaL_callmeta(L,2,"_tofd"))
   {
@@ -1304,13 +4031,10 @@ static int polllua_update(lua_State *L)
   }
   
   fh = luaL_checkinteger(L,-1);
-  
-  FD_CLR(fh,&set->read);
-  FD_CLR(fh,&set->write);
-  FD_CLR(fh,&set->except);
-  
-  pollset_toevents(L,3,set,fh);
-  lua_pushinteger(L,0);
+  rc = pollset_flags(L,set,3,&flags);
+  if (rc == 0)
+    rc = (*set->ops->update)(set,fh,flags);
+  lua_pushinteger(L,rc);
   return 1;
 }
 
@@ -1318,9 +4042,15 @@ static int polllua_update(lua_State *L)
 
 static int polllua_remove(lua_State *L)
 {
-  pollset__t *set = luaL_checkudata(L,1,TYPE_POLL);
+  pollset__t *set = pollset_check(L,1);
   int         fh;
+  int         rc;
   
+  if (pollset_isa(L,2,TYPE_TIMER))
+    return pollset_timer_remove(L,set,lua_touserdata(L,2));
+  if (pollset_isa(L,2,TYPE_SIGNAL))
+    return pollset_signal_remove(L,set,lua_touserdata(L,2));
+    
   if (!luaL_callmeta(L,2,"_tofd"))
   {
     lua_pushinteger(L,EINVAL);
@@ -1328,57 +4058,195 @@ static int polllua_remove(lua_State *L)
   }
   
   fh = luaL_checkinteger(L,-1);
+  rc = (*set->ops->remove)(set,fh);
   
-  if (FD_ISSET(fh,&set->read) || FD_ISSET(fh,&set->write) || FD_ISSET(fh,&set->except))
+  if (rc != 0)
   {
-    FD_CLR(fh,&set->read);
-    FD_CLR(fh,&set->write);
-    FD_CLR(fh,&set->except);
-    
-    lua_getuservalue(L,1);
-    lua_pushinteger(L,fh);
-    lua_pushnil(L);
-    lua_settable(L,-3);
-    
-    set->idx--;
-    lua_pushinteger(L,0);
+    lua_pushinteger(L,rc);
+    return 1;
   }
-  else
-    lua_pushinteger(L,EINVAL);
+  
+  lua_getuservalue(L,1);
+  lua_pushinteger(L,fh);
+  lua_pushnil(L);
+  lua_settable(L,-3);
+  
+  set->idx--;
+  lua_pushinteger(L,0);
+  return 1;
+}
+
+/**********************************************************************/
+
+static void pollset_stats(pollset__t *set,double start,int rc)
+{
+  size_t bucket = 0;
+  
+  set->stats.last     = pollset_now();
+  set->stats.blocked += set->stats.last - start;
+  set->stats.waits++;
+  
+  if (rc <= 0)
+  {
+    set->stats.histogram[0]++;
+    return;
+  }
+  
+  set->stats.events += rc;
+  if (rc > set->stats.peak)
+    set->stats.peak = rc;
     
+  while((rc > 0) && (bucket < PS_HISTOGRAM - 1))
+  {
+    bucket++;
+    rc >>= 1;
+  }
+  
+  set->stats.histogram[bucket]++;
+}
+
+/**********************************************************************/
+
+static int polllua_stats(lua_State *L)
+{
+  pollset__t *set = pollset_check(L,1);
+  
+  lua_createtable(L,0,8);
+  lua_pushinteger(L,set->stats.waits);
+  lua_setfield(L,-2,"waits");
+  lua_pushinteger(L,set->stats.events);
+  lua_setfield(L,-2,"events");
+  lua_pushinteger(L,set->stats.peak);
+  lua_setfield(L,-2,"peak");
+  lua_pushnumber(L,set->stats.blocked);
+  lua_setfield(L,-2,"blocked");
+  lua_pushnumber(L,set->stats.between);
+  lua_setfield(L,-2,"between");
+  lua_pushnumber(L,set->stats.spin);
+  lua_setfield(L,-2,"spin");
+  lua_pushinteger(L,set->stats.spinhits);
+  lua_setfield(L,-2,"spinhits");
+  
+  lua_createtable(L,PS_HISTOGRAM,0);
+  for (size_t i = 0 ; i < PS_HISTOGRAM ; i++)
+  {
+    lua_pushinteger(L,set->stats.histogram[i]);
+    lua_rawseti(L,-2,(int)i + 1);
+  }
+  lua_setfield(L,-2,"histogram");
+  
+  if (lua_toboolean(L,2))
+  {
+    double last = set->stats.last;
+    memset(&set->stats,0,sizeof(set->stats));
+    set->stats.last = last;
+  }
+  
   return 1;
 }
 
+/**********************************************************************
+*
+* Poll without blocking for up to set->spin seconds (but no longer than
+* the timeout).  If events show up, spin longer next time (up to the
+* maximum); if not, halve the time so an idle set mostly blocks.  Returns
+* the result of the last wait, and adjusts the timeout by the time spent.
+*
+***********************************************************************/
+
+static int pollset_spin(pollset__t *set,lua_Number *ptimeout)
+{
+  double start   = pollset_now();
+  double elapsed = 0.0;
+  double limit   = set->spin;
+  int    rc;
+  
+  if ((*ptimeout >= 0.0) && (*ptimeout < limit))
+    limit = *ptimeout;
+    
+  do
+  {
+    rc      = (*set->ops->wait)(set,0);
+    elapsed = pollset_now() - start;
+  } while((rc == 0) && (elapsed < limit));
+  
+  set->stats.spin += elapsed;
+  
+  /*----------------------------------------------------------------------
+  ; Errors are passed through without counting as a hit or a miss.
+  ;-----------------------------------------------------------------------*/
+  
+  if (rc > 0)
+  {
+    set->stats.spinhits++;
+    set->spin *= 2.0;
+    if (set->spin > set->spinmax)
+      set->spin = set->spinmax;
+  }
+  else if (rc == 0)
+  {
+    set->spin /= 2.0;
+    if (set->spin < set->spinmax / 64.0)
+      set->spin = set->spinmax / 64.0;
+  }
+  
+  if (*ptimeout >= 0.0)
+  {
+    *ptimeout -= elapsed;
+    if (*ptimeout < 0.0)
+      *ptimeout = 0.0;
+  }
+  
+  return rc;
+}
+
 /**********************************************************************/
 
 static int polllua_wait(lua_State *L)
 {
-  pollset__t     *set     = luaL_checkudata(L,1,TYPE_POLL);
-  double          timeout = luaL_optnumber(L,2,-1.0);
-  struct timeval  tout;
-  struct timeval *ptout;
-  int             events;
+  pollset__t *set     = pollset_check(L,1);
+  lua_Number  timeout = pstimer_timeout(set,luaL_optnumber(L,2,-1.0));
+  double      start   = pollset_now();
+  int         rc;
   
-  if (timeout < 0)
-    ptout = NULL;
-  else
+  if (set->stats.last > 0.0)
+    set->stats.between += start - set->stats.last;
+    
+  /*----------------------------------------------------------------------
+  ; If all we have are timers kept by the set, there's nothing for the
+  ; implementation to wait on (and some won't wait when empty).
+  ;-----------------------------------------------------------------------*/
+  
+  if ((set->idx == set->nemulated) && (set->nheap > 0))
   {
-    double seconds;
-    double fract;
+    struct timespec ts;
     
-    fract        = modf(timeout,&seconds);
-    tout.tv_sec  = (long)seconds;
-    tout.tv_usec = (long)(fract * 1000000.0);
-    ptout        = &tout;
+    ts.tv_sec  = (time_t)timeout;
+    ts.tv_nsec = (long)((timeout - (double)ts.tv_sec) * 1000000000.0);
+    
+    /*--------------------------------------------------------------------
+    ; No signal can be waiting on us here (signals take a file in the set),
+    ; so an interrupted sleep just continues for the time remaining.
+    ;---------------------------------------------------------------------*/
+    
+    while(((rc = nanosleep(&ts,&ts)) == -1) && (errno == EINTR))
+      ;
+  }
+  else
+  {
+    rc = 0;
+    if ((set->spinmax > 0.0) && (timeout != 0.0))
+      rc = pollset_spin(set,&timeout);
+    if (rc == 0)
+      rc = (*set->ops->wait)(set,timeout);
   }
   
-  set->sread   = set->read;
-  set->swrite  = set->write;
-  set->sexcept = set->except;
-  set->count   = 0;
-  events       = select(FD_SETSIZE,&set->sread,&set->swrite,&set->sexcept,ptout);
+  if (rc >= 0)
+    rc += pstimer_expire(set);
+    
+  pollset_stats(set,start,rc);
   
-  if (events == -1)
+  if (rc < 0)
   {
     lua_pushboolean(L,false);
     lua_pushinteger(L,errno);
@@ -1386,23 +4254,66 @@ static int polllua_wait(lua_State *L)
   else
   {
     lua_pushboolean(L,true);
-    lua_pushboolean(L,events == 0);
+    lua_pushboolean(L,rc == 0);
   }
   return 2;
 }
 
 /**********************************************************************/
 
-static int polllua_events(lua_State *L)
+static int pollset_submit(lua_State *L,unsigned int kind)
 {
-  luaL_checkudata(L,1,TYPE_POLL);
-  lua_pushcfunction(L,pollset_next);
-  lua_pushvalue(L,1);
-  lua_pushnil(L);
-  return 3;
+  pollset__t *set  = pollset_check(L,1);
+  char const *data = NULL;
+  size_t      len  = 0;
+  int         fh;
+  
+  if (kind == PS_SEND)
+    data = luaL_checklstring(L,3,&len);
+  else if (kind == PS_RECV)
+  {
+    lua_Integer size = luaL_optinteger(L,3,RECVSIZE);
+    luaL_argcheck(L,(size > 0) && (size <= INT_MAX),3,"invalid size");
+    len = (size_t)size;
+  }
+  
+  if (set->ops->submit == NULL)
+  {
+    lua_pushinteger(L,ENOTSUP);
+    return 1;
+  }
+  
+  if (!luaL_callmeta(L,2,"_tofd"))
+  {
+    lua_pushinteger(L,EINVAL);
+    return 1;
+  }
+  
+  fh = luaL_checkinteger(L,-1);
+  lua_pushinteger(L,(*set->ops->submit)(set,fh,kind,data,len));
+  return 1;
 }
 
-#endif
+/**********************************************************************/
+
+static int polllua_recv(lua_State *L)
+{
+  return pollset_submit(L,PS_RECV);
+}
+
+/**********************************************************************/
+
+static int polllua_send(lua_State *L)
+{
+  return pollset_submit(L,PS_SEND);
+}
+
+/**********************************************************************/
+
+static int polllua_accept(lua_State *L)
+{
+  return pollset_submit(L,PS_ACCEPT);
+}
 
 /**********************************************************************/
 
@@ -1416,22 +4327,82 @@ int luaopen_org_conman_pollset(lua_State *L)
   #if LUA_VERSION_NUM >= 504
     { "__close"           , polllua___gc          } ,
   #endif
+    { "close"             , polllua___gc          } ,
     { "insert"            , polllua_insert        } ,
     { "update"            , polllua_update        } ,
     { "remove"            , polllua_remove        } ,
     { "wait"              , polllua_wait          } ,
     { "events"            , polllua_events        } ,
+    { "ievents"           , polllua_ievents       } ,
+    { "recv"              , polllua_recv          } ,
+    { "send"              , polllua_send          } ,
+    { "accept"            , polllua_accept        } ,
+    { "timer"             , polllua_timer         } ,
+    { "insert_signal"     , polllua_insert_signal } ,
+    { "stats"             , polllua_stats         } ,
+    { NULL                , NULL                  }
+  };
+  
+  static luaL_Reg const m_timerlua[] =
+  {
+    { "__tostring"        , timerlua___tostring   } ,
+    { "__gc"              , timerlua___gc         } ,
+    { NULL                , NULL                  }
+  };
+  
+  static luaL_Reg const m_signallua[] =
+  {
+    { "__tostring"        , signallua___tostring  } ,
+    { "__gc"              , signallua___gc        } ,
     { NULL                , NULL                  }
   };
   
+  static struct
+  {
+    char const *const text;
+    unsigned int      value;
+  } const m_eventflags[] =
+  {
+    { "READ"              , PS_READ               } ,
+    { "WRITE"             , PS_WRITE              } ,
+    { "PRIORITY"          , PS_PRIORITY           } ,
+    { "ERROR"             , PS_ERROR              } ,
+    { "HANGUP"            , PS_HANGUP             } ,
+    { "INVALID"           , PS_INVALID            } ,
+    { "RDHANGUP"          , PS_RDHANGUP           } ,
+    { "RECV"              , PS_RECV               } ,
+    { "SEND"              , PS_SEND               } ,
+    { "ACCEPT"            , PS_ACCEPT             } ,
+    { "TIMER"             , PS_TIMER              } ,
+    { "SIGNAL"            , PS_SIGNAL             } ,
+    { NULL                , 0                     }
+  };
+  
+  luaL_newmetatable(L,TYPE_TIMER);
+  luaL_setfuncs(L,m_timerlua,0);
+  lua_pop(L,1);
+  
+  luaL_newmetatable(L,TYPE_SIGNAL);
+  luaL_setfuncs(L,m_signallua,0);
+  lua_pop(L,1);
+  
   luaL_newmetatable(L,TYPE_POLL);
   luaL_setfuncs(L,m_polllua,0);
-  lua_pushliteral(L,POLLSET_IMPL);
-  lua_setfield(L,-2,"_implementation");
+  
+  for (size_t i = 0 ; m_eventflags[i].text != NULL ; i++)
+  {
+    lua_pushinteger(L,m_eventflags[i].value);
+    lua_setfield(L,-2,m_eventflags[i].text);
+  }
+  
+  /*----------------------------------------------------------------------
+  ; set._implementation and set._iocp depend upon the implementation used
+  ; for each set, so they're supplied by __index.
+  ;-----------------------------------------------------------------------*/
+  
   lua_pushvalue(L,-1);
-  lua_pushboolean(L,false);
-  lua_setfield(L,-2,"_iocp");
-  lua_setfield(L,-1,"__index");
+  lua_pushcclosure(L,polllua___index,1);
+  lua_setfield(L,-2,"__index");
   
   lua_pushcfunction(L,pollset_lua);
   return 1;
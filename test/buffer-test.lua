@@ -0,0 +1,148 @@
+-- luacheck: ignore 611
+
+local tap    = require "tap14"
+local buffer = require "org.conman.net.buffer"
+
+-- ---------------------------------------------------------------------
+-- Data that won't look right if it's moved around incorrectly
+-- ---------------------------------------------------------------------
+
+local data = string.rep("0123456789",2000)
+
+tap.plan(6)
+
+tap.plan(6,"append and get") do
+  local buf = buffer.new()
+  tap.assert(#buf == 0,"new buffer is empty")
+  
+  buf:append("hello, ")
+  buf:append("")
+  buf:append("world")
+  tap.assert(#buf == 12,"appended data counted")
+  tap.assert(buf:get(5) == "hello","get part of the data")
+  tap.assert(buf:get(-1) == "","get nothing")
+  tap.assert(buf:get() == ", world","get the rest")
+  tap.assert(#buf == 0 and buf:get() == "","buffer is empty again")
+  tap.done()
+end
+
+tap.plan(4,"unget") do
+  local buf = buffer.new()
+  buf:unget("there")
+  tap.assert(buf:get() == "there","unget into an empty buffer")
+  
+  buf:append("abcdef")
+  tap.assert(buf:get(3) == "abc","take from the front")
+  buf:unget("xyz")
+  tap.assert(buf:get() == "xyzdef","unget into the space in front")
+  
+  buf:append("def")
+  buf:unget("abcdefghijklmnopqrstuvwxyz")
+  tap.assert(buf:get() == "abcdefghijklmnopqrstuvwxyzdef","unget more than the space in front")
+  tap.done()
+end
+
+tap.plan(4,"buffer grows and shrinks") do
+  local buf = buffer.new()
+  buf:append(data)
+  tap.assert(#buf == #data,"buffer grew")
+  
+  -- ------------------------------------------------------------------
+  -- These leave at most a quarter of the buffer in use, so it shrinks
+  -- (down to 4K), moving what's left to the front each time.
+  -- ------------------------------------------------------------------
+  
+  local okay = true
+  local at   = 1
+  for _,amount in ipairs { 12005 , 4000 , 2000 , 1000 } do
+    if buf:get(amount) ~= data:sub(at,at + amount - 1) then
+      okay = false
+    end
+    at = at + amount
+  end
+  tap.assert(okay,"data taken intact while shrinking")
+  tap.assert(buf:get() == data:sub(at),"data left intact while shrinking")
+  
+  buf:append(data)
+  tap.assert(buf:get() == data,"buffer grew again")
+  tap.done()
+end
+
+tap.plan(8,"lines") do
+  local buf = buffer.new()
+  buf:append("abc\r")
+  tap.assert(buf:line() == nil,"no line without a line ending")
+  
+  buf:append("\ndef\nghi\r\n")
+  tap.assert(buf:line() == "abc","CRLF split across appends")
+  tap.assert(buf:line() == "def","LF line ending")
+  tap.assert(buf:line(true) == "ghi\r\n","line ending kept")
+  tap.assert(buf:line() == nil and #buf == 0,"no more lines")
+  
+  -- ------------------------------------------------------------------
+  -- The failed search covers "hello", so a line ending put back in
+  -- front of where it stopped has to be found anyway.
+  -- ------------------------------------------------------------------
+  
+  buf:append("hello")
+  tap.assert(buf:line() == nil,"partial line")
+  buf:unget("ab\n")
+  tap.assert(buf:line() == "ab","line found after unget")
+  buf:append(", world\n")
+  tap.assert(buf:line() == "hello, world","search resumed with more data")
+  tap.done()
+end
+
+tap.plan(8,"headers") do
+  local buf = buffer.new()
+  buf:append("A: 1\r\nB: 2\r\n")
+  tap.assert(buf:header() == nil,"no header without a blank line")
+  tap.assert(buf:line() == "A: 1","line() after a failed header()")
+  
+  buf:append("\r")
+  tap.assert(buf:header() == nil,"blank line split across appends")
+  buf:append("\nbody")
+  tap.assert(buf:header() == "B: 2\r\n\r\n","header found")
+  tap.assert(buf:get() == "body","data after the header left")
+  
+  buf:append("X: 1")
+  tap.assert(buf:line() == nil,"partial line")
+  buf:append("\n\nY")
+  tap.assert(buf:header() == "X: 1\n\n","header() after a failed line()")
+  tap.assert(buf:line() == nil and buf:get() == "Y","data after the header left")
+  tap.done()
+end
+
+tap.plan(10,"numbers") do
+  local buf = buffer.new()
+  local n,more
+  
+  buf:append("  12")
+  n,more = buf:number()
+  tap.assert(n == nil and more == true,"more data needed for a number")
+  n,more = buf:number(true)
+  tap.assert(n == 12 and more == false,"number at EOF")
+  tap.assert(#buf == 0,"number and whitespace removed")
+  
+  buf:append("3.5e")
+  n,more = buf:number()
+  tap.assert(n == nil and more == true,"exponent split across appends")
+  buf:append("2 0x1F,")
+  n,more = buf:number()
+  tap.assert(n == 350 and more == false,"number with exponent")
+  n = buf:number()
+  tap.assert(n == 31,"hex number")
+  tap.assert(buf:get() == ",","data after the number left")
+  
+  buf:append("abc")
+  n,more = buf:number(true)
+  tap.assert(n == nil and more == false,"not a number")
+  tap.assert(buf:get() == "abc","nothing removed")
+  
+  buf:append("-")
+  n,more = buf:number(true)
+  tap.assert(n == nil and more == false and #buf == 0,"sign without digits removed at EOF")
+  tap.done()
+end
+
+os.exit(tap.done(),true)
@@ -1,8 +1,14 @@
 
 -- luacheck: ignore 611
 
-local tap = require "tap14"
-local net = require "org.conman.net"
+local tap    = require "tap14"
+local net    = require "org.conman.net"
+local ios    = require "org.conman.net.ios"
+local errno  = require "org.conman.errno"
+local buffer = require "org.conman.net.buffer"
+local tcp    = require "org.conman.nfl.tcp"
+
+require "org.conman.fsys" -- for file:_tofd()
 
 local function compare_lists(a,b)
   if (#a ~= #b) then return false end
@@ -16,7 +22,7 @@ end
 -- Address tests
 -- ---------------------------------------------------------------------
 
-tap.plan(7)
+tap.plan(12)
 
 local function address_test(case)
   tap.plan(10,case.desc)
@@ -173,4 +179,174 @@ table.remove(list2) -- last slot with 0.  So remove that 0.
 table.sort(list1)
 
 tap.assert(compare_lists(list1,list2),"test sortability")
+
+-- ---------------------------------------------------------------------
+-- Socket primitives
+-- ---------------------------------------------------------------------
+
+tap.plan(6,"sendv") do
+  local chunks       = { "abc" , "defg" , "hi" }
+  local first,offset = ios.advance(chunks,1,0,5)
+  tap.assert(first == 2 and offset == 2,"advance() stops in the middle of a chunk")
+  first,offset = ios.advance(chunks,first,offset,2)
+  tap.assert(first == 3 and offset == 0,"advance() resumes in the middle of a chunk")
+  
+  local a,b  = net.socketpair()
+  local many = {}
+  for i = 1 , 100 do
+    many[i] = string.format("%09d\n",i)
+  end
+  
+  tap.assert(a:sendv(many) == 640,"at most 64 chunks written per call")
+  tap.assert(a:sendv(many,65) == 360,"the rest written from a later chunk")
+  local _,data = b:recv()
+  tap.assert(data == table.concat(many),"chunks arrive in order")
+  
+  -- ------------------------------------------------------------------
+  -- With a small send buffer, writes are partial and end in the middle
+  -- of chunks.
+  -- ------------------------------------------------------------------
+  
+  local big = {}
+  local got = {}
+  local mid = false
+  
+  for i = 1 , 50 do
+    big[i] = string.rep(string.char(65 + i % 26),997)
+  end
+  
+  a.nonblock   = true
+  b.nonblock   = true
+  a.sendbuffer = 4096
+  first,offset = 1,0
+  
+  for _ = 1 , 100000 do
+    local bytes,err = a:sendv(big,first,offset)
+    if bytes < 0 then
+      if err ~= errno.EAGAIN then break end
+    else
+      first,offset = ios.advance(big,first,offset,bytes)
+      mid          = mid or offset > 0
+    end
+    
+    repeat
+      local _,chunk = b:recv()
+      got[#got + 1] = chunk
+    until not chunk
+    
+    if first > #big then break end
+  end
+  
+  tap.assert(mid and table.concat(got) == table.concat(big),"partial writes resumed mid-chunk")
+  a:close()
+  b:close()
+  tap.done()
+end
+
+tap.plan(5,"sendfile") do
+  local name    = os.tmpname()
+  local content = string.rep("0123456789",100)
+  local f       = io.open(name,"wb")
+  f:write(content)
+  f:close()
+  
+  local a,b = net.socketpair()
+  f = io.open(name,"rb")
+  
+  local bytes,err = a:sendfile(f,100,50)
+  local _,data    = b:recv()
+  tap.assert(bytes == 50 and err == 0,"part of a file sent")
+  tap.assert(data == content:sub(101,150),"data sent from the offset")
+  
+  bytes  = a:sendfile(f,990)
+  _,data = b:recv()
+  tap.assert(bytes == 10 and data == content:sub(991),"rest of the file sent")
+  tap.assert(a:sendfile(f,1000) == 0,"nothing sent at the end of the file")
+  tap.assert(f:seek() == 0,"file position unchanged")
+  
+  f:close()
+  os.remove(name)
+  a:close()
+  b:close()
+  tap.done()
+end
+
+for _,splice in ipairs { true , false } do
+  tap.plan(6,"relay:move() " .. (splice and "splicing" or "copying")) do
+    local a1,a2 = net.socketpair()
+    local b1,b2 = net.socketpair()
+    a2.nonblock = true
+    b1.nonblock = true
+    
+    local relay,err = net.relay(nil,splice)
+    tap.assert(relay and err == 0,"relay created")
+    tap.assert(splice or tostring(relay):find("copy",1,true),"copying when not splicing")
+    
+    a1:send(nil,"hello, world")
+    local bytes,state
+    bytes,err,state = relay:move(a2,b1)
+    tap.assert(bytes == 12 and err == 0 and state == 'r',"data moved until the source blocks")
+    local _,data = b2:recv()
+    tap.assert(data == "hello, world","data relayed")
+    
+    a1:shutdown('w')
+    bytes,err,state = relay:move(a2,b1)
+    tap.assert(bytes == 0 and err == 0 and state == 'eof',"end of file relayed")
+    
+    relay:close()
+    tap.assert(not pcall(relay.move,relay,a2,b1),"closed relay can't move data")
+    a1:close()
+    a2:close()
+    b1:close()
+    b2:close()
+    tap.done()
+  end
+end
+
+-- ---------------------------------------------------------------------
+-- tcp.relay() failing before it takes over the sockets.  These only get
+-- as far as the buffered data, so plain tables stand in for the I/O
+-- objects.
+-- ---------------------------------------------------------------------
+
+local function fakeios(data)
+  local rbuf = buffer.new()
+  if data then rbuf:append(data) end
+  return {
+    __handler = true,
+    _readbuf  = rbuf,
+    sent      = {},
+    flush     = function() return true end,
+    _drain    = function(self,d) self.sent[#self.sent + 1] = d return true end,
+  }
+end
+
+tap.plan(5,"tcp.relay() early failures") do
+  local a,b = fakeios("hello"),fakeios()
+  b.flush   = function() return false,"broken pipe" end
+  local atob,btoa,reason = tcp.relay(a,b)
+  tap.assert(atob == 0 and btoa == 0 and reason == "broken pipe","flush failure reported")
+  
+  local made     = {}
+  local netrelay = net.relay
+  
+  net.relay = function()
+    if #made > 0 then
+      return nil,errno.EMFILE
+    end
+    made[1] = { close = function(self) self.closed = true end }
+    return made[1],0
+  end
+  
+  a,b = fakeios("hello"),fakeios("hi!")
+  atob,btoa,reason = tcp.relay(a,b)
+  net.relay = netrelay
+  
+  tap.assert(atob == 5 and btoa == 3,"buffered data counted")
+  tap.assert(b.sent[1] == "hello" and a.sent[1] == "hi!","buffered data passed on")
+  tap.assert(reason == errno[errno.EMFILE],"relay failure reported")
+  tap.assert(made[1].closed,"first relay closed")
+  tap.done()
+end
+
 os.exit(tap.done(),true)
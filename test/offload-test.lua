@@ -0,0 +1,104 @@
+-- luacheck: ignore 611
+
+local tap     = require "tap14"
+local offload = require "org.conman.offload"
+local pollset = require "org.conman.pollset"
+local process = require "org.conman.process"
+local errno   = require "org.conman.errno"
+
+require "org.conman.fsys" -- for file:_tofd()
+
+-- ---------------------------------------------------------------------
+-- A file to work on, and a way to wait for results.
+-- ---------------------------------------------------------------------
+
+local name    = os.tmpname()
+local content = string.rep("0123456789",1000)
+local f       = io.open(name,"wb")
+f:write(content)
+f:close()
+
+local function results(pool,n)
+  local set   = pollset()
+  local got   = {}
+  local count = 0
+  
+  set:insert(pool,'r')
+  for _ = 1 , 10 do
+    if count == n then break end
+    set:wait(1)
+    while true do
+      local r = { pool:result() }
+      if not r[1] then break end
+      got[r[1]] = r
+      count     = count + 1
+    end
+  end
+  
+  set:remove(pool)
+  return got,count
+end
+
+-- ---------------------------------------------------------------------
+
+tap.plan(3)
+
+local pool,err = offload.pool(2)
+tap.assert(pool and err == 0,"pool created")
+
+tap.plan(8,"operations") do
+  f = io.open(name,"rb")
+  
+  local ids =
+  {
+    pool:submit('stat',name),
+    pool:submit('stat',name .. ".missing"),
+    pool:submit('read',name),
+    pool:submit('read',name,5),
+    (pool:submit('fsync',f)),
+  }
+  
+  local got,count = results(pool,#ids)
+  tap.assert(count == #ids,"all operations completed")
+  tap.assert(got[ids[1]][2].type == 'file' and got[ids[1]][2].size == #content,"stat of a file")
+  tap.assert(got[ids[2]][2] == nil and got[ids[2]][3] == errno.ENOENT,"stat of a missing file")
+  tap.assert(got[ids[3]][2] == content and got[ids[3]][3] == 0,"read a file")
+  tap.assert(got[ids[4]][2] == content:sub(1,5),"read part of a file")
+  tap.assert(got[ids[5]][2] == 0,"fsync a file")
+  tap.assert(pool:result() == nil,"no more results")
+  tap.assert(not pcall(pool.submit,pool,'unlink',name),"unknown operation")
+  
+  f:close()
+  tap.done()
+end
+
+-- ---------------------------------------------------------------------
+-- The threads don't exist in a child process, so closing the pool there
+-- (explicitly or via __gc) can't wait on them, and has to leave the
+-- parent's pool alone.
+-- ---------------------------------------------------------------------
+
+tap.plan(4,"closed in a child process") do
+  local child = process.fork()
+  if child == 0 then
+    getmetatable(pool).__gc(pool)
+    pool:close()
+    process.exit(pool:submit('stat',name) == nil and 0 or 1)
+  end
+  
+  local info = process.wait(child)
+  tap.assert(info and info.rc == 0,"child closed the pool")
+  
+  local id  = pool:submit('stat',name)
+  local got = results(pool,1)
+  tap.assert(got[id] and got[id][2].size == #content,"parent's pool still works")
+  
+  pool:close()
+  local none,err2 = pool:submit('stat',name)
+  tap.assert(none == nil and err2 == errno.EBADF,"closed pool refuses work")
+  tap.assert(pool:result() == nil,"closed pool has no results")
+  tap.done()
+end
+
+os.remove(name)
+os.exit(tap.done(),true)
@@ -3,6 +3,10 @@
 local tap     = require "tap14"
 local fsys    = require "org.conman.fsys"
 local pollset = require "org.conman.pollset"
+local net     = require "org.conman.net"
+local errno   = require "org.conman.errno"
+local process = require "org.conman.process"
+local signal  = require "org.conman.signal"
 
 -- -------------------------------------------------------------
 -- create some data to schlep around, and a pipe to select upon
@@ -17,11 +21,11 @@ pipe.write:setvbuf('no')
 -- Run the tests
 -- ----------------
 
-tap.plan(6)
+tap.plan(20)
 local set do
   set = pollset()
   tap.assertB(set,"set creation")
-  tap.assertB(set._implementation,"We're testing the %s implementation",set._implemenation or "-")
+  tap.assertB(set._implementation,"We're testing the %s implementation",set._implementation or "-")
 end
 
 tap.plan(7,"timeout test (5 seconds)") do
@@ -113,4 +117,388 @@ tap.plan(16,"testing write readiness") do
 	tap.done()
 end
 
+tap.plan(7,"events without tables") do
+	pipe.write:write(data)
+	
+	local n,flags,what = 0
+	set:wait(5)
+	for obj,events in set:ievents() do n,flags,what = n + 1,events,obj end
+	tap.assert(n == 1,"one event")
+	tap.assert(flags == set.READ,"integer flags")
+	tap.assert(what == pipe.read:_tofd(),"default object")
+	
+	set:wait(5)
+	for _,events in set:ievents('string') do flags = events end
+	tap.assert(flags == "r","string flags")
+	
+	local t = {}
+	set:wait(5)
+	for obj,events in set:ievents(t) do flags,what = events,obj end
+	tap.assert(flags == t,"caller supplied table")
+	tap.assert(t.read and not t.write and t.obj == what,"table filled in")
+	
+	tap.assert(#pipe.read:read(256) == 256,"we have data")
+	tap.done()
+end
+
+tap.plan(5,"one shot events") do
+	local set2 = pollset()
+	local function count()
+	  local n = 0
+	  set2:wait(0)
+	  for _ in set2:ievents() do n = n + 1 end
+	  return n
+	end
+	
+	tap.assert(set2:insert(pipe.read,"ro") == 0,"insert one shot read event")
+	pipe.write:write(data)
+	tap.assert(count() == 1,"first event reported")
+	tap.assert(count() == 0,"no event until re-armed")
+	tap.assert(set2:update(pipe.read,"ro") == 0,"re-armed")
+	tap.assert(count() == 1,"event reported after re-arming")
+	
+	pipe.read:read(256)
+	set2:remove(pipe.read)
+	tap.done()
+end
+
+tap.plan(2,"edge triggered support") do
+	local bad = 0
+	
+	for _,name in ipairs { 'epoll' , 'uring' , 'kqueue' , 'poll' , 'select' } do
+	  local set2 = pollset(name)
+	  if set2 then
+	    local edge = set2._flags:find('e',1,true) ~= nil
+	    local err  = set2:insert(pipe.read,"re")
+	    tap.comment("%s supports %q",set2._implementation,set2._flags)
+	    if edge ~= (err == 0) or (not edge and err ~= errno.ENOTSUP) then
+	      bad = bad + 1
+	    end
+	    set2:remove(pipe.read)
+	  end
+	end
+	
+	tap.assert(bad == 0,"edge triggered files refused only where unsupported")
+	tap.assert(pollset('poll')._flags:find('e',1,true) == nil,"poll doesn't support edge triggered files")
+	tap.done()
+end
+
+tap.plan(5,"maxevents limits events per wait") do
+	local set2  = pollset { maxevents = 1 }
+	local pipe2 = fsys.pipe()
+	pipe2.write:setvbuf('no')
+	
+	set2:insert(pipe.read,"r")
+	set2:insert(pipe2.read,"r")
+	pipe.write:write(data)
+	pipe2.write:write(data)
+	
+	local function count()
+	  local n = 0
+	  set2:wait(0)
+	  for _ in set2:events() do n = n + 1 end
+	  return n
+	end
+	
+	if set2._implementation == 'epoll' or set2._implementation == 'kqueue' then
+	  tap.assert(count() == 1,"one event on the first wait")
+	  tap.assert(count() == 1,"one event on the second wait")
+	else
+	  tap.assert(count() == 2,"maxevents ignored by %s",set2._implementation)
+	  tap.assert(count() == 2,"maxevents ignored by %s",set2._implementation)
+	end
+	
+	tap.assert(#pipe.read:read(256)  == 256,"drained first pipe")
+	tap.assert(#pipe2.read:read(256) == 256,"drained second pipe")
+	tap.assert(count() == 0,"no further events")
+	
+	set2:remove(pipe.read)
+	set2:remove(pipe2.read)
+	pipe2.read:close()
+	pipe2.write:close()
+	tap.done()
+end
+
+tap.plan(3,"selecting implementations") do
+	local bad   = 0
+	local found = 0
+	
+	for _,name in ipairs { 'epoll' , 'uring' , 'kqueue' , 'poll' , 'select' } do
+	  local set2,err = pollset(name)
+	  if set2 then
+	    tap.comment("%s available as %s",name,set2._implementation)
+	    found = found + 1
+	    if set2._implementation ~= name
+	    and not (name == 'uring' and set2._implementation == 'epoll') then
+	      bad = bad + 1
+	    end
+	  elseif err ~= errno.ENOTSUP then
+	    bad = bad + 1
+	  end
+	end
+	
+	local set2,err = pollset('bogus')
+	tap.assert(found >= 2,"poll and select are always available")
+	tap.assert(bad == 0,"each set reports its implementation")
+	tap.assert(not set2 and err == errno.ENOTSUP,"unknown implementation")
+	tap.done()
+end
+
+tap.plan(5,"completion based I/O") do
+	local set2 = pollset('uring') or pollset()
+	local a,b  = net.socketpair()
+	
+	local function results()
+	  local r = {}
+	  set2:wait(1)
+	  for _,events,result in set2:ievents('string') do
+	    r[events] = result
+	  end
+	  return r
+	end
+	
+	tap.comment("using %s",set2._implementation)
+	tap.assert(set2:insert(a,"") == 0,"inserted socket")
+	
+	if set2._iocp then
+	  tap.assert(set2:send(a,"hello") == 0,"send started")
+	  tap.assert(results().S == 5,"sent five bytes")
+	  tap.assert(set2:recv(a) == 0,"receive started")
+	  local _,data = b:recv()
+	  b:send(nil,data)
+	  tap.assert(results().R == "hello","received data")
+	else
+	  tap.assert(set2:send(a,"hello") == errno.ENOTSUP,"send not supported")
+	  tap.assert(set2:recv(a)         == errno.ENOTSUP,"recv not supported")
+	  tap.assert(set2:accept(a)       == errno.ENOTSUP,"accept not supported")
+	  tap.assert(not set2._iocp,"%s is not completion based",set2._implementation)
+	end
+	
+	set2:remove(a)
+	a:close()
+	b:close()
+	tap.done()
+end
+
+tap.plan(7,"timers") do
+	local set2 = pollset()
+	
+	local function results(timeout)
+	  local r = {}
+	  set2:wait(timeout)
+	  for obj,events,count in set2:ievents() do
+	    if events == set2.TIMER then
+	      r[obj] = count
+	    end
+	  end
+	  return r
+	end
+	
+	local once,err = set2:timer(0.01,"once")
+	tap.assert(once and err == 0,"one shot timer created")
+	tap.assert(results(1).once == 1,"one shot timer expired")
+	tap.assert(results(0.05).once == nil,"one shot timer expired only once")
+	
+	local tick = set2:timer(0.01,"tick",0.01)
+	local r1   = results(1)
+	local r2   = results(1)
+	tap.assert(r1.tick and r1.tick >= 1 and r2.tick and r2.tick >= 1,"periodic timer expired twice")
+	
+	local num = set2:timer(0.001,0.001)
+	local n   = 0
+	for _ = 1 , 5 do
+	  if results(0.05)[0.001] then n = n + 1 end
+	end
+	tap.assert(n == 1,"numeric object isn't an interval")
+	
+	tap.assert(set2:remove(tick) == 0 and set2:remove(once) == 0 and set2:remove(num) == 0,"timers removed")
+	tap.assert(#set2 == 0 and results(0.03).tick == nil,"no more timer events")
+	tap.done()
+end
+
+tap.plan(6,"emulated timers with files") do
+	local set2 = pollset('poll',{ timerfd = false }) or pollset('poll')
+	local a,b  = net.socketpair()
+	local c,d  = net.socketpair()
+	
+	local function results(timeout)
+	  local r = {}
+	  set2:wait(timeout)
+	  for obj,events in set2:ievents() do
+	    r[obj] = events
+	  end
+	  return r
+	end
+	
+	tap.comment("using %s",set2._implementation)
+	local t1 = set2:timer(0.01,"t1")
+	tap.assert(set2:insert(a,'r',"a") == 0,"file inserted after a timer")
+	local t2 = set2:timer(5,"t2")
+	tap.assert(set2:insert(c,'r',"c") == 0,"file inserted between timers")
+	
+	local r = results(1)
+	tap.assert(r.t1 == set2.TIMER and not r.a and not r.c,"timer reported")
+	
+	b:send(nil,"x")
+	d:send(nil,"x")
+	r = results(1)
+	tap.assert(r.a and r.c and not r.t1,"files reported")
+	tap.assert(set2:remove(a) == 0 and set2:remove(t1) == 0,"file and timer removed")
+	
+	r = results(0)
+	tap.assert(r.c and not r.a and not r.t1 and #set2 == 2,"remaining file still reported")
+	
+	set2:remove(c)
+	set2:remove(t2)
+	a:close() b:close()
+	c:close() d:close()
+	tap.done()
+end
+
+tap.plan(5,"signals") do
+	local set2 = pollset()
+	
+	local sig,err = set2:insert_signal({ 'usr1' },"usr1")
+	tap.assert(sig and err == 0,"signal handle created")
+	
+	signal.raise('usr1')
+	set2:wait(1)
+	local obj,events,info
+	for o,e,r in set2:ievents() do
+	  obj,events,info = o,e,r
+	end
+	tap.assert(obj == "usr1" and events == set2.SIGNAL,"signal reported as an event")
+	tap.assert(type(info) == 'table' and info.signal == 'usr1',"signal information returned")
+	tap.assert(set2:remove(sig) == 0,"signal handle removed")
+	tap.assert(#set2 == 0,"set is empty")
+	tap.done()
+end
+
+tap.plan(5,"wakeup") do
+	local set2 = pollset()
+	local wake,err = fsys.wakeup()
+	tap.assert(wake and err == 0,"wakeup object created")
+	tap.assert(set2:insert(wake,'r') == 0,"wakeup object added")
+	
+	wake:signal()
+	wake:signal(2)
+	set2:wait(1)
+	local n = 0
+	for obj in set2:ievents() do
+	  if obj == wake then n = n + 1 end
+	end
+	tap.assert(n == 1,"signals coalesced into one event")
+	
+	local count = wake:drain()
+	tap.assert(count > 0 and wake:drain() == 0,"wakeup object drained")
+	
+	set2:wait(0)
+	n = 0
+	for _ in set2:ievents() do n = n + 1 end
+	tap.assert(n == 0,"no event after drain")
+	set2:remove(wake)
+	wake:close()
+	tap.done()
+end
+
+tap.plan(3,"statistics") do
+	local set2 = pollset()
+	set2:wait(0)
+	set2:wait(0)
+	local stats = set2:stats(true)
+	tap.assert(stats.waits == 2 and stats.events == 0,"waits counted")
+	tap.assert(stats.histogram[1] == 2,"waits without events counted")
+	tap.assert(set2:stats().waits == 0,"statistics reset")
+	tap.done()
+end
+
+tap.plan(2,"closed set") do
+	local set2 = pollset()
+	set2:close()
+	tap.assert(not pcall(set2.wait,set2,0),"closed set can't be used")
+	tap.assert(pcall(getmetatable(set2).__gc,set2),"closing twice is harmless")
+	tap.done()
+end
+
+tap.plan(4,"closed in a child process") do
+	local set2  = pollset()
+	local pipe2 = fsys.pipe()
+	local sig   = set2:insert_signal('usr2',"usr2")
+	set2:insert(pipe2.read,'r')
+	
+	local child = process.fork()
+	if child == 0 then
+	  set2:close()
+	  process.exit(0)
+	end
+	
+	local info = process.wait(child)
+	tap.assert(info and info.rc == 0,"child closed the set")
+	
+	pipe2.write:setvbuf('no')
+	pipe2.write:write("x")
+	signal.raise('usr2')
+	tap.assert(set2:wait(1),"parent still waits")
+	
+	local seen = {}
+	for obj in set2:ievents() do
+	  seen[obj] = true
+	end
+	tap.assert(seen[pipe2.read],"parent still sees the file")
+	tap.assert(seen.usr2,"parent still sees the signal")
+	
+	set2:remove(sig)
+	pipe2.read:close()
+	pipe2.write:close()
+	tap.done()
+end
+
+tap.plan(5,"10,000 files") do
+	local set2  = pollset('poll') or pollset()
+	local files = {}
+	local max   = 10000
+	local err   = 0
+	local n     = 0
+	
+	process.limits.soft.nofile = process.limits.hard.nofile
+	if process.limits.soft.nofile < max + 64 then
+	  max = process.limits.soft.nofile - 64
+	end
+	
+	tap.comment("using %s with %d files",set2._implementation,max)
+	
+	for i = 1 , max do
+	  files[i] = pipe.write:_dup('w')
+	  err      = math.max(err,set2:insert(files[i],"r",files[i]))
+	end
+	
+	tap.assert(err == 0 and #set2 == max,"inserted all files")
+	
+	for i = 1 , max , 2 do
+	  err = math.max(err,set2:update(files[i],"w"))
+	end
+	
+	tap.assert(err == 0,"updated half the files")
+	
+	set2:wait(0)
+	for obj in set2:ievents() do
+	  n   = n + 1
+	  err = math.max(err,set2:remove(obj))
+	end
+	
+	tap.assert(n == math.floor((max + 1) / 2),"events for updated files")
+	tap.assert(err == 0 and #set2 == max - n,"removed files while reporting")
+	
+	for i = 2 , max , 2 do
+	  err = math.max(err,set2:remove(files[i]))
+	end
+	
+	tap.assert(err == 0 and #set2 == 0,"removed remaining files")
+	
+	for i = 1 , max do
+	  files[i]:close()
+	end
+	tap.done()
+end
+
 os.exit(tap.done(),true)